@@ -3,9 +3,15 @@
 #pragma warning(disable : 4786)
 
 #include "RayTracer.h"
+#include "RenderCheckpoint.h"
+#include "ThreadPool.h"
 #include "scene/light.h"
 #include "scene/material.h"
 #include "scene/ray.h"
+#include "scene/sampler.h"
+#include "scene/snapshot.h"
+
+#include "fileio/images.h"
 
 #include "parser/JsonParser.h"
 #include "parser/Parser.h"
@@ -14,13 +20,18 @@
 
 #include "ui/TraceUI.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
 #include <string.h> // for memset
 
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
 
 using namespace std;
 extern TraceUI *traceUI;
@@ -32,160 +43,413 @@ bool debugMode = false;
 // Trace a top-level ray through pixel(i,j), i.e. normalized window coordinates
 // (x,y), through the projection plane, and out into the scene. All we do is
 // enter the main ray-tracing method, getting things started by plugging in an
-// initial ray weight of (0.0,0.0,0.0) and an initial recursion depth of 0.
+// initial ray weight of (1.0,1.0,1.0) and the full recursion depth. The
+// result is linear and unclamped; the 8-bit image clamps each sample.
+
+// sample is where this ray's first hit goes in the G-buffer, or -1 if
+// it isn't kept.
 
-glm::dvec3 RayTracer::trace(double x, double y) {
+glm::dvec3 RayTracer::trace(double x, double y, int64_t sample) {
   // Clear out the ray cache in the scene for debugging purposes,
   if (TraceUI::m_debug) {
-    scene->clearIntersectCache();
+    scene->clearDebugRays();
   }
 
+  ray r = cameraRay(x, y);
+  if (sample < 0) {
+    double dummy;
+    return traceRay(r, glm::dvec3(1.0, 1.0, 1.0), traceUI->getDepth(), dummy);
+  }
+  isect i;
+  bool hit = firstHit(r, i, sample);
+  return traceHit(r, i, hit, glm::dvec3(1.0, 1.0, 1.0), traceUI->getDepth());
+}
+
+// The first hit of camera ray r. A render finds it in the scene and
+// writes down the object in G-buffer entry sample; relighting only has to
+// intersect that object again, which gives the same hit with the object's
+// current material.
+bool RayTracer::firstHit(ray &r, isect &i, size_t sample) {
+  if (relighting) {
+    const Geometry *obj = gbuffer[sample];
+    bool hit = obj && obj->intersect(r, i);
+    if (ray_footprint.mask)
+      ray_footprint.grid->addRay(
+          r, hit ? i.getT() : std::numeric_limits<double>::infinity(),
+          *ray_footprint.mask);
+    return hit;
+  }
+  bool hit = scene->intersect(r, i);
+  gbuffer[sample] = hit ? i.getObject() : nullptr;
+  return hit;
+}
+
+Camera &RayTracer::camera() {
+  return cameraOverride ? *cameraOverride : scene->getCamera();
+}
+
+void RayTracer::setCamera(const Camera &c) {
+  cameraOverride.reset(new Camera(c));
+}
+
+void RayTracer::clearCamera() { cameraOverride.reset(); }
+
+// The camera ray through normalized window coordinates (x,y). Its cone
+// starts at the eye and spreads by the angle one sample subtends, which is
+// what texture lookups use to choose a mip level.
+ray RayTracer::cameraRay(double x, double y) {
   ray r(glm::dvec3(0, 0, 0), glm::dvec3(0, 0, 0), glm::dvec3(1, 1, 1),
         ray::VISIBILITY);
-  scene->getCamera().rayThrough(x, y, r);
-  double dummy;
-  glm::dvec3 ret =
-      traceRay(r, glm::dvec3(1.0, 1.0, 1.0), traceUI->getDepth(), dummy);
-  ret = glm::clamp(ret, 0.0, 1.0);
-  return ret;
+  camera().rayThrough(x, y, r);
+  r.setCone(0.0, coneSpread);
+  return r;
+}
+
+// Seed for the samples of pixel (i,j) in progressive pass `pass` (0 for
+// ordinary renders). Seeding per pixel of the frame rather than per
+// thread makes an image independent of how its blocks were shared out
+// between threads, and a region the same as that part of the full frame.
+uint64_t RayTracer::pixelSeed(int i, int j, int pass) const {
+  return (uint64_t(pass) << 40) ^ (uint64_t(region_y + j) << 20) ^
+         uint64_t(region_x + i);
 }
 
 glm::dvec3 RayTracer::tracePixel(int i, int j) {
   glm::dvec3 col(0, 0, 0);
+  glm::dvec3 linear(0, 0, 0);
 
   if (!sceneLoaded())
     return col;
 
   int numSamples = samples;
+  int64_t first = gbuffer.empty()
+                      ? -1
+                      : (int64_t(j) * buffer_width + i) * numSamples * numSamples;
 
+  ray_sampler.reseed(pixelSeed(i, j, 0));
   for (int p = 0; p < numSamples; ++p) {
       for (int q = 0; q < numSamples; ++q) {
-          // double xOffset = (double(p) + 0.5) / double(numSamples);
-          // double yOffset = (double(q) + 0.5) / double(numSamples);
-          double r1 = double(rand()) / RAND_MAX;
-          double r2 = double(rand()) / RAND_MAX;
-
-          double xOffset = (double(p) + r1) / double(numSamples);
-          double yOffset = (double(q) + r2) / double(numSamples);
-
-          double x = (double(i) + xOffset) / double(buffer_width);
-          double y = (double(j) + yOffset) / double(buffer_height);
-
-          col += trace(x, y);
+          double x, y;
+          samplePosition(i, j, p, q, x, y);
+          glm::dvec3 c =
+              trace(x, y, first < 0 ? -1 : first + p * numSamples + q);
+          col += glm::clamp(c, 0.0, 1.0);
+          linear += c;
       }
   }
 
   col /= double(numSamples * numSamples);
+  linear /= double(numSamples * numSamples);
 
-  unsigned char *pixel = buffer.data() + (i + j * buffer_width) * 3;
-  pixel[0] = (int)(255.0 * col[0]);
-  pixel[1] = (int)(255.0 * col[1]);
-  pixel[2] = (int)(255.0 * col[2]);
+  setPixel(i, j, col);
+  setLinear(i, j, linear);
   return col;
 }
 
+// Jittered position of sub-sample (p,q) of pixel (i,j) in normalized window
+// coordinates.
+void RayTracer::samplePosition(int i, int j, int p, int q, double &x,
+                               double &y) const {
+  // double xOffset = (double(p) + 0.5) / double(numSamples);
+  // double yOffset = (double(q) + 0.5) / double(numSamples);
+  double r1 = ray_sampler.next();
+  double r2 = ray_sampler.next();
+
+  double xOffset = (double(p) + r1) / double(samples);
+  double yOffset = (double(q) + r2) / double(samples);
+
+  x = frameX(double(i) + xOffset);
+  y = frameY(double(j) + yOffset);
+}
+
 #define VERBOSE 0
 
+// Hand each ray spawned at hit i (reflection, refraction, or the total
+// internal reflection that replaces refraction) to emit, along with the
+// coefficient its color is to be scaled by. The child's atten is the
+// weight of its whole path, i.e. weight times that coefficient. Shared by
+// the recursive tracer and the sorted block tracer so both spawn the same
+// rays. With Russian roulette on, the two draw the pixel's samples in a
+// different order (depth first here, breadth first there), so different
+// rays survive and the images agree only in expectation.
+template <typename Emit>
+static void spawnSecondaryRays(const ray &r, const isect &i,
+                               const glm::dvec3 &weight, Emit &&emit) {
+  const Material &m = i.getMaterial();
+
+  // reflection
+  if (glm::length(m.kr(i)) > 0) {
+    glm::dvec3 N = glm::normalize(i.getN());
+    glm::dvec3 V = glm::normalize(r.getDirection()); 
+    glm::dvec3 R = glm::normalize(glm::reflect(V, N));
+
+    glm::dvec3 P = r.at(i.getT());
+    
+    // Shift slightly along the normal to prevent self-intersection
+    glm::dvec3 offsetN = (glm::dot(N, V) < 0) ? N : -N;
+    ray reflectedRay(P + (offsetN * 0.0001), R, weight * m.kr(i), ray::REFLECTION);
+    reflectedRay.setCone(r.getConeWidth(i.getT()), r.getConeSpread());
+
+    emit(reflectedRay, m.kr(i));
+  }
+
+  // refraction
+  if (glm::length(m.kt(i)) > 0) {
+      glm::dvec3 N = glm::normalize(i.getN());
+      glm::dvec3 V = glm::normalize(r.getDirection());
+
+      double eta;
+      double nDotV = glm::dot(N, V);
+      glm::dvec3 effectiveN;
+
+      if (nDotV < 0) {
+          eta = 1.0 / m.index(i); 
+          effectiveN = N;
+          nDotV = -nDotV;
+      }
+      else {
+          eta = m.index(i) / 1.0;
+          effectiveN = -N;
+      }
+
+      double discriminant = 1.0 - (eta * eta) * (1.0 - nDotV * nDotV);
+      glm::dvec3 P = r.at(i.getT());
+
+      if (discriminant >= 0.0) {
+          double cosThetaT = sqrt(discriminant);
+          glm::dvec3 T = glm::normalize(eta * V + (eta * nDotV - cosThetaT) * effectiveN);
+
+          // Shift slightly along T to prevent self-intersection
+          ray refractedRay(P + (T * 0.0001), T, weight * m.kt(i), ray::REFRACTION);
+          refractedRay.setCone(r.getConeWidth(i.getT()), r.getConeSpread());
+
+          emit(refractedRay, m.kt(i));
+      } else {
+          // Total Internal Reflection! The ray bounces perfectly inside the object.
+          glm::dvec3 R = glm::normalize(glm::reflect(V, effectiveN));
+          ray reflectedRay(P + (R * 0.0001), R, weight * m.kt(i), ray::REFLECTION);
+          reflectedRay.setCone(r.getConeWidth(i.getT()), r.getConeSpread());
+          
+          emit(reflectedRay, m.kt(i));
+      }
+  }
+}
+
+// Decide whether a secondary ray with path weight `weight' is worth tracing.
+// Once the strongest channel of the weight drops below the threshold the ray
+// can no longer make a visible difference and is dropped. With Russian
+// roulette enabled it instead survives with probability weight / threshold,
+// and k is scaled up by the inverse of that so the image stays unbiased.
+bool RayTracer::keepRay(const glm::dvec3 &weight, glm::dvec3 &k) const {
+  double w = std::max(weight[0], std::max(weight[1], weight[2]));
+  if (w >= thresh)
+    return true;
+  if (!traceUI->russianRoulette() || w <= 0.0)
+    return false;
+
+  double survive = w / thresh;
+  if (ray_sampler.next() >= survive)
+    return false;
+  k /= survive;
+  return true;
+}
+
 // Do recursive ray tracing! You'll want to insert a lot of code here (or places
 // called from here) to handle reflection, refraction, etc etc.
+//
+// thresh is the weight the color of r will be scaled by in the final pixel,
+// i.e. the product of the kr/kt coefficients along its path.
 glm::dvec3 RayTracer::traceRay(ray &r, const glm::dvec3 &thresh, int depth,
                                double &t) {
   isect i;
+  bool hit = scene->intersect(r, i);
+  return traceHit(r, i, hit, thresh, depth);
+}
+
+// The color of r, given whether and where it hit.
+glm::dvec3 RayTracer::traceHit(ray &r, isect &i, bool hit,
+                               const glm::dvec3 &thresh, int depth) {
   glm::dvec3 colorC;
 #if VERBOSE
   std::cerr << "== current depth: " << depth << std::endl;
 #endif
 
-  if (scene->intersect(r, i)) {
-    // YOUR CODE HERE
-
+  if (hit) {
     // An intersection occurred!  We've got work to do. For now, this code gets
     // the material for the surface that was intersected, and asks that material
     // to provide a color for the ray.
-
-    // This is a great place to insert code for recursive ray tracing. Instead
-    // of just returning the result of shade(), add some more steps: add in the
-    // contributions from reflected and refracted rays.
-
     const Material &m = i.getMaterial();
     colorC = m.shade(scene.get(), r, i);
 
-    // reflection
-    if (depth > 0 && glm::length(m.kr(i)) > 0) {
-      glm::dvec3 N = glm::normalize(i.getN());
-      glm::dvec3 V = glm::normalize(r.getDirection()); 
-      glm::dvec3 R = glm::normalize(glm::reflect(V, N));
+    // Add in the contributions from reflected and refracted rays.
+    if (depth > 0) {
+      spawnSecondaryRays(r, i, thresh, [&](ray &child, glm::dvec3 k) {
+        if (!keepRay(child.getAtten(), k))
+          return;
+        double dummyT;
+        colorC += k * traceRay(child, thresh * k, depth - 1, dummyT);
+      });
+    }
+  } else {
+    colorC = background(r);
+  }
+#if VERBOSE
+  std::cerr << "== depth: " << depth + 1 << " done, returning: " << colorC
+            << std::endl;
+#endif
+  return colorC;
+}
 
-      glm::dvec3 P = r.at(i.getT());
-      
-      // Shift slightly along the normal to prevent self-intersection
-      glm::dvec3 offsetN = (glm::dot(N, V) < 0) ? N : -N;
-      ray reflectedRay(P + (offsetN * 0.0001), R, glm::dvec3(1.0, 1.0, 1.0), ray::REFLECTION);
+glm::dvec3 RayTracer::background(const ray &r) const {
+  if (traceUI->cubeMap()) {
+    return traceUI->getCubeMap()->getColor(r);
+  } else {
+    return glm::dvec3(0.0, 0.0, 0.0);
+  }
+}
+
+// Spread the low 10 bits of v so that there are two zero bits between each.
+static uint32_t expandBits(uint32_t v) {
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+// Sort key for a queued ray: the direction octant in the top bits, then a
+// 30-bit Morton code of the origin quantised to the scene bounds. Rays that
+// start close together and head the same way end up next to each other, so
+// they are traced back-to-back and walk the same BVH nodes.
+static uint64_t coherenceKey(const ray &r, const BoundingBox &bounds) {
+  glm::dvec3 d = r.getDirection();
+  uint64_t octant = (d[0] < 0 ? 1 : 0) | (d[1] < 0 ? 2 : 0) | (d[2] < 0 ? 4 : 0);
 
-      double dummyT;
-      colorC += m.kr(i) * traceRay(reflectedRay, thresh, depth - 1, dummyT);
+  uint32_t morton = 0;
+  if (!bounds.isEmpty()) {
+    glm::dvec3 extent = bounds.getMax() - bounds.getMin();
+    glm::dvec3 p = r.getPosition() - bounds.getMin();
+    for (int axis = 0; axis < 3; axis++) {
+      double f = extent[axis] > 0 ? p[axis] / extent[axis] : 0.0;
+      uint32_t cell = (uint32_t)(std::min(std::max(f, 0.0), 1.0) * 1023.0);
+      morton |= expandBits(cell) << (2 - axis);
     }
+  }
+  return (octant << 30) | morton;
+}
 
-    // refraction
-    if (depth > 0 && glm::length(m.kt(i)) > 0) {
-        glm::dvec3 N = glm::normalize(i.getN());
-        glm::dvec3 V = glm::normalize(r.getDirection());
+/*
+ * RayTracer::traceBlockSorted
+ *
+ *	Breadth-first version of tracePixel over a whole block. Rather than
+ *	following each reflection and refraction as soon as it is spawned,
+ *	the rays of one generation are collected for the entire block,
+ *	ordered by coherenceKey(), and only then traced. Each queued ray
+ *	remembers the sample it belongs to and the product of the kr/kt
+ *	coefficients along its path, so the summed result is what the
+ *	recursive traceRay() produces: exactly, without Russian roulette,
+ *	and in expectation with it, since keepRay() then draws from the
+ *	pixel's sampler in a different order.
+ */
+void RayTracer::traceBlockSorted(int x0, int y0, int x1, int y1) {
+  int perPixel = samples * samples;
+  int blockWidth = x1 - x0;
+  std::vector<glm::dvec3> sampleColor((x1 - x0) * (y1 - y0) * perPixel,
+                                      glm::dvec3(0, 0, 0));
 
-        double eta;
-        double nDotV = glm::dot(N, V);
-        glm::dvec3 effectiveN;
+  // Where sample s of the block is in the G-buffer.
+  auto gbufferIndex = [&](int s) {
+    int pixel = s / perPixel;
+    return (size_t(y0 + pixel / blockWidth) * buffer_width + x0 +
+            pixel % blockWidth) *
+               perPixel +
+           s % perPixel;
+  };
 
-        if (nDotV < 0) {
-            eta = 1.0 / m.index(i); 
-            effectiveN = N;
-            nDotV = -nDotV;
-        }
-        else {
-            eta = m.index(i) / 1.0;
-            effectiveN = -N;
+  std::vector<QueuedRay> queue, next;
+  queue.reserve(sampleColor.size());
+  for (int j = y0; j < y1; ++j) {
+    for (int i = x0; i < x1; ++i) {
+      int first = ((j - y0) * blockWidth + (i - x0)) * perPixel;
+      ray_sampler.reseed(pixelSeed(i, j, 0));
+      for (int p = 0; p < samples; ++p) {
+        for (int q = 0; q < samples; ++q) {
+          double x, y;
+          samplePosition(i, j, p, q, x, y);
+          ray r = cameraRay(x, y);
+          queue.push_back({r, glm::dvec3(1.0, 1.0, 1.0),
+                           first + p * samples + q, traceUI->getDepth(), 0});
         }
+      }
+    }
+  }
 
-        double discriminant = 1.0 - (eta * eta) * (1.0 - nDotV * nDotV);
-        glm::dvec3 P = r.at(i.getT());
-
-        if (discriminant >= 0.0) {
-            double cosThetaT = sqrt(discriminant);
-            glm::dvec3 T = glm::normalize(eta * V + (eta * nDotV - cosThetaT) * effectiveN);
-
-            // Shift slightly along T to prevent self-intersection
-            ray refractedRay(P + (T * 0.0001), T, glm::dvec3(1.0, 1.0, 1.0), ray::REFRACTION);
-
-            double dummyT;
-            colorC += m.kt(i) * traceRay(refractedRay, thresh, depth - 1, dummyT);
-        } else {
-            // Total Internal Reflection! The ray bounces perfectly inside the object.
-            glm::dvec3 R = glm::normalize(glm::reflect(V, effectiveN));
-            ray reflectedRay(P + (R * 0.0001), R, glm::dvec3(1.0, 1.0, 1.0), ray::REFLECTION);
-            
-            double dummyT;
-            colorC += m.kt(i) * traceRay(reflectedRay, thresh, depth - 1, dummyT);
+  // Primary rays are already in scanline order; only later generations
+  // are shuffled enough to be worth sorting.
+  bool primary = true;
+  while (!queue.empty() && !stopTrace) {
+    if (!primary) {
+      for (auto &qr : queue)
+        qr.key = coherenceKey(qr.r, scene->bounds());
+      std::sort(queue.begin(), queue.end(),
+                [](const QueuedRay &a, const QueuedRay &b) {
+                  return a.key < b.key;
+                });
+      TraceUI::addStat(TraceUI::SORTED_RAYS, ray_thread_id, queue.size());
+    }
+
+    for (auto &qr : queue) {
+      isect i;
+      bool hit = primary && !gbuffer.empty()
+                     ? firstHit(qr.r, i, gbufferIndex(qr.sample))
+                     : scene->intersect(qr.r, i);
+      if (hit) {
+        const Material &m = i.getMaterial();
+        sampleColor[qr.sample] += qr.weight * m.shade(scene.get(), qr.r, i);
+        if (qr.depth > 0) {
+          spawnSecondaryRays(qr.r, i, qr.weight,
+                             [&](ray &child, glm::dvec3 k) {
+                               if (!keepRay(child.getAtten(), k))
+                                 return;
+                               next.push_back({child, qr.weight * k, qr.sample,
+                                               qr.depth - 1, 0});
+                             });
         }
+      } else {
+        sampleColor[qr.sample] += qr.weight * background(qr.r);
+      }
     }
-  } else {
-    if (traceUI->cubeMap()) {
-      colorC = traceUI->getCubeMap()->getColor(r);
-    } else {
-      colorC = glm::dvec3(0.0, 0.0, 0.0);
+
+    queue.swap(next);
+    next.clear();
+    primary = false;
+  }
+
+  for (int j = y0; j < y1; ++j) {
+    for (int i = x0; i < x1; ++i) {
+      int first = ((j - y0) * blockWidth + (i - x0)) * perPixel;
+      glm::dvec3 col(0, 0, 0), linear(0, 0, 0);
+      for (int s = 0; s < perPixel; ++s) {
+        col += glm::clamp(sampleColor[first + s], 0.0, 1.0);
+        linear += sampleColor[first + s];
+      }
+      setPixel(i, j, col / double(perPixel));
+      setLinear(i, j, linear / double(perPixel));
     }
   }
-#if VERBOSE
-  std::cerr << "== depth: " << depth + 1 << " done, returning: " << colorC
-            << std::endl;
-#endif
-  return colorC;
 }
 
 RayTracer::RayTracer()
     : scene(nullptr), buffer(0), thresh(0), buffer_width(0), buffer_height(0),
-      m_bBufferReady(false) {
+      frame_width(0), frame_height(0), region_x(0), region_y(0),
+      m_bBufferReady(false), coneSpread(0), progressive(false) {
 }
 
-RayTracer::~RayTracer() {}
+RayTracer::~RayTracer() {
+  stopTrace = true;
+  waitRender();
+}
 
 void RayTracer::getBuffer(unsigned char *&buf, int &w, int &h) {
   buf = buffer.data();
@@ -194,16 +458,25 @@ void RayTracer::getBuffer(unsigned char *&buf, int &w, int &h) {
 }
 
 double RayTracer::aspectRatio() {
-  return sceneLoaded() ? scene->getCamera().getAspectRatio() : 1;
+  return sceneLoaded() ? camera().getAspectRatio() : 1;
 }
 
 bool RayTracer::loadScene(const char *fn) {
+  Scene *loaded = parseScene(fn);
+  if (!loaded)
+    return false;
+  scene.reset(loaded);
+  return true;
+}
+
+// Read scene file fn. Returns null, having told the UI why, if it can't.
+Scene *RayTracer::parseScene(const char *fn) {
   ifstream ifs(fn);
   if (!ifs) {
     string msg("Error: couldn't read scene file ");
     msg.append(fn);
     traceUI->alert(msg);
-    return false;
+    return nullptr;
   }
 
   // Check if fn ends in '.ray'
@@ -222,50 +495,120 @@ bool RayTracer::loadScene(const char *fn) {
   if (isRay) {
     // .ray Parsing Path
     // Call this with 'true' for debug output from the tokenizer
-    Tokenizer tokenizer(ifs, false);
+    Tokenizer tokenizer(string(fn), false);
     Parser parser(tokenizer, path);
     try {
-      scene.reset(parser.parseScene());
+      return parser.parseScene();
     } catch (SyntaxErrorException &pe) {
       traceUI->alert(pe.formattedMessage());
-      return false;
+      return nullptr;
     } catch (ParserException &pe) {
       string msg("Parser: fatal exception ");
       msg.append(pe.message());
       traceUI->alert(msg);
-      return false;
+      return nullptr;
     } catch (TextureMapException e) {
       string msg("Texture mapping exception: ");
       msg.append(e.message());
       traceUI->alert(msg);
-      return false;
+      return nullptr;
     }
   } else {
     // JSON Parsing Path
     try {
       JsonParser parser(path, ifs);
-      scene.reset(parser.parseScene());
+      return parser.parseScene();
     } catch (ParserException &pe) {
       string msg("Parser: fatal exception ");
       msg.append(pe.message());
       traceUI->alert(msg);
-      return false;
+      return nullptr;
     } catch (const json::exception &je) {
       string msg("Invalid JSON encountered ");
       msg.append(je.what());
       traceUI->alert(msg);
-      return false;
+      return nullptr;
     }
   }
+}
 
+bool RayTracer::reloadShading(const char *fn) {
   if (!sceneLoaded())
     return false;
+  if (renderThread.joinable()) {
+    stopTrace = true;
+    waitRender();
+  }
+  std::unique_ptr<Scene> edited(parseScene(fn));
+  if (!edited)
+    return false;
+  string error;
+  if (!scene->takeShading(*edited, error)) {
+    string msg("Error: couldn't take the lights and materials of ");
+    msg.append(fn);
+    msg.append(": ");
+    msg.append(error);
+    traceUI->alert(msg);
+    return false;
+  }
+  return true;
+}
 
+bool RayTracer::loadSnapshot(const char *fn) {
+  string error;
+  Scene *loaded = SceneSnapshot::load(fn, error);
+  if (!loaded) {
+    string msg("Error: couldn't load snapshot ");
+    msg.append(fn);
+    msg.append(": ");
+    msg.append(error);
+    traceUI->alert(msg);
+    return false;
+  }
+  scene.reset(loaded);
+  return true;
+}
+
+bool RayTracer::saveSnapshot(const char *fn) {
+  if (!sceneLoaded())
+    return false;
+  string error;
+  if (!SceneSnapshot::save(*scene, fn, error)) {
+    string msg("Error: couldn't save snapshot ");
+    msg.append(fn);
+    msg.append(": ");
+    msg.append(error);
+    traceUI->alert(msg);
+    return false;
+  }
   return true;
 }
 
 void RayTracer::traceSetup(int w, int h) {
-  size_t newBufferSize = w * h * 3;
+  // The buffers are about to change under any render still running.
+  if (renderThread.joinable()) {
+    stopTrace = true;
+    waitRender();
+  }
+
+  // The buffers hold the region being rendered, or the whole frame.
+  frame_width = w;
+  frame_height = h;
+  int x0 = 0, y0 = 0, x1 = w, y1 = h;
+  if (useRegion) {
+    x0 = std::min(std::max(region[0], 0), w);
+    y0 = std::min(std::max(region[1], 0), h);
+    x1 = std::min(std::max(region[2], x0), w);
+    y1 = std::min(std::max(region[3], y0), h);
+  }
+  // The region is given top down, the buffers are bottom up.
+  region_x = x0;
+  region_y = h - y1;
+  w = x1 - x0;
+  h = y1 - y0;
+
+  // In size_t: w * h * 3 overflows an int past about 700 megapixels.
+  size_t newBufferSize = size_t(w) * h * 3;
   if (newBufferSize != buffer.size()) {
     bufferSize = newBufferSize;
     buffer.resize(bufferSize);
@@ -280,13 +623,41 @@ void RayTracer::traceSetup(int w, int h) {
    */
 
   threads = traceUI->getThreads();
-  block_size = traceUI->getBlockSize();
+  block_size = std::max(traceUI->getBlockSize(), 1);
   thresh = traceUI->getThreshold();
   samples = traceUI->getSuperSamples();
   aaThresh = traceUI->getAaThreshold();
+  progressive = traceUI->progressive();
+  passes = 0;
+  progressiveSeconds = 0.0;
 
-  // YOUR CODE HERE
-  // FIXME: Additional initializations
+  // Each progressive pass takes one sample per pixel, so that is the
+  // footprint the camera rays' cones should have.
+  double spp = progressive ? 1 : samples;
+  coneSpread = sceneLoaded() ? glm::length(camera().getV()) /
+                                   (frame_height * spp)
+                             : 0.0;
+
+  hdr.assign(size_t(w) * h * 3, 0.0f);
+  if (progressive) {
+    accum.assign(size_t(w) * h * 3, 0.0f);
+    hdrAccum.assign(size_t(w) * h * 3, 0.0f);
+    accumSq.assign(size_t(w) * h, 0.0f);
+  } else {
+    accum.clear();
+    hdrAccum.clear();
+    accumSq.clear();
+  }
+
+  if (traceUI->aovs()) {
+    aovDepth.assign(size_t(w) * h, 0.0f);
+    aovNormal.assign(size_t(w) * h * 3, 0.0f);
+    aovAlbedo.assign(size_t(w) * h * 3, 0.0f);
+  } else {
+    aovDepth.clear();
+    aovNormal.clear();
+    aovAlbedo.clear();
+  }
 }
 
 /*
@@ -302,21 +673,412 @@ void RayTracer::traceSetup(int w, int h) {
 void RayTracer::traceImage(int w, int h) {
   // Always call traceSetup before rendering anything.
   traceSetup(w, h);
+  if (!sceneLoaded())
+    return;
 
-  // YOUR CODE HERE
-  // FIXME: Start one or more threads for ray tracing
-  //
-  // TIPS: Ideally, the traceImage should be executed asynchronously,
-  //       i.e. returns IMMEDIATELY after working threads are launched.
-  //
-  //       An asynchronous traceImage lets the GUI update your results
-  //       while rendering.
+  relighting = false;
+  retraceBlocks.clear();
+  gbufferReady = false;
+  footprintsReady = false;
+  // A resumed render doesn't trace the blocks it resumes with.
+  bool record = !progressive && !resumeState;
+  if (keepGBuffer && record)
+    gbuffer.assign(size_t(buffer_width) * buffer_height * samples * samples,
+                   nullptr);
+  else
+    gbuffer.clear();
+  footprints =
+      trackEdits && record ? RayFootprint(scene->bounds()) : RayFootprint();
+  startRender();
+}
+
+bool RayTracer::relight() {
+  if (!sceneLoaded() || !gbufferReady || scene->id() != keptScene)
+    return false;
+  traceSetup(frame_width, frame_height);
+  if (progressive || renderShape() != keptShape)
+    return false;
+  relighting = true;
+  retraceBlocks.clear();
+  startRender();
+  return true;
+}
+
+/*
+ * RayTracer::editScene
+ *
+ *	Swap in the edited scene, first working out which blocks to trace
+ *	again. That is only possible when the last render finished with
+ *	footprints recorded, and the edit moved, reshaped or changed the
+ *	material of objects and nothing else; and only for objects that lay
+ *	within the grid both before and after. The footprints are of where
+ *	rays went, so a block is traced again if any of its rays, camera,
+ *	secondary or shadow, passed through a cell the object's bounds touch
+ *	now or touched before: that covers where it was seen, reflected or
+ *	cast a shadow, and where it now can be. Otherwise, retraceEdited
+ *	declines and the whole image is rendered again.
+ */
+bool RayTracer::editScene(const char *fn) {
+  if (!sceneLoaded())
+    return loadScene(fn);
+  if (renderThread.joinable()) {
+    stopTrace = true;
+    waitRender();
+  }
+  std::unique_ptr<Scene> edited(parseScene(fn));
+  if (!edited)
+    return false;
 
-  // loop through every pixel
-  for (int i = 0; i < w; ++i) {
-      for (int j = 0; j < h; ++j) {
-          tracePixel(i, j);
+  retraceBlocks.clear();
+  std::vector<int> changed;
+  if (footprintsReady && scene->id() == keptScene &&
+      scene->changedObjects(*edited, changed)) {
+    RayFootprint::Mask touched{};
+    bool inside = true;
+    for (int k : changed) {
+      for (const Geometry *obj :
+           {scene->getAllObjects()[k], edited->getAllObjects()[k]}) {
+        if (!obj->hasBoundingBoxCapability() ||
+            !footprints.contains(obj->getBoundingBox()))
+          inside = false;
+        footprints.addBox(obj->getBoundingBox(), touched);
       }
+    }
+    if (inside) {
+      retraceBlocks.resize(tileFootprints.size());
+      for (size_t k = 0; k < tileFootprints.size(); k++)
+        retraceBlocks[k] = RayFootprint::overlaps(tileFootprints[k], touched);
+    }
+  }
+
+  if (retraceBlocks.empty()) {
+    gbufferReady = false;
+    footprintsReady = false;
+  } else if (gbufferReady) {
+    // The blocks that are kept still see the same objects, which are now
+    // the edited scene's.
+    std::unordered_map<const Geometry *, const Geometry *> same;
+    for (size_t k = 0; k < scene->getAllObjects().size(); k++)
+      same[scene->getAllObjects()[k]] = edited->getAllObjects()[k];
+    for (const Geometry *&obj : gbuffer)
+      if (obj)
+        obj = same[obj];
+  }
+  scene.reset(edited.release());
+  keptScene = scene->id();
+  return true;
+}
+
+bool RayTracer::retraceEdited() {
+  if (retraceBlocks.empty() || !sceneLoaded())
+    return false;
+  // traceSetup clears the image, most of which is to be kept.
+  std::vector<unsigned char> keptBuffer(buffer);
+  std::vector<float> keptHdr(hdr);
+  traceSetup(frame_width, frame_height);
+  if (progressive || renderShape() != keptShape) {
+    retraceBlocks.clear();
+    return false;
+  }
+  buffer.swap(keptBuffer);
+  hdr.swap(keptHdr);
+  relighting = false;
+  startRender();
+  return true;
+}
+
+// What a G-buffer or footprints depend on besides the scene.
+std::vector<int> RayTracer::renderShape() const {
+  return {frame_width,   frame_height, region_x,  region_y,
+          buffer_width,  buffer_height, samples, block_size};
+}
+
+// Run the render set up by traceSetup on the render thread.
+void RayTracer::startRender() {
+  // The acceleration structures are otherwise built by whichever ray
+  // needs them first, which is not safe once several threads trace.
+  scene->buildAccelerators();
+
+  // Blocks of an ordinary render, to tell which are done.
+  blocksAcross = (buffer_width + block_size - 1) / block_size;
+  blocksDown = (buffer_height + block_size - 1) / block_size;
+  if (!progressive) {
+    blockDone.reset(new std::atomic<bool>[blocksAcross * blocksDown]);
+    for (int k = 0; k < blocksAcross * blocksDown; k++)
+      blockDone[k] = false;
+  }
+  applyCheckpoint();
+  lastCheckpoint = std::chrono::steady_clock::now();
+
+  // After editScene, only the blocks the edit can have changed are traced.
+  for (size_t k = 0; k < retraceBlocks.size(); k++)
+    if (!retraceBlocks[k])
+      blockDone[k] = true;
+  retraceBlocks.clear();
+  if (!relighting)
+    gbufferReady = false;
+  footprintsReady = false;
+  if (!footprints.empty())
+    tileFootprints.resize(blocksAcross * blocksDown);
+
+  stopTrace = false;
+  renderDone = false;
+  renderThread = std::thread([this] {
+    if (!aovDepth.empty()) {
+      forEachBlock([this](int x0, int y0, int x1, int y1) {
+        traceAovBlock(x0, y0, x1, y1);
+      });
+    }
+    if (progressive) {
+      traceProgressive();
+      reportRows(0, buffer_height);
+    } else {
+      // Rows are final once every block across them is. Blocks finished
+      // before a resume already are.
+      int across = blocksAcross, down = blocksDown;
+      std::unique_ptr<std::atomic<int>[]> left(new std::atomic<int>[down]);
+      for (int r = 0; r < down; r++) {
+        left[r] = across;
+        for (int c = 0; c < across; c++)
+          left[r] -= blockDone[r * across + c] ? 1 : 0;
+        if (left[r] == 0)
+          reportRows(r * block_size,
+                     std::min((r + 1) * block_size, buffer_height));
+      }
+      forEachBlock([&](int x0, int y0, int x1, int y1) {
+        int k = (y0 / block_size) * across + x0 / block_size;
+        if (blockDone[k])
+          return;
+        if (!footprints.empty()) {
+          tileFootprints[k].fill(0);
+          ray_footprint.grid = &footprints;
+          ray_footprint.mask = &tileFootprints[k];
+        }
+        traceBlock(x0, y0, x1, y1);
+        ray_footprint = FootprintRecorder();
+        // It may have been cut short.
+        if (stopTrace)
+          return;
+        blockDone[k] = true;
+        if (--left[y0 / block_size] == 0)
+          reportRows(y0, y1);
+        maybeCheckpoint(false);
+      });
+      if (stopTrace)
+        maybeCheckpoint(true);
+      for (int r = 0; r < down; r++)
+        if (left[r] > 0)
+          reportRows(r * block_size,
+                     std::min((r + 1) * block_size, buffer_height));
+      passes = samples * samples;
+      if (!stopTrace) {
+        gbufferReady = !gbuffer.empty();
+        footprintsReady = !footprints.empty();
+        keptScene = scene->id();
+        keptShape = renderShape();
+      }
+    }
+    renderDone = true;
+  });
+}
+
+// Run work on every block of the image, spread over the UI's thread
+// count. Blocks are handed out in scanline order, top row first, from a
+// shared counter, so a thread that lands on cheap blocks just takes more
+// of them. The calling thread is one of the workers, unless there is a
+// shared pool, in which case it waits while the pool runs them. Returns
+// early if stopTrace is set.
+void RayTracer::forEachBlock(
+    const std::function<void(int, int, int, int)> &work) {
+  int w = buffer_width, h = buffer_height;
+  int across = (w + block_size - 1) / block_size;
+  int down = (h + block_size - 1) / block_size;
+  int count = across * down;
+  auto block = [&](int k) {
+    int x0 = (k % across) * block_size;
+    int y0 = (down - 1 - k / across) * block_size;
+    work(x0, y0, std::min(x0 + block_size, w), std::min(y0 + block_size, h));
+  };
+
+  if (pool) {
+    pool->run(count, [&](int k) {
+      if (!stopTrace)
+        block(k);
+    });
+    return;
+  }
+
+  std::atomic<int> next{0};
+  auto worker = [&](unsigned int id) {
+    ray_thread_id = id;
+    for (int k; !stopTrace && (k = next++) < count;)
+      block(k);
+  };
+
+  unsigned int n = std::min(std::max(threads, 1u), (unsigned int)MAX_THREADS);
+  std::vector<std::thread> workers;
+  for (unsigned int id = 1; id < n; id++)
+    workers.emplace_back(worker, id);
+  worker(0);
+  for (auto &t : workers)
+    t.join();
+}
+
+/*
+ * RayTracer::traceProgressive
+ *
+ *	Render in passes of one jittered sample per pixel, adding each into
+ *	a float accumulation buffer and rewriting the display buffer with
+ *	the running mean after every pass, so a noisy but complete image is
+ *	there as soon as the first pass ends. Stops, between passes, when
+ *	the first of these is reached: the sample budget, the time budget,
+ *	the error tolerance, or stopTrace. A resumed render starts from the
+ *	passes it was saved with, and counts the time they took; a stopped
+ *	one is checkpointed as of its last whole pass.
+ */
+void RayTracer::traceProgressive() {
+  auto start = std::chrono::steady_clock::now();
+  double before = progressiveSeconds;
+  int maxPasses = traceUI->getProgressiveSamples();
+  double budget = traceUI->getProgressiveTime();
+  double tolerance = traceUI->getProgressiveTolerance();
+
+  // The sums as of the last whole pass, kept while checkpointing so that
+  // a stopped render can still be saved.
+  std::vector<float> wholeAccum, wholeHdrAccum, wholeAccumSq;
+  bool partial = false;
+
+  for (int pass = passes; !stopTrace;) {
+    if (maxPasses > 0 && pass >= maxPasses)
+      break;
+    if (!checkpointPath.empty()) {
+      wholeAccum = accum;
+      wholeHdrAccum = hdrAccum;
+      wholeAccumSq = accumSq;
+    }
+    forEachBlock([this, pass](int x0, int y0, int x1, int y1) {
+      traceProgressiveBlock(x0, y0, x1, y1, pass);
+    });
+    // A pass cut short would leave some pixels with one sample more
+    // than the others; keep showing the last whole one.
+    if (stopTrace) {
+      partial = true;
+      break;
+    }
+    passes = ++pass;
+    resolveProgressive();
+
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    progressiveSeconds = before + elapsed.count();
+    maybeCheckpoint(false);
+    if (budget > 0 && progressiveSeconds >= budget)
+      break;
+    // A handful of samples is too few to trust the variance estimate.
+    if (tolerance > 0 && pass >= 4 && progressiveError() < tolerance)
+      break;
+  }
+
+  // Save what there is to resume from: the sums without the part of the
+  // pass that was cut short.
+  if (stopTrace && !checkpointPath.empty()) {
+    if (partial) {
+      accum.swap(wholeAccum);
+      hdrAccum.swap(wholeHdrAccum);
+      accumSq.swap(wholeAccumSq);
+    }
+    maybeCheckpoint(true);
+  }
+}
+
+// Fill in the auxiliary outputs for [x0, x1) x [y0, y1) from the first
+// hit of a ray through each pixel's centre: the distance to it (infinite
+// for the background), its shading normal, and its diffuse color.
+void RayTracer::traceAovBlock(int x0, int y0, int x1, int y1) {
+  for (int j = y0; j < y1; ++j) {
+    for (int i = x0; i < x1; ++i) {
+      size_t p = size_t(j) * buffer_width + i;
+      ray r = cameraRay(frameX(i + 0.5), frameY(j + 0.5));
+      isect hit;
+      if (!scene->intersect(r, hit)) {
+        aovDepth[p] = INFINITY;
+        continue;
+      }
+      glm::dvec3 n = hit.getN();
+      glm::dvec3 kd = hit.getMaterial().kd(hit);
+      aovDepth[p] = float(hit.getT());
+      for (int k = 0; k < 3; k++) {
+        aovNormal[p * 3 + k] = float(n[k]);
+        aovAlbedo[p * 3 + k] = float(kd[k]);
+      }
+    }
+  }
+}
+
+void RayTracer::traceProgressiveBlock(int x0, int y0, int x1, int y1,
+                                      int pass) {
+  for (int j = y0; j < y1; ++j) {
+    for (int i = x0; i < x1; ++i) {
+      ray_sampler.reseed(pixelSeed(i, j, pass));
+      double x = frameX(i + ray_sampler.next());
+      double y = frameY(j + ray_sampler.next());
+      glm::dvec3 linear = trace(x, y);
+      glm::dvec3 c = glm::clamp(linear, 0.0, 1.0);
+
+      size_t p = size_t(j) * buffer_width + i;
+      for (int k = 0; k < 3; k++) {
+        accum[p * 3 + k] += float(c[k]);
+        hdrAccum[p * 3 + k] += float(linear[k]);
+      }
+      double lum = 0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2];
+      accumSq[p] += float(lum * lum);
+    }
+  }
+}
+
+// Write the mean of the samples so far into the display buffer.
+void RayTracer::resolveProgressive() {
+  double n = passes;
+  for (int j = 0; j < buffer_height; ++j) {
+    for (int i = 0; i < buffer_width; ++i) {
+      size_t p = (size_t(j) * buffer_width + i) * 3;
+      const float *a = &accum[p], *l = &hdrAccum[p];
+      setPixel(i, j, glm::dvec3(a[0], a[1], a[2]) / n);
+      setLinear(i, j, glm::dvec3(l[0], l[1], l[2]) / n);
+    }
+  }
+}
+
+// Root mean square, over the image, of the standard error of each pixel's
+// mean luminance: roughly how far the displayed image is from the one
+// infinitely many passes would give, in the same 0..1 units as a color.
+double RayTracer::progressiveError() const {
+  double n = passes;
+  double total = 0.0;
+  size_t pixels = accumSq.size();
+  for (size_t p = 0; p < pixels; ++p) {
+    const float *a = &accum[p * 3];
+    double mean = (0.2126 * a[0] + 0.7152 * a[1] + 0.0722 * a[2]) / n;
+    double variance = std::max(accumSq[p] / n - mean * mean, 0.0);
+    total += variance / n;
+  }
+  return pixels ? std::sqrt(total / pixels) : 0.0;
+}
+
+// Trace the pixels in [x0, x1) x [y0, y1).
+void RayTracer::traceBlock(int x0, int y0, int x1, int y1) {
+  if (!sceneLoaded())
+    return;
+
+  if (traceUI->raySorting()) {
+    traceBlockSorted(x0, y0, x1, y1);
+    return;
+  }
+
+  for (int j = y0; j < y1; ++j) {
+    for (int i = x0; i < x1; ++i) {
+      tracePixel(i, j);
+    }
   }
 }
 
@@ -329,23 +1091,156 @@ int RayTracer::aaImage() {
   return 0;
 }
 
-bool RayTracer::checkRender() {
-  // YOUR CODE HERE
-  // FIXME: Return true if tracing is done.
-  //        This is a helper routine for GUI.
-  //
-  // TIPS: Introduce an array to track the status of each worker thread.
-  //       This array is maintained by the worker threads.
+void RayTracer::reportRows(int y0, int y1) {
+  if (rowsDone && y0 < y1)
+    rowsDone(y0, y1);
+}
+
+void RayTracer::setCheckpoint(const std::string &path, double interval,
+                              const std::string &tag) {
+  checkpointPath = path;
+  checkpointInterval = interval;
+  checkpointTag = tag;
+}
+
+// Everything that decides the pixels of the buffer. A checkpoint is only
+// resumed by a render with the same key.
+std::string RayTracer::checkpointKey() const {
+  std::ostringstream key;
+  key << std::setprecision(17) << "frame " << frame_width << "x"
+      << frame_height << " at " << region_x << "," << region_y << " size "
+      << buffer_width << "x" << buffer_height << " block " << block_size
+      << " samples " << samples << " depth " << traceUI->getDepth()
+      << " threshold " << thresh << " progressive " << progressive
+      << " sorted " << traceUI->raySorting() << " roulette "
+      << traceUI->russianRoulette() << " light cutoff "
+      << traceUI->getLightCutoff() << " max lights "
+      << traceUI->getMaxLights() << " cubemap ";
+  if (traceUI->cubeMap())
+    key << traceUI->getCubeMapFiles() << " filter "
+        << traceUI->getFilterWidth();
+  else
+    key << "none";
+  key << " scene " << checkpointTag;
+  return key.str();
+}
+
+bool RayTracer::resumeFrom(const std::string &path, std::string &error) {
+  std::unique_ptr<RenderCheckpoint> c(new RenderCheckpoint);
+  if (!c->load(path, error))
+    return false;
+  if (c->key != checkpointKey()) {
+    error = "it is for another render (" + c->key + ")";
+    return false;
+  }
+  size_t pixels = size_t(buffer_width) * buffer_height;
+  size_t blocks = size_t((buffer_width + block_size - 1) / block_size) *
+                  ((buffer_height + block_size - 1) / block_size);
+  bool fits = c->progressive
+                  ? c->accum.size() == pixels * 3 &&
+                        c->hdrAccum.size() == pixels * 3 &&
+                        c->accumSq.size() == pixels
+                  : c->blocksDone.size() == blocks &&
+                        c->buffer.size() == pixels * 3 &&
+                        c->hdr.size() == pixels * 3;
+  if (c->progressive != progressive || !fits) {
+    error = "checkpoint is truncated or damaged";
+    return false;
+  }
+  resumeState = std::move(c);
   return true;
 }
 
+// Put the state saved by resumeFrom back, once traceSetup has cleared
+// the buffers for the render it is to be part of.
+void RayTracer::applyCheckpoint() {
+  if (!resumeState)
+    return;
+  std::unique_ptr<RenderCheckpoint> c = std::move(resumeState);
+  if (c->key != checkpointKey()) {
+    traceUI->alert("Warning: not resuming, the render has changed since "
+                   "the checkpoint was read.");
+    return;
+  }
+  if (progressive) {
+    accum = c->accum;
+    hdrAccum = c->hdrAccum;
+    accumSq = c->accumSq;
+    passes = c->passes;
+    progressiveSeconds = c->seconds;
+    if (passes > 0)
+      resolveProgressive();
+  } else {
+    buffer = c->buffer;
+    hdr = c->hdr;
+    for (size_t k = 0; k < c->blocksDone.size(); k++)
+      blockDone[k] = c->blocksDone[k] != 0;
+  }
+}
+
+// Save a checkpoint if the interval is up, or regardless if now is set.
+// Called from the render threads; one saves while the others carry on.
+void RayTracer::maybeCheckpoint(bool now) {
+  if (checkpointPath.empty() || (!now && checkpointInterval <= 0))
+    return;
+  std::unique_lock<std::mutex> guard(checkpointLock, std::try_to_lock);
+  if (!guard.owns_lock()) {
+    if (!now)
+      return;
+    guard.lock();
+  }
+  std::chrono::duration<double> since =
+      std::chrono::steady_clock::now() - lastCheckpoint;
+  if (!now && since.count() < checkpointInterval)
+    return;
+  writeCheckpoint();
+  lastCheckpoint = std::chrono::steady_clock::now();
+}
+
+// Write out the finished blocks of an ordinary render, or the sums of a
+// progressive one, which only happens between passes. Blocks still being
+// traced are left out, so the other threads can keep writing to them.
+void RayTracer::writeCheckpoint() {
+  RenderCheckpoint c;
+  c.key = checkpointKey();
+  c.progressive = progressive;
+  if (progressive) {
+    c.passes = passes;
+    c.seconds = progressiveSeconds;
+    c.accum = accum;
+    c.hdrAccum = hdrAccum;
+    c.accumSq = accumSq;
+  } else {
+    int count = blocksAcross * blocksDown;
+    c.blocksDone.assign(count, 0);
+    c.buffer.assign(buffer.size(), 0);
+    c.hdr.assign(hdr.size(), 0.0f);
+    for (int k = 0; k < count; k++) {
+      if (!blockDone[k])
+        continue;
+      c.blocksDone[k] = 1;
+      int x0 = (k % blocksAcross) * block_size;
+      int y0 = (k / blocksAcross) * block_size;
+      int x1 = std::min(x0 + block_size, buffer_width);
+      int y1 = std::min(y0 + block_size, buffer_height);
+      for (int j = y0; j < y1; ++j) {
+        size_t p = (size_t(j) * buffer_width + x0) * 3;
+        size_t n = size_t(x1 - x0) * 3;
+        std::copy_n(buffer.begin() + p, n, c.buffer.begin() + p);
+        std::copy_n(hdr.begin() + p, n, c.hdr.begin() + p);
+      }
+    }
+  }
+  std::string error;
+  if (!c.save(checkpointPath, error))
+    traceUI->alert("Error: couldn't save checkpoint: " + error);
+}
+
+bool RayTracer::checkRender() { return renderDone; }
+
 void RayTracer::waitRender() {
-  // YOUR CODE HERE
-  // FIXME: Wait until the rendering process is done.
-  //        This function is essential if you are using an asynchronous
-  //        traceImage implementation.
-  //
-  // TIPS: Join all worker threads here.
+  if (renderThread.joinable())
+    renderThread.join();
 }
 
 
@@ -355,6 +1250,81 @@ glm::dvec3 RayTracer::getPixel(int i, int j) {
                     (double)pixel[2] / 255.0);
 }
 
+void RayTracer::setRegion(int x0, int y0, int x1, int y1) {
+  region[0] = x0;
+  region[1] = y0;
+  region[2] = x1;
+  region[3] = y1;
+  useRegion = true;
+}
+
+ImageWindow RayTracer::window() const {
+  ImageWindow win;
+  win.x = region_x;
+  win.y = frame_height - region_y - buffer_height;
+  win.fullWidth = frame_width;
+  win.fullHeight = frame_height;
+  return win;
+}
+
+void RayTracer::setLinear(int i, int j, const glm::dvec3 &color) {
+  float *pixel = hdr.data() + (i + j * buffer_width) * 3;
+  pixel[0] = float(color[0]);
+  pixel[1] = float(color[1]);
+  pixel[2] = float(color[2]);
+}
+
+/*
+ * RayTracer::saveImage
+ *
+ *	Write the image to fn in the format its extension asks for. Float
+ *	formats get the linear buffer and any auxiliary outputs as they are;
+ *	8-bit ones get exportRows().
+ */
+bool RayTracer::saveImage(const char *fn) {
+  try {
+    if (isFloatImage(fn)) {
+      std::vector<ImagePlane> planes{{"", 3, hdr.data()}};
+      if (!aovDepth.empty()) {
+        planes.push_back({"depth", 1, aovDepth.data()});
+        planes.push_back({"normal", 3, aovNormal.data()});
+        planes.push_back({"albedo", 3, aovAlbedo.data()});
+      }
+      writeFloatImage(fn, buffer_width, buffer_height, planes, window());
+    } else {
+      std::vector<unsigned char> out = exportRows(0, buffer_height);
+      writeImage(fn, buffer_width, buffer_height, out.data());
+    }
+  } catch (const string &e) {
+    traceUI->alert("Error: couldn't save image: " + e);
+    return false;
+  }
+  return true;
+}
+
+// Rows [y0, y1) of the 8-bit image to export. With no exposure change and
+// the clamp curve this is the display buffer, whose pixels are the mean of
+// their clamped samples. Otherwise it is made from the linear buffer,
+// scaled by 2^exposure and put through the tone curve before quantising.
+std::vector<unsigned char> RayTracer::exportRows(int y0, int y1) const {
+  size_t begin = size_t(y0) * buffer_width * 3;
+  size_t end = size_t(y1) * buffer_width * 3;
+  double scale = std::exp2(traceUI->getExposure());
+  bool reinhard = traceUI->getToneMap() == "reinhard";
+  if (!reinhard && scale == 1.0)
+    return std::vector<unsigned char>(buffer.begin() + begin,
+                                      buffer.begin() + end);
+
+  std::vector<unsigned char> out(end - begin);
+  for (size_t k = 0; k < out.size(); k++) {
+    double v = std::max(hdr[begin + k] * scale, 0.0);
+    if (reinhard)
+      v = v / (1.0 + v);
+    out[k] = (unsigned char)(255.0 * std::min(v, 1.0));
+  }
+  return out;
+}
+
 void RayTracer::setPixel(int i, int j, glm::dvec3 color) {
   unsigned char *pixel = buffer.data() + (i + j * buffer_width) * 3;
 
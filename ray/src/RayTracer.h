@@ -5,15 +5,28 @@
 
 // The main ray tracer.
 
+#include "fileio/imagewindow.h"
 #include "scene/cubeMap.h"
+#include "scene/footprint.h"
 #include "scene/ray.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <glm/vec3.hpp>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <time.h>
+#include <vector>
 
+class Camera;
+class Geometry;
 class Scene;
+class ThreadPool;
+struct RenderCheckpoint;
 class Pixel {
 public:
   Pixel(int i, int j, unsigned char *ptr) : ix(i), jy(j), value(ptr) {}
@@ -35,6 +48,7 @@ public:
 
   glm::dvec3 getPixel(int i, int j);
   void setPixel(int i, int j, glm::dvec3 color);
+  void setLinear(int i, int j, const glm::dvec3 &color);
   void getBuffer(unsigned char *&buf, int &w, int &h);
   double aspectRatio();
 
@@ -45,7 +59,68 @@ public:
 
   void traceSetup(int w, int h);
 
+  // Render only [x0, x1) x [y0, y1) of the w x h frame given to
+  // traceSetup, counting rows from the top as image files do. The buffers
+  // then hold just that part, and are exactly what the full frame has
+  // there. Applies to every traceSetup until clearRegion.
+  void setRegion(int x0, int y0, int x1, int y1);
+  void clearRegion() { useRegion = false; }
+  // Where the buffer sits in the frame.
+  ImageWindow window() const;
+
   bool loadScene(const char *fn);
+
+  // Relighting. With setKeepGBuffer on, an ordinary render writes down
+  // which object each camera ray hit first, one pointer per sample.
+  // reloadShading reads the lights and materials of scene file fn into the
+  // loaded scene (see Scene::takeShading), and relight then renders the
+  // image again starting from those hits: each camera ray only intersects
+  // the object it hit last time, and shading and the rays it spawns are
+  // traced as usual. The result is what traceImage would give. relight
+  // returns false, doing nothing, if there is no finished render of this
+  // scene at the UI's current size and sampling to start from.
+  void setKeepGBuffer(bool keep) { keepGBuffer = keep; }
+  bool reloadShading(const char *fn);
+  bool relight();
+
+  // Incremental re-rendering. With setTrackEdits on, an ordinary render
+  // records, per block, which cells of a coarse grid over the scene its
+  // rays passed through (see RayFootprint). editScene loads scene file fn,
+  // an edited copy of the loaded scene, in its place, and works out which
+  // blocks the objects that were moved, reshaped or given a new material
+  // can have changed: those whose rays went near them, before or after
+  // the edit. retraceEdited then traces just those blocks again, keeping
+  // the rest of the image. It returns false, doing nothing, if the last
+  // render can't be updated that way (see editScene in RayTracer.cpp), in
+  // which case the scene is rendered with traceImage as usual.
+  void setTrackEdits(bool track) { trackEdits = track; }
+  bool editScene(const char *fn);
+  bool retraceEdited();
+
+  // Write the rendered image; see the comment in RayTracer.cpp.
+  bool saveImage(const char *fn);
+  std::vector<unsigned char> exportRows(int y0, int y1) const;
+
+  // Called from the render threads with each band of rows [y0, y1) once
+  // its pixels are final, and at the end for any not yet reported (e.g.
+  // when the render was stopped). Set before traceImage.
+  void setRowsDone(std::function<void(int, int)> f) { rowsDone = f; }
+
+  // Save the render in progress to path every interval seconds (0 for
+  // only when it is stopped early), so that a later run can resume it;
+  // see RenderCheckpoint.h. tag names the scene, which must be the same
+  // when resuming.
+  void setCheckpoint(const std::string &path, double interval,
+                     const std::string &tag);
+  // Call after traceSetup: make the next traceImage of the same size carry
+  // on from the checkpoint at path. Returns false, with the reason in
+  // error, if it can't be read or is for a different render.
+  bool resumeFrom(const std::string &path, std::string &error);
+
+  // Replace the scene with one saved by saveSnapshot, or save the current
+  // one; see scene/snapshot.h.
+  bool loadSnapshot(const char *fn);
+  bool saveSnapshot(const char *fn);
   bool sceneLoaded() { return scene != 0; }
 
   void setReady(bool ready) { m_bBufferReady = ready; }
@@ -53,23 +128,142 @@ public:
 
   const Scene &getScene() { return *scene; }
 
-  bool stopTrace;
+  // Render a scene that is shared with other RayTracers, e.g. one kept
+  // loaded by the render server. It must have its accelerators built
+  // before any two of them trace it at once.
+  void setScene(std::shared_ptr<Scene> s) { scene = std::move(s); }
+  std::shared_ptr<Scene> sharedScene() const { return scene; }
+
+  // Look through this camera instead of the scene's, until clearCamera.
+  void setCamera(const Camera &c);
+  void clearCamera();
+
+  // Trace on the threads of pool, shared with other RayTracers, instead
+  // of starting threads of our own. Null to go back to that.
+  void setThreadPool(ThreadPool *p) { pool = p; }
+
+  // Samples per pixel in the buffer so far; in progressive mode this
+  // grows by one with every finished pass.
+  int samplesDone() const { return passes; }
+
+  std::atomic<bool> stopTrace{false};
 
 private:
-  glm::dvec3 trace(double x, double y);
+  glm::dvec3 trace(double x, double y, int64_t sample = -1);
+  glm::dvec3 traceHit(ray &r, isect &i, bool hit, const glm::dvec3 &thresh,
+                      int depth);
+  bool firstHit(ray &r, isect &i, size_t sample);
+  Scene *parseScene(const char *fn);
+  void startRender();
+  std::vector<int> renderShape() const;
+  Camera &camera();
+  ray cameraRay(double x, double y);
+  glm::dvec3 background(const ray &r) const;
+  bool keepRay(const glm::dvec3 &weight, glm::dvec3 &k) const;
+  void samplePosition(int i, int j, int p, int q, double &x, double &y) const;
+  uint64_t pixelSeed(int i, int j, int pass) const;
+
+  // Normalized window coordinates of a point of the buffer.
+  double frameX(double px) const { return (region_x + px) / frame_width; }
+  double frameY(double py) const { return (region_y + py) / frame_height; }
+
+  void traceBlock(int x0, int y0, int x1, int y1);
+  void traceBlockSorted(int x0, int y0, int x1, int y1);
+  void forEachBlock(const std::function<void(int, int, int, int)> &work);
+
+  void traceProgressive();
+  void traceProgressiveBlock(int x0, int y0, int x1, int y1, int pass);
+  void traceAovBlock(int x0, int y0, int x1, int y1);
+  void reportRows(int y0, int y1);
+  std::string checkpointKey() const;
+  void maybeCheckpoint(bool now);
+  void writeCheckpoint();
+  void applyCheckpoint();
+  void resolveProgressive();
+  double progressiveError() const;
+
+  // A ray waiting its turn in traceBlockSorted, with the sample it
+  // contributes to and the weight its color is scaled by.
+  struct QueuedRay {
+    ray r;
+    glm::dvec3 weight;
+    int sample;
+    int depth;
+    uint64_t key;
+  };
 
-  std::unique_ptr<Scene> scene;
+  std::shared_ptr<Scene> scene;
+  std::unique_ptr<Camera> cameraOverride;
+  ThreadPool *pool = nullptr;
   std::vector<unsigned char> buffer;
+  // The image as traced, linear and unclamped, laid out like buffer.
+  std::vector<float> hdr;
+  // Auxiliary outputs, when on: first-hit distance, normal and albedo.
+  std::vector<float> aovDepth, aovNormal, aovAlbedo;
   double thresh;
   int buffer_width, buffer_height;
+  // The frame the buffer is part of, and the buffer's bottom left corner
+  // in it.
+  int frame_width, frame_height;
+  int region_x, region_y;
+  int region[4];
+  bool useRegion = false;
   bool m_bBufferReady;
 
-  int bufferSize;
+  size_t bufferSize;
   unsigned int threads;
   int block_size;
   double aaThresh;
   int samples;
+  double coneSpread;
+  bool progressive;
+
+  // The render runs on its own thread so traceImage can return at once;
+  // renderDone is what checkRender reports.
+  std::thread renderThread;
+  std::atomic<bool> renderDone{true};
+  std::atomic<int> passes{0};
+  std::function<void(int, int)> rowsDone;
+
+  // Progressive mode: per pixel, the sum of its clamped samples (RGB), of
+  // its unclamped ones, and of their squared luminance for the convergence
+  // estimate.
+  std::vector<float> accum;
+  std::vector<float> hdrAccum;
+  std::vector<float> accumSq;
+
+  // Checkpoints: where to and how often, what has been saved last, and
+  // what to start from. blockDone marks the blocks of an ordinary render
+  // that are finished; progressiveSeconds is the time spent on the passes
+  // so far, including before a resume.
+  std::string checkpointPath, checkpointTag;
+  double checkpointInterval = 0.0;
+  std::chrono::steady_clock::time_point lastCheckpoint;
+  std::mutex checkpointLock;
+  std::unique_ptr<RenderCheckpoint> resumeState;
+  std::unique_ptr<std::atomic<bool>[]> blockDone;
+  int blocksAcross = 0, blocksDown = 0;
+  double progressiveSeconds = 0.0;
+
+  // Relighting: the object (or null) each camera ray hit, per sample of
+  // each pixel, laid out like the buffer, and whether it is complete.
+  bool keepGBuffer = false;
+  bool relighting = false;
+  std::vector<const Geometry *> gbuffer;
+  bool gbufferReady = false;
+
+  // Incremental re-rendering: the grid, each block's footprint on it, and
+  // whether they are complete; after editScene, the blocks to trace again.
+  bool trackEdits = false;
+  RayFootprint footprints;
+  std::vector<RayFootprint::Mask> tileFootprints;
+  bool footprintsReady = false;
+  std::vector<uint8_t> retraceBlocks;
 
+  // The scene and renderShape of the last finished render, which the
+  // G-buffer and footprints are for.
+  uint64_t keptScene = 0;
+  std::vector<int> keptShape;
 };
 
 #endif // __RAYTRACER_H__
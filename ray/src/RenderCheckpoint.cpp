@@ -0,0 +1,84 @@
+#include "RenderCheckpoint.h"
+
+#include "fileio/binaryio.h"
+#include "fileio/mappedfile.h"
+
+#include <cstring>
+
+namespace {
+
+const char MAGIC[8] = {'R', 'A', 'Y', 'C', 'K', 'P', 'T', '\0'};
+const uint32_t VERSION = 1;
+const uint32_t ENDIAN_MARK = 0x01020304;
+
+} // namespace
+
+bool RenderCheckpoint::save(const std::string &path, std::string &error) const {
+  BinaryWriter w;
+  w.putBytes(MAGIC, sizeof(MAGIC));
+  w.put(VERSION);
+  w.put(ENDIAN_MARK);
+  w.putString(key);
+  w.put((uint8_t)progressive);
+  if (progressive) {
+    w.put(passes);
+    w.put(seconds);
+    w.putArray(accum);
+    w.putArray(hdrAccum);
+    w.putArray(accumSq);
+  } else {
+    w.putArray(blocksDone);
+    w.putArray(buffer);
+    w.putArray(hdr);
+  }
+  if (!writeFileAtomically(path, w.bytes.data(), w.bytes.size())) {
+    error = "could not write " + path;
+    return false;
+  }
+  return true;
+}
+
+bool RenderCheckpoint::load(const std::string &path, std::string &error) {
+  MappedFile file(path);
+  if (!file.isOpen()) {
+    error = "could not read " + path;
+    return false;
+  }
+  BinaryReader r(file.data(), file.size());
+
+  char magic[sizeof(MAGIC)];
+  r.getBytes(magic, sizeof(magic));
+  if (!r.ok() || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+    error = "not a render checkpoint";
+    return false;
+  }
+  uint32_t version = r.get<uint32_t>();
+  if (version != VERSION) {
+    error = "checkpoint format version " + std::to_string(version) +
+            " is not supported (expected " + std::to_string(VERSION) + ")";
+    return false;
+  }
+  if (r.get<uint32_t>() != ENDIAN_MARK) {
+    error = "checkpoint was written on a machine with another byte order";
+    return false;
+  }
+
+  key = r.getString();
+  progressive = r.get<uint8_t>() != 0;
+  if (progressive) {
+    passes = r.get<int32_t>();
+    seconds = r.get<double>();
+    r.getArray(accum);
+    r.getArray(hdrAccum);
+    r.getArray(accumSq);
+  } else {
+    r.getArray(blocksDone);
+    r.getArray(buffer);
+    r.getArray(hdr);
+  }
+  if (!r.ok() || passes < 0) {
+    error = "checkpoint is truncated or damaged";
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __RENDERCHECKPOINT_H__
+#define __RENDERCHECKPOINT_H__
+
+// What a long render has done so far, saved so it can be resumed.
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * A checkpoint is written while a render runs and read back to carry on
+ * where it left off. Every pixel's samples are seeded from its position
+ * in the frame (see RayTracer::pixelSeed), so there is no random state to
+ * save: finishing the missing blocks, or running the remaining passes,
+ * gives exactly the image an uninterrupted render would have.
+ *
+ * key describes the render (frame, region, settings, scene) and must
+ * match for a checkpoint to be used. Like snapshots, the file is in the
+ * machine's own byte order and is refused by another version.
+ */
+struct RenderCheckpoint {
+  std::string key;
+  bool progressive = false;
+
+  // An ordinary render: which blocks are finished, row by row from the
+  // bottom, and the buffers, which only hold anything in those blocks.
+  std::vector<uint8_t> blocksDone;
+  std::vector<unsigned char> buffer;
+  std::vector<float> hdr;
+
+  // A progressive render: the sums after `passes` whole passes, and the
+  // time taken to get there.
+  int32_t passes = 0;
+  double seconds = 0.0;
+  std::vector<float> accum, hdrAccum, accumSq;
+
+  // Write atomically, so a crash while saving leaves the last checkpoint
+  // intact. Both return false, with the reason in error, on failure.
+  bool save(const std::string &path, std::string &error) const;
+  bool load(const std::string &path, std::string &error);
+};
+
+#endif // __RENDERCHECKPOINT_H__
@@ -3,9 +3,9 @@
 
 #include "../scene/scene.h"
 
-class Box : public SceneObject {
+class Box final : public SceneObject {
 public:
-  Box(Scene *scene, Material *mat) : SceneObject(scene, mat) {}
+  Box(Scene *scene, Material *mat) : SceneObject(scene, mat, BOX) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
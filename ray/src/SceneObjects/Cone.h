@@ -3,11 +3,13 @@
 
 #include "../scene/scene.h"
 
-class Cone : public SceneObject {
+class Cone final : public SceneObject {
+  friend class SceneSnapshot;
+
 public:
   Cone(Scene *scene, Material *mat, double h = 1.0, double br = 1.0,
        double tr = 0.0, bool cap = false)
-      : SceneObject(scene, mat) {
+      : SceneObject(scene, mat, CONE) {
     height = h;
     b_radius = (br < 0.0f) ? (-br) : (br);
     t_radius = (tr < 0.0f) ? (-tr) : (tr);
@@ -54,6 +56,12 @@ public:
   bool intersectBody(const ray &r, isect &i) const;
   bool intersectCaps(const ray &r, isect &i) const;
 
+  bool sameShape(const Geometry &other) const {
+    const Cone &c = static_cast<const Cone &>(other);
+    return capped == c.capped && height == c.height &&
+           b_radius == c.b_radius && t_radius == c.t_radius;
+  }
+
 protected:
   bool isGoodRoot(glm::dvec3 root) const;
   double radiusAt(double h) const;
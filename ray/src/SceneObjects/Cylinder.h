@@ -3,10 +3,12 @@
 
 #include "../scene/scene.h"
 
-class Cylinder : public SceneObject {
+class Cylinder final : public SceneObject {
+  friend class SceneSnapshot;
+
 public:
   Cylinder(Scene *scene, Material *mat)
-      : SceneObject(scene, mat), capped(true) {}
+      : SceneObject(scene, mat, CYLINDER), capped(true) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
@@ -23,6 +25,10 @@ public:
 
   void setCapped(bool capped) { this->capped = capped; }
 
+  bool sameShape(const Geometry &other) const {
+    return capped == static_cast<const Cylinder &>(other).capped;
+  }
+
 protected:
   bool capped;
 
@@ -42,6 +42,7 @@ bool Sphere::intersectLocal(ray &r, isect &i) const {
   double v_coord = 0.5 + asin(normal[1]) / M_PI;
   
   i.setUVCoordinates(glm::dvec2(u_coord, v_coord));
+  i.setUVScale(1.0 / M_PI); // v spans the pi long meridian
 
   return true;
 }
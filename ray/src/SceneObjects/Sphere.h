@@ -3,9 +3,9 @@
 
 #include "../scene/scene.h"
 
-class Sphere : public SceneObject {
+class Sphere final : public SceneObject {
 public:
-  Sphere(Scene *scene, Material *mat) : SceneObject(scene, mat) {}
+  Sphere(Scene *scene, Material *mat) : SceneObject(scene, mat, SPHERE) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
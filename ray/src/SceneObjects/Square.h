@@ -3,9 +3,9 @@
 
 #include "../scene/scene.h"
 
-class Square : public SceneObject {
+class Square final : public SceneObject {
 public:
-  Square(Scene *scene, Material *mat) : SceneObject(scene, mat) {}
+  Square(Scene *scene, Material *mat) : SceneObject(scene, mat, SQUARE) {}
 
   virtual bool intersectLocal(ray &r, isect &i) const;
   virtual bool hasBoundingBoxCapability() const { return true; }
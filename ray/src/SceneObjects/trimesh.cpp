@@ -4,16 +4,14 @@
 #include <cmath>
 #include <float.h>
 #include <string.h>
+#include <type_traits>
 #include "../ui/TraceUI.h"
 extern TraceUI *traceUI;
 extern TraceUI *traceUI;
 
 using namespace std;
 
-Trimesh::~Trimesh() {
-  for (auto f : faces)
-    delete f;
-}
+Trimesh::~Trimesh() {}
 
 // must add vertices, normals, and materials IN ORDER
 void Trimesh::addVertex(const glm::dvec3 &v) { vertices.emplace_back(v); }
@@ -24,6 +22,27 @@ void Trimesh::addColor(const glm::dvec3 &c) { vertColors.emplace_back(c); }
 
 void Trimesh::addUV(const glm::dvec2 &uv) { uvCoords.emplace_back(uv); }
 
+void Trimesh::reserve(size_t nverts, size_t nfaces, bool withNormals,
+                      bool withUVs, bool withColors) {
+  vertices.reserve(nverts);
+  if (withNormals)
+    normals.reserve(nverts);
+  if (withUVs)
+    uvCoords.reserve(nverts);
+  if (withColors)
+    vertColors.reserve(nverts);
+  faces.reserve(nfaces);
+  faceArena.reserve(nfaces * sizeof(TrimeshFace));
+}
+
+// Faces are never destroyed one by one, only freed with faceArena.
+static_assert(std::is_trivially_destructible<TrimeshFace>::value,
+              "TrimeshFace must not need its destructor run");
+
+TrimeshFace *Trimesh::makeFace(int a, int b, int c) {
+  return faceArena.make<TrimeshFace>(this, a, b, c);
+}
+
 // Returns false if the vertices a,b,c don't all exist
 bool Trimesh::addFace(int a, int b, int c) {
   int vcnt = vertices.size();
@@ -31,17 +50,42 @@ bool Trimesh::addFace(int a, int b, int c) {
   if (a >= vcnt || b >= vcnt || c >= vcnt)
     return false;
 
-  TrimeshFace *newFace = new TrimeshFace(this, a, b, c);
-  if (!newFace->degen)
-    faces.push_back(newFace);
-  else
-    delete newFace;
+  TrimeshFace face(this, a, b, c);
+  if (!face.degen)
+    faces.push_back(faceArena.make<TrimeshFace>(face));
 
   // Don't add faces to the scene's object list so we can cull by bounding
   // box
   return true;
 }
 
+bool Trimesh::setVertices(const Vertices &v, double rebuildThreshold) {
+  vertices = v;
+  for (auto face : faces)
+    face->update();
+  if (generatedNormals)
+    generateNormals();
+  ComputeBoundingBox();
+  if (!bvh.isBuilt()) {
+    bvh.build(faces);
+    return true;
+  }
+  return bvh.refit(faces, rebuildThreshold);
+}
+
+bool Trimesh::sameShape(const Geometry &other) const {
+  const Trimesh &t = static_cast<const Trimesh &>(other);
+  if (vertNorms != t.vertNorms || generatedNormals != t.generatedNormals ||
+      vertices != t.vertices || normals != t.normals ||
+      uvCoords != t.uvCoords || faces.size() != t.faces.size())
+    return false;
+  for (size_t f = 0; f < faces.size(); f++)
+    for (int k = 0; k < 3; k++)
+      if ((*faces[f])[k] != (*t.faces[f])[k])
+        return false;
+  return true;
+}
+
 // Check to make sure that if we have per-vertex materials or normals
 // they are the right number.
 const char *Trimesh::doubleCheck() {
@@ -52,8 +96,10 @@ const char *Trimesh::doubleCheck() {
   if (!normals.empty() && normals.size() != vertices.size())
     return "Bad Trimesh: Wrong number of normals.";
 
-  bvh.build(faces);
-  
+  // A mesh restored from the mesh cache already has its BVH.
+  if (!bvh.isBuilt())
+    bvh.build(faces);
+
   return 0;
 }
 
@@ -131,6 +177,13 @@ bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
       const glm::dvec2 &uv1 = parent->uvCoords[ids[1]];
       const glm::dvec2 &uv2 = parent->uvCoords[ids[2]];
       i.setUVCoordinates((w * uv0) + (u * uv1) + (v * uv2));
+
+      glm::dvec2 duv1 = uv1 - uv0;
+      glm::dvec2 duv2 = uv2 - uv0;
+      double uvArea = std::abs(duv1[0] * duv2[1] - duv1[1] * duv2[0]);
+      double area = glm::length(glm::cross(edge1, edge2));
+      if (area > 0.0)
+        i.setUVScale(std::sqrt(uvArea / area));
       
       i.setMaterial(parent->getMaterial());
   } 
@@ -155,7 +208,7 @@ bool TrimeshFace::intersectLocal(ray &r, isect &i) const {
 // generated by averaging the normals of the neighboring faces.
 void Trimesh::generateNormals() {
   int cnt = vertices.size();
-  normals.resize(cnt);
+  normals.assign(cnt, glm::dvec3(0, 0, 0));
   std::vector<int> numFaces(cnt, 0);
 
   for (auto face : faces) {
@@ -173,5 +226,6 @@ void Trimesh::generateNormals() {
   }
 
   vertNorms = true;
+  generatedNormals = true;
 }
 
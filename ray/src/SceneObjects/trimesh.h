@@ -16,8 +16,10 @@
 
 class TrimeshFace;
 
-class Trimesh : public SceneObject {
+class Trimesh final : public SceneObject {
     friend class TrimeshFace;
+    friend class MeshCache;
+    friend class SceneSnapshot;
 
     typedef std::vector<glm::dvec3> Normals;
     typedef std::vector<glm::dvec3> Vertices;
@@ -35,15 +37,23 @@ class Trimesh : public SceneObject {
 private:
     TrimeshBVH bvh;  // ✅ BVH belongs to the mesh, not individual faces
 
+    // The faces live here, so dropping a mesh frees a few blocks rather
+    // than every face.
+    Arena faceArena;
+    TrimeshFace* makeFace(int a, int b, int c);
+
 public:
     Trimesh(Scene* scene, Material* mat, MatrixTransform transform)
-        : SceneObject(scene, mat), displayListWithMaterials(0),
+        : SceneObject(scene, mat, TRIMESH), displayListWithMaterials(0),
           displayListWithoutMaterials(0) {
         this->transform = transform;
         vertNorms = false;
     }
 
     bool vertNorms;
+    // The vertex normals came from generateNormals() rather than the scene
+    // file or OBJ, so they can be generated again when the vertices move.
+    bool generatedNormals = false;
 
     bool intersectLocal(ray &r, isect &i) const;
 
@@ -56,10 +66,35 @@ public:
     void addUV(const glm::dvec2 &);
     bool addFace(int a, int b, int c);
 
+    // Make room for this many vertices (and their normals, UVs and colors,
+    // if the mesh will have them) and faces ahead of adding them.
+    void reserve(size_t nverts, size_t nfaces, bool withNormals,
+                 bool withUVs, bool withColors);
+
     const char* doubleCheck();
 
     void generateNormals();
 
+    // Move the vertices to v (the same number of them), e.g. for the next
+    // frame of an animation, and bring the faces, normals, bounds and BVH
+    // up to date. Generated vertex normals are generated again from the
+    // faces; authored ones are kept as they are. The BVH is refitted, or
+    // rebuilt past rebuildThreshold (see SceneBVH::refit); returns true if
+    // rebuilt.
+    bool setVertices(const Vertices &v, double rebuildThreshold);
+    size_t vertexCount() const { return vertices.size(); }
+    bool sameShape(const Geometry &other) const;
+
+    // Use other's vertex colors, e.g. after they were edited in the scene
+    // file, if it has as many.
+    void setColors(const Trimesh &other) {
+        if (other.vertColors.size() == vertColors.size())
+            vertColors = other.vertColors;
+    }
+    bool sameColors(const Trimesh &other) const {
+        return vertColors == other.vertColors;
+    }
+
     bool hasBoundingBoxCapability() const { return true; }
 
     BoundingBox ComputeLocalBoundingBox() {
@@ -104,11 +139,15 @@ public:
         ids[0] = a;
         ids[1] = b;
         ids[2] = c;
+        update();
+    }
 
+    // Recompute the normal and bounds from the parent's vertices.
+    void update() {
         // Compute the face normal
-        glm::dvec3 a_coords = parent->vertices[a];
-        glm::dvec3 b_coords = parent->vertices[b];
-        glm::dvec3 c_coords = parent->vertices[c];
+        glm::dvec3 a_coords = parent->vertices[ids[0]];
+        glm::dvec3 b_coords = parent->vertices[ids[1]];
+        glm::dvec3 c_coords = parent->vertices[ids[2]];
 
         glm::dvec3 vab = b_coords - a_coords;
         glm::dvec3 vac = c_coords - a_coords;
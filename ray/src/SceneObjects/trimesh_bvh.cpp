@@ -1,76 +1,106 @@
 #include "trimesh_bvh.h"
 #include "trimesh.h"
+#include "../scene/bvhRefit.h"
+#include "../ui/TraceUI.h"
 #include <algorithm>
 
 static const int MAX_FACES_PER_LEAF = 4;
 
-TrimeshBVHNode::TrimeshBVHNode() : left(nullptr), right(nullptr) {}
+TrimeshBVHNode::TrimeshBVHNode() : left(-1), right(-1), first(0), count(0) {}
 
-TrimeshBVHNode::~TrimeshBVHNode() {
-  delete left;
-  delete right;
-}
+TrimeshBVH::TrimeshBVH() : built(false) {}
 
-TrimeshBVH::TrimeshBVH() : root(nullptr) {}
+TrimeshBVH::~TrimeshBVH() {}
 
-TrimeshBVH::~TrimeshBVH() {
-  delete root;
+void TrimeshBVH::build(const std::vector<TrimeshFace*>& faces) {
+  nodes.clear();
+  faceOrder.resize(faces.size());
+  for (size_t k = 0; k < faces.size(); k++)
+    faceOrder[k] = (int)k;
+  if (!faces.empty())
+    buildRecursive(faces, faceOrder, 0, (int)faces.size(), 0);
+  resolveFaces(faces);
+  built = true;
+  builtCost = bvhCost(nodes);
 }
 
-void TrimeshBVH::build(const std::vector<TrimeshFace*>& faces) {
-  delete root;
-  std::vector<TrimeshFace*> copy = faces;
-  root = buildRecursive(copy, 0);
+bool TrimeshBVH::refit(const std::vector<TrimeshFace*>& faces,
+                       double rebuildThreshold) {
+  // A tree read from a mesh cache or snapshot is measured against itself
+  // as it was before this first move.
+  if (builtCost <= 0.0)
+    builtCost = bvhCost(nodes);
+  refitBVHNodes(nodes, [this](int k) { return leafFaces[k]->getBoundingBox(); });
+  if (bvhCost(nodes) <= rebuildThreshold * builtCost)
+    return false;
+  build(faces);
+  return true;
+}
+
+// Point the leaves back at the faces, once faceOrder is final.
+void TrimeshBVH::resolveFaces(const std::vector<TrimeshFace*>& faces) {
+  leafFaces.resize(faceOrder.size());
+  for (size_t k = 0; k < faceOrder.size(); k++)
+    leafFaces[k] = faces[faceOrder[k]];
 }
 
-TrimeshBVHNode* TrimeshBVH::buildRecursive(std::vector<TrimeshFace*>& faces, int depth) {
-  TrimeshBVHNode* node = new TrimeshBVHNode();
+int TrimeshBVH::buildRecursive(const std::vector<TrimeshFace*>& faces,
+                               std::vector<int>& order, int begin, int end,
+                               int depth) {
+  int index = (int)nodes.size();
+  nodes.emplace_back();
 
   // Compute bounds
-  for (auto f : faces) {
-    node->bounds.merge(f->getBoundingBox());
+  BoundingBox bounds;
+  for (int k = begin; k < end; k++) {
+    bounds.merge(faces[order[k]]->getBoundingBox());
   }
+  nodes[index].bounds = bounds;
 
-  if (faces.size() <= MAX_FACES_PER_LEAF) {
-    node->faces = faces;
-    return node;
+  if (end - begin <= MAX_FACES_PER_LEAF) {
+    nodes[index].first = begin;
+    nodes[index].count = end - begin;
+    return index;
   }
 
   // Choose split axis by largest extent
-  glm::dvec3 ext = node->bounds.getMax() - node->bounds.getMin();
+  glm::dvec3 ext = bounds.getMax() - bounds.getMin();
   int axis = 0;
   if (ext.y > ext.x && ext.y > ext.z) axis = 1;
   else if (ext.z > ext.x) axis = 2;
 
-  std::sort(faces.begin(), faces.end(), [axis](TrimeshFace* a, TrimeshFace* b) {
-    return a->getBoundingBox().getMin()[axis] < b->getBoundingBox().getMin()[axis];
+  std::sort(order.begin() + begin, order.begin() + end, [&faces, axis](int a, int b) {
+    return faces[a]->getBoundingBox().getMin()[axis] < faces[b]->getBoundingBox().getMin()[axis];
   });
 
-  size_t mid = faces.size() / 2;
-  std::vector<TrimeshFace*> leftFaces(faces.begin(), faces.begin() + mid);
-  std::vector<TrimeshFace*> rightFaces(faces.begin() + mid, faces.end());
+  int mid = begin + (end - begin) / 2;
 
-  node->left = buildRecursive(leftFaces, depth + 1);
-  node->right = buildRecursive(rightFaces, depth + 1);
+  // nodes may reallocate while children are added; don't hold references
+  int left = buildRecursive(faces, order, begin, mid, depth + 1);
+  int right = buildRecursive(faces, order, mid, end, depth + 1);
+  nodes[index].left = left;
+  nodes[index].right = right;
 
-  return node;
+  return index;
 }
 
 bool TrimeshBVH::intersect(ray& r, isect& i) const {
-  if (!root) return false;
-  return intersectNode(root, r, i);
+  if (nodes.empty()) return false;
+  return intersectNode(0, r, i);
 }
 
-bool TrimeshBVH::intersectNode(TrimeshBVHNode* node, ray& r, isect& i) const {
+bool TrimeshBVH::intersectNode(int index, ray& r, isect& i) const {
+  const TrimeshBVHNode* node = &nodes[index];
+  TraceUI::touchNode(node, ray_thread_id);
   double tmin, tmax;
   if (!node->bounds.intersect(r, tmin, tmax)) return false;
 
   bool hit = false;
 
   if (node->isLeaf()) {
-    for (auto f : node->faces) {
+    for (int k = node->first; k < node->first + node->count; k++) {
       isect cur;
-      if (f->intersectLocal(r, cur)) {
+      if (leafFaces[k]->intersectLocal(r, cur)) {
         if (!hit || cur.getT() < i.getT()) {
           i = cur;
           hit = true;
@@ -81,8 +111,8 @@ bool TrimeshBVH::intersectNode(TrimeshBVHNode* node, ray& r, isect& i) const {
   }
 
   isect leftI, rightI;
-  bool hitLeft = node->left && intersectNode(node->left, r, leftI);
-  bool hitRight = node->right && intersectNode(node->right, r, rightI);
+  bool hitLeft = node->left >= 0 && intersectNode(node->left, r, leftI);
+  bool hitRight = node->right >= 0 && intersectNode(node->right, r, rightI);
 
   if (hitLeft && hitRight) {
     i = (leftI.getT() < rightI.getT()) ? leftI : rightI;
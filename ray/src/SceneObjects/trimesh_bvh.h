@@ -7,33 +7,49 @@
 
 class TrimeshFace;
 
-// Simple BVH node for Trimesh acceleration
+// Simple BVH node for Trimesh acceleration. Nodes live in one array and
+// refer to each other by index, which keeps them together in memory and
+// lets the whole tree be written to and read back from a mesh cache.
 class TrimeshBVHNode {
 public:
   BoundingBox bounds;
-  TrimeshBVHNode* left;
-  TrimeshBVHNode* right;
-  std::vector<TrimeshFace*> faces;
+  int left;   // index of the children, -1 for a leaf
+  int right;
+  int first;  // a leaf's faces are leafFaces[first, first + count)
+  int count;
 
   TrimeshBVHNode();
-  ~TrimeshBVHNode();
 
-  bool isLeaf() const { return left == nullptr && right == nullptr; }
+  bool isLeaf() const { return left < 0 && right < 0; }
 };
 
 class TrimeshBVH {
+  friend class MeshCache;
+  friend class SceneSnapshot;
+
 public:
   TrimeshBVH();
   ~TrimeshBVH();
 
   void build(const std::vector<TrimeshFace*>& faces);
+  bool isBuilt() const { return built; }
   bool intersect(ray& r, isect& i) const;
 
-private:
-  TrimeshBVHNode* root;
+  // The faces have moved; like SceneBVH::refit. Returns true if the tree
+  // was rebuilt.
+  bool refit(const std::vector<TrimeshFace*>& faces, double rebuildThreshold);
 
-  TrimeshBVHNode* buildRecursive(std::vector<TrimeshFace*>& faces, int depth);
-  bool intersectNode(TrimeshBVHNode* node, ray& r, isect& i) const;
+private:
+  std::vector<TrimeshBVHNode> nodes; // nodes[0] is the root
+  std::vector<int> faceOrder;        // face indices in leaf order
+  std::vector<TrimeshFace*> leafFaces;
+  bool built;
+  double builtCost = 0.0; // bvhCost when built, 0 if unknown
+
+  int buildRecursive(const std::vector<TrimeshFace*>& faces,
+                     std::vector<int>& order, int begin, int end, int depth);
+  bool intersectNode(int node, ray& r, isect& i) const;
+  void resolveFaces(const std::vector<TrimeshFace*>& faces);
 };
 
-#endif // TRIMESH_BVH_H__
\ No newline at end of file
+#endif // TRIMESH_BVH_H__
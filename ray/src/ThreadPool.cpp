@@ -0,0 +1,68 @@
+#include "ThreadPool.h"
+#include "RayTracer.h"
+#include "scene/ray.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int threads) {
+  turn = jobs.end();
+  unsigned int n = std::min(std::max(threads, 1u), (unsigned int)MAX_THREADS);
+  for (unsigned int id = 0; id < n; id++)
+    workers.emplace_back(&ThreadPool::work, this, id);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    quit = true;
+  }
+  wake.notify_all();
+  for (auto &t : workers)
+    t.join();
+}
+
+void ThreadPool::run(int count, const std::function<void(int)> &item) {
+  if (count <= 0)
+    return;
+  std::unique_lock<std::mutex> guard(lock);
+  auto job = jobs.insert(jobs.end(), Job{&item, count});
+  wake.notify_all();
+  finished.wait(guard, [&] {
+    return job->next >= job->count && job->active == 0;
+  });
+  if (turn == job)
+    ++turn;
+  jobs.erase(job);
+}
+
+void ThreadPool::work(unsigned int id) {
+  ray_thread_id = id;
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;) {
+    // Starting from whoever's turn it is, find a job with items left.
+    auto job = jobs.end();
+    for (size_t tried = 0; tried < jobs.size(); tried++) {
+      if (turn == jobs.end())
+        turn = jobs.begin();
+      auto candidate = turn++;
+      if (candidate->next < candidate->count) {
+        job = candidate;
+        break;
+      }
+    }
+    if (job == jobs.end()) {
+      if (quit)
+        return;
+      wake.wait(guard);
+      continue;
+    }
+
+    int k = job->next++;
+    job->active++;
+    guard.unlock();
+    (*job->item)(k);
+    guard.lock();
+    if (--job->active == 0 && job->next >= job->count)
+      finished.notify_all();
+  }
+}
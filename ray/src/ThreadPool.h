@@ -0,0 +1,50 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+// Render threads shared between several RayTracers.
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A fixed set of threads that several renders can run on at once. A
+ * render hands over a job of numbered items (its blocks); idle threads
+ * take the next item of each job in turn, so renders running side by
+ * side share the threads evenly rather than queueing behind each other.
+ * Each thread sets ray_thread_id to its index for the statistics.
+ */
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int threads);
+  ~ThreadPool();
+
+  unsigned int size() const { return (unsigned int)workers.size(); }
+
+  // Call item(k) for k in [0, count) on the pool's threads and return once
+  // every call has. The calling thread only waits.
+  void run(int count, const std::function<void(int)> &item);
+
+private:
+  struct Job {
+    const std::function<void(int)> *item;
+    int count;
+    int next = 0;
+    int active = 0;
+  };
+
+  void work(unsigned int id);
+
+  std::vector<std::thread> workers;
+  std::list<Job> jobs;
+  std::list<Job>::iterator turn; // the job to take from next
+  std::mutex lock;
+  std::condition_variable wake;     // for the workers
+  std::condition_variable finished; // for run()
+  bool quit = false;
+};
+
+#endif // __THREADPOOL_H__
@@ -0,0 +1,167 @@
+#ifndef FILEIO_BINARYIO_H
+#define FILEIO_BINARYIO_H
+
+#include <cmath>
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../scene/bbox.h"
+
+/*
+ * Helpers for the binary files we write (mesh caches, scene snapshots).
+ * Values are stored as they are in memory, so the files are only meant to
+ * be read back by the same build on the same kind of machine; each format
+ * has its own version number and endianness mark to catch the rest.
+ */
+
+class BinaryWriter {
+public:
+  std::string bytes;
+
+  template <typename T> void put(const T &v) {
+    bytes.append((const char *)&v, sizeof(T));
+  }
+  void putBytes(const void *p, size_t n) { bytes.append((const char *)p, n); }
+  void putString(const std::string &s) {
+    put((uint64_t)s.size());
+    putBytes(s.data(), s.size());
+  }
+  template <typename T> void putArray(const std::vector<T> &v) {
+    put((uint64_t)v.size());
+    putBytes(v.data(), v.size() * sizeof(T));
+  }
+  void putBox(const BoundingBox &b) {
+    put((uint8_t)b.isEmpty());
+    put(b.getMin());
+    put(b.getMax());
+  }
+};
+
+// Reads from a block of memory, usually a MappedFile. Every read is bounds
+// checked; once a read fails, the reader stays failed and returns zeroes.
+class BinaryReader {
+public:
+  BinaryReader(const char *p, size_t n) : cur(p), end(p + n) {}
+
+  bool ok() const { return good; }
+  void fail() { good = false; }
+
+  template <typename T> T get() {
+    T v{};
+    getBytes(&v, sizeof(T));
+    return v;
+  }
+  void getBytes(void *dst, size_t n) {
+    if (!good || (size_t)(end - cur) < n) {
+      good = false;
+      return;
+    }
+    if (n)
+      std::memcpy(dst, cur, n);
+    cur += n;
+  }
+  std::string getString() {
+    uint64_t n = get<uint64_t>();
+    if (!good || (size_t)(end - cur) < n) {
+      good = false;
+      return std::string();
+    }
+    std::string s(cur, (size_t)n);
+    cur += n;
+    return s;
+  }
+  template <typename T> void getArray(std::vector<T> &v) {
+    uint64_t n = get<uint64_t>();
+    if (!good || (size_t)(end - cur) / sizeof(T) < n) {
+      good = false;
+      return;
+    }
+    v.resize((size_t)n);
+    getBytes(v.data(), (size_t)n * sizeof(T));
+  }
+  BoundingBox getBox() {
+    bool empty = get<uint8_t>() != 0;
+    glm::dvec3 lo = get<glm::dvec3>();
+    glm::dvec3 hi = get<glm::dvec3>();
+    return empty ? BoundingBox() : BoundingBox(lo, hi);
+  }
+
+private:
+  const char *cur;
+  const char *end;
+  bool good = true;
+};
+
+// On-disk node of a flattened BVH (TrimeshBVHNode, SceneBVHNode). Children
+// and item ranges are indices, so an array of them can be copied as is. An
+// empty box is stored inside out (min > max).
+struct PackedBVHNode {
+  double bmin[3];
+  double bmax[3];
+  int32_t left, right;
+  int32_t first, count;
+};
+
+template <typename Node>
+void packBVHNodes(const std::vector<Node> &nodes,
+                  std::vector<PackedBVHNode> &packed) {
+  packed.clear();
+  packed.reserve(nodes.size());
+  for (const Node &node : nodes) {
+    PackedBVHNode p;
+    glm::dvec3 lo = node.bounds.getMin(), hi = node.bounds.getMax();
+    if (node.bounds.isEmpty()) {
+      lo = glm::dvec3(HUGE_VAL);
+      hi = glm::dvec3(-HUGE_VAL);
+    }
+    for (int k = 0; k < 3; k++) {
+      p.bmin[k] = lo[k];
+      p.bmax[k] = hi[k];
+    }
+    p.left = node.left;
+    p.right = node.right;
+    p.first = node.first;
+    p.count = node.count;
+    packed.push_back(p);
+  }
+}
+
+template <typename Node>
+void unpackBVHNodes(const std::vector<PackedBVHNode> &packed,
+                    std::vector<Node> &nodes) {
+  nodes.resize(packed.size());
+  for (size_t n = 0; n < packed.size(); n++) {
+    const PackedBVHNode &p = packed[n];
+    Node &node = nodes[n];
+    if (p.bmin[0] > p.bmax[0])
+      node.bounds = BoundingBox();
+    else
+      node.bounds = BoundingBox(glm::dvec3(p.bmin[0], p.bmin[1], p.bmin[2]),
+                                glm::dvec3(p.bmax[0], p.bmax[1], p.bmax[2]));
+    node.left = p.left;
+    node.right = p.right;
+    node.first = p.first;
+    node.count = p.count;
+  }
+}
+
+// Whether the nodes form a tree over `items` leaf entries. Children must
+// come after their parent, which also rules out cycles.
+inline bool validBVHNodes(const std::vector<PackedBVHNode> &packed,
+                          size_t items) {
+  for (size_t n = 0; n < packed.size(); n++) {
+    const PackedBVHNode &p = packed[n];
+    auto child = [&](int32_t c) {
+      return c == -1 || (c > (int32_t)n && c < (int32_t)packed.size());
+    };
+    if (!child(p.left) || !child(p.right) || p.first < 0 || p.count < 0 ||
+        (size_t)p.first + p.count > items)
+      return false;
+  }
+  return true;
+}
+
+#endif
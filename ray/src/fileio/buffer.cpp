@@ -1,6 +1,6 @@
 /*
-  The Buffer class is essentially a wrapper for an istream.
-  It is here mainly to keep track of the current file location
+  The Buffer class hands out the characters of a source file one at a
+  time. It is here mainly to keep track of the current file location
   (line number, column number) to print intelligent error messages.
 
 
@@ -9,57 +9,102 @@
 */
 
 #include "buffer.h"
+#include "mappedfile.h"
+
+#include <cstring>
+#include <iterator>
 #include <string>
 
 // #include "../parser/Parser.h"
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Buffer::Buffer(FILE*,...) constructor
+// Buffer::Buffer(istream&,...) constructor
 //
 //   This constructor sets up the initial state that we need in order
-// to read files.
+// to read files.  The stream is read in full right away.
 //
 
-Buffer::Buffer(istream &is, bool printChars, bool printLines) : inStream(is) {
-  PositionInCurrentLine = Line.begin();
-  LineNumber = 0;
-  ColNumber = 0;
-  LastPrintedLine = 0;
+Buffer::Buffer(istream &is, bool printChars, bool printLines)
+    : Contents(std::istreambuf_iterator<char>(is),
+               std::istreambuf_iterator<char>()) {
+  _printChars = printChars;
+  _printLines = printLines;
+  Init(Contents.data(), Contents.size());
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Buffer::Buffer(const string&,...) constructor
+//
+//   Same, but maps the named file into memory instead of copying it.  A
+// file that can't be opened reads as empty.
+//
 
+Buffer::Buffer(const std::string &path, bool printChars, bool printLines)
+    : Mapping(new MappedFile(path)) {
   _printChars = printChars;
   _printLines = printLines;
+  Init(Mapping->data(), Mapping->size());
+}
+
+Buffer::~Buffer() {}
+
+void Buffer::Init(const char *data, size_t size) {
+  if (data == nullptr)
+    data = ""; // Pos == nullptr means "not started", so never point there
+  Begin = data;
+  End = data + size;
+  Pos = nullptr;
+  LineStart = data;
+  AtEOF = false;
+  LineNumber = 0;
+  LastPrintedLine = 0;
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// char Buffer::GetCh() private method
+// char Buffer::GetChSlow() private method
 //
-//   GetCh() gets a new character from the buffer and returns it
+//   GetChSlow() does the work of GetCh() whenever moving to the next
+// character is more than a pointer increment: at the start of the file,
+// at the end of a line, at the end of the file, and when printing.
 //
 
-char Buffer::GetCh() {
-  if (!inStream) {
+char Buffer::GetChSlow() {
+  if (AtEOF) {
     return '\0';
   }
 
-  // advance position
-  if (!Line.empty() && PositionInCurrentLine != Line.end()) {
-    PositionInCurrentLine++;
-    ColNumber++;
-  }
-
-  while (PositionInCurrentLine == Line.end() || Line.empty()) {
-    // need to read another line of input from the file
-
-    GetLine();
-    if (!inStream) {
-      return '\0';
+  if (Pos == nullptr) {
+    Pos = Begin;
+    LineNumber = 1;
+    if (_printLines && Pos != End)
+      PrintLine(std::cout);
+  } else if (Pos == End) {
+    // we just handed out the newline that the last line was missing
+    AtEOF = true;
+    return '\0';
+  } else {
+    // advance position
+    if (*Pos == '\n') {
+      LineStart = Pos + 1;
+      LineNumber++;
+      if (_printLines && LineStart != End)
+        PrintLine(std::cout);
     }
+    Pos++;
   }
 
-  // extract character from line buffer
-  char CurrentCh = *PositionInCurrentLine;
+  char CurrentCh;
+  if (Pos != End) {
+    CurrentCh = *Pos;
+  } else if (Pos != Begin && Pos[-1] != '\n') {
+    CurrentCh = '\n'; // every line ends in a newline, even the last
+  } else {
+    AtEOF = true;
+    return '\0';
+  }
 
   if (_printChars) {
     std::cout << "Read character `" << CurrentCh << "'" << std::endl;
@@ -68,32 +113,6 @@ char Buffer::GetCh() {
   return CurrentCh;
 }
 
-//////////////////////////////////////////////////////////////////////////
-//
-// void Buffer::GetLine() private method
-//
-//   GetLine() reads a new line from the file into the Line buffer
-// variable.  It also handles listings, if necessary.  Returns are false
-// for EOF or true for got a new buffer.
-//
-// This function is weak, in that it can't handle arbitrarily long lines
-// in a file.  Ideally it would be rewritten so that it can do this fine.
-// The real difficulty is in being able to print out, on demand, the whole
-// line of input, of arbitrary length.
-//
-
-void Buffer::GetLine() {
-  std::getline(inStream, Line);
-  Line.append("\n"); // because iostreams strip out the end-of-line char
-  PositionInCurrentLine = Line.begin();
-
-  ColNumber = 0;
-  LineNumber++;
-
-  if (_printLines)
-    PrintLine(std::cout);
-}
-
 //////////////////////////////////////////////////////////////////////////
 //
 // void Buffer::PrintLine() method
@@ -103,7 +122,11 @@ void Buffer::GetLine() {
 
 void Buffer::PrintLine(ostream &out) const {
   if (LineNumber > LastPrintedLine) {
-    out << "# " << Line << std::endl;
+    const char *eol = LineStart < End ? (const char *)std::memchr(
+                                            LineStart, '\n', End - LineStart)
+                                      : nullptr;
+    out << "# " << std::string(LineStart, eol ? eol : End) << std::endl
+        << std::endl;
     LastPrintedLine = LineNumber;
   }
 }
@@ -5,13 +5,17 @@
 #define _BUFFER_H_
 
 /*
-  The Buffer class is essentially a wrapper for an istream.
-  It is here mainly to keep track of the current file location
+  The Buffer class hands out the characters of a source file one at a
+  time. It is here mainly to keep track of the current file location
   (line number, column number) to print intelligent error messages.
 
+  The whole file is held in memory: files opened by name are memory
+  mapped, and streams are read in full up front. Characters are handed
+  out by moving a pointer, so GetCh() is cheap enough to be called for
+  every character, and the tokenizer can look at whole runs of
+  characters (numbers, identifiers) in place through Current().
 
-  If you find yourself changing stuff in this file, you're probably
-  doing something wrong.
+  Every line ends with a '\n', even the last one if the file does not.
 
   This class was borrowed from the stock PL0 source code used for
   CSE401, because I didn't feel like rewriting it.
@@ -19,33 +23,63 @@
 */
 
 #include <iostream>
+#include <memory>
 #include <string>
 
 using std::istream;
 using std::ostream;
 using std::string;
 
+class MappedFile;
+
 class Buffer {
 public:
   Buffer(std::istream &file, bool printChars, bool printLines);
+  Buffer(const std::string &path, bool printChars, bool printLines);
+  ~Buffer();
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  // Read and return next character, or '\0' at the end of the file
+  char GetCh() {
+    if (Pos != nullptr && End - Pos > 1 && *Pos != '\n' && !_printChars)
+      return *++Pos;
+    return GetChSlow(); // new lines, end of file, printing
+  }
+
+  // Skip the current character and the n - 1 after it, which must all be
+  // on the current line, and return the character that follows.
+  char Skip(size_t n) {
+    Pos += n - 1;
+    return GetCh();
+  }
+
+  // The current character and those after it, up to EndOfData(). Only
+  // meaningful once GetCh() has been called.
+  const char *Current() const { return Pos; }
+  const char *EndOfData() const { return End; }
 
-  char GetCh();                        // Read and return next character
-  bool isEOF() { return !(inStream); } // Return whether is end of file
+  bool isEOF() const { return AtEOF; } // Return whether is end of file
 
   void PrintLine(std::ostream &out) const; // Print current line
 
-  int CurColumn() const { return ColNumber; }
+  int CurColumn() const { return Pos ? (int)(Pos - LineStart) : 0; }
   int CurLine() const { return LineNumber; } // Return current line #
 
 protected:
-  void GetLine(); // Read next line from file
+  void Init(const char *data, size_t size);
+  char GetChSlow();
 
-  std::istream &inStream; // The file pointer to the source file
+  std::unique_ptr<MappedFile> Mapping; // the file, when opened by name
+  std::string Contents;                // the file, when read from a stream
 
-  std::string Line; // The line buffer
-  std::string::const_iterator PositionInCurrentLine;
+  const char *Begin;     // Start of the file contents
+  const char *End;       // One past the end of the file contents
+  const char *Pos;       // The current character; null before the first
+  const char *LineStart; // The first character of the current line
 
-  int ColNumber;               // The number of the current column
+  bool AtEOF;                  // Set once the last character is consumed
   int LineNumber;              // The number of the line in the file
   mutable int LastPrintedLine; // The line number of the last printed line
 
@@ -0,0 +1,169 @@
+#include "hdrimage.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+bool littleEndian() {
+  uint16_t one = 1;
+  return *(const uint8_t *)&one == 1;
+}
+
+// Appends little-endian values, which is what both PFM (with a negative
+// scale) and EXR want.
+struct LEWriter {
+  vector<char> bytes;
+
+  void raw(const void *p, size_t n) {
+    const char *c = (const char *)p;
+    bytes.insert(bytes.end(), c, c + n);
+  }
+  template <typename T> void put(T v) {
+    char b[sizeof(T)];
+    memcpy(b, &v, sizeof(T));
+    if (!littleEndian())
+      std::reverse(b, b + sizeof(T));
+    raw(b, sizeof(T));
+  }
+  void str(const string &s) { raw(s.c_str(), s.size() + 1); }
+};
+
+void writeFile(const char *fname, const vector<char> &bytes) {
+  FILE *fp = fopen(fname, "wb");
+  if (!fp)
+    throw string("File could not be opened for writing: ") + fname;
+  bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+  ok = fclose(fp) == 0 && ok;
+  if (!ok)
+    throw string("Error writing ") + fname;
+}
+
+void writePFMPlane(const string &fname, int width, int height,
+                   const ImagePlane &plane) {
+  char header[64];
+  snprintf(header, sizeof header, "%s\n%d %d\n-1.0\n",
+           plane.channels == 3 ? "PF" : "Pf", width, height);
+  LEWriter out;
+  out.raw(header, strlen(header));
+  size_t n = size_t(width) * height * plane.channels;
+  for (size_t k = 0; k < n; k++)
+    out.put(plane.data[k]);
+  writeFile(fname.c_str(), out.bytes);
+}
+
+} // namespace
+
+void writePFM(const char *fname, int width, int height,
+              const vector<ImagePlane> &planes, const ImageWindow &) {
+  string base(fname), ext;
+  size_t dot = base.find_last_of('.');
+  if (dot != string::npos && base.find_first_of("\\/", dot) == string::npos) {
+    ext = base.substr(dot);
+    base.erase(dot);
+  }
+  for (const ImagePlane &plane : planes) {
+    string name = plane.name.empty() ? string(fname)
+                                     : base + "." + plane.name + ext;
+    writePFMPlane(name, width, height, plane);
+  }
+}
+
+void writeEXR(const char *fname, int width, int height,
+              const vector<ImagePlane> &planes, const ImageWindow &window) {
+  // EXR wants channels sorted by name, each stored as a whole row.
+  struct Channel {
+    string name;
+    const float *data;
+    int stride;
+  };
+  vector<Channel> channels;
+  for (const ImagePlane &plane : planes) {
+    if (plane.channels == 1) {
+      channels.push_back({plane.name == "depth" ? "Z" : plane.name,
+                          plane.data, 1});
+      continue;
+    }
+    const char *xyz = plane.name == "normal" ? "XYZ" : "RGB";
+    for (int c = 0; c < 3; c++) {
+      string suffix(1, xyz[c]);
+      channels.push_back({plane.name.empty() ? suffix
+                                             : plane.name + "." + suffix,
+                          plane.data + c, 3});
+    }
+  }
+  std::sort(channels.begin(), channels.end(),
+            [](const Channel &a, const Channel &b) { return a.name < b.name; });
+
+  LEWriter out;
+  out.put(uint32_t(20000630)); // magic
+  out.put(uint32_t(2));        // version 2, single-part scanline
+
+  auto attribute = [&](const char *name, const char *type, uint32_t size) {
+    out.str(name);
+    out.str(type);
+    out.put(size);
+  };
+
+  uint32_t chlistSize = 1;
+  for (const Channel &c : channels)
+    chlistSize += uint32_t(c.name.size() + 1 + 16);
+  attribute("channels", "chlist", chlistSize);
+  for (const Channel &c : channels) {
+    out.str(c.name);
+    out.put(int32_t(2)); // FLOAT
+    out.put(uint32_t(0)); // pLinear and reserved
+    out.put(int32_t(1)); // x sampling
+    out.put(int32_t(1)); // y sampling
+  }
+  out.put(uint8_t(0));
+
+  attribute("compression", "compression", 1);
+  out.put(uint8_t(0)); // NO_COMPRESSION
+  int x0 = window.x, y0 = window.y;
+  int fullWidth = window.fullWidth ? window.fullWidth : x0 + width;
+  int fullHeight = window.fullWidth ? window.fullHeight : y0 + height;
+  attribute("dataWindow", "box2i", 16);
+  out.put(int32_t(x0));
+  out.put(int32_t(y0));
+  out.put(int32_t(x0 + width - 1));
+  out.put(int32_t(y0 + height - 1));
+  attribute("displayWindow", "box2i", 16);
+  out.put(int32_t(0));
+  out.put(int32_t(0));
+  out.put(int32_t(fullWidth - 1));
+  out.put(int32_t(fullHeight - 1));
+  attribute("lineOrder", "lineOrder", 1);
+  out.put(uint8_t(0)); // INCREASING_Y
+  attribute("pixelAspectRatio", "float", 4);
+  out.put(1.0f);
+  attribute("screenWindowCenter", "v2f", 8);
+  out.put(0.0f);
+  out.put(0.0f);
+  attribute("screenWindowWidth", "float", 4);
+  out.put(1.0f);
+  out.put(uint8_t(0)); // end of header
+
+  // Uncompressed, so every line is a chunk of the same size and the
+  // offset table can be written up front.
+  uint32_t lineBytes = uint32_t(channels.size() * width * sizeof(float));
+  uint64_t first = out.bytes.size() + uint64_t(height) * 8;
+  for (int y = 0; y < height; y++)
+    out.put(first + uint64_t(y) * (8 + lineBytes));
+
+  // EXR's first line is the top of the image; ours is the bottom.
+  for (int y = 0; y < height; y++) {
+    size_t row = size_t(height - 1 - y) * width;
+    out.put(int32_t(y0 + y));
+    out.put(lineBytes);
+    for (const Channel &c : channels)
+      for (int x = 0; x < width; x++)
+        out.put(c.data[(row + x) * c.stride]);
+  }
+  writeFile(fname, out.bytes);
+}
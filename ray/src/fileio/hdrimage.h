@@ -0,0 +1,38 @@
+#ifndef FILEIO_HDRIMAGE_H
+#define FILEIO_HDRIMAGE_H
+
+#include "imagewindow.h"
+#include <string>
+#include <vector>
+
+/*
+ * Writers for floating point images. Pixels are linear and unclamped,
+ * stored bottom row first like the 8-bit buffers.
+ *
+ * An image is a list of planes. The plane named "" is the color and
+ * must come first with three channels; the others are auxiliary outputs
+ * such as "depth" (one channel) or "normal" (three).
+ */
+struct ImagePlane {
+  std::string name;
+  int channels; // 1 or 3, interleaved
+  const float *data;
+};
+
+// Portable float map. A .pfm holds a single plane, so each auxiliary one
+// goes to a file of its own next to the color, e.g. out.depth.pfm. There
+// is nowhere to record a window.
+void writePFM(const char *fname, int width, int height,
+              const std::vector<ImagePlane> &planes,
+              const ImageWindow &window = ImageWindow());
+
+// Single-part scanline OpenEXR with 32-bit float channels and no
+// compression. The color is R, G, B; a one-channel plane is named after
+// itself ("depth" becomes Z), a three-channel one gets .R/.G/.B (or .X,
+// .Y, .Z for normals) appended. A window becomes the data window, inside
+// a display window the size of the frame.
+void writeEXR(const char *fname, int width, int height,
+              const std::vector<ImagePlane> &planes,
+              const ImageWindow &window = ImageWindow());
+
+#endif
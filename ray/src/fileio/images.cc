@@ -30,13 +30,31 @@ Backend backends[] = {
 
 const Backend *bmp_handler = &backends[0];
 
-const Backend *find_handler(const char *fname) {
+struct FloatBackend {
+  const char *ext;
+  void (*writer)(const char *iname, int width, int height,
+                 const std::vector<ImagePlane> &planes,
+                 const ImageWindow &window);
+};
+
+FloatBackend float_backends[] = {
+    {".pfm", writePFM},
+    {".exr", writeEXR},
+};
+
+string extension(const char *fname) {
   string filename(fname);
   int start = (int)filename.find_last_of('.');
   int end = (int)filename.size() - 1;
   if (start < 0 || start >= end)
+    return string();
+  return filename.substr(start, end);
+}
+
+const Backend *find_handler(const char *fname) {
+  string ext = extension(fname);
+  if (ext.empty())
     return NULL;
-  string ext = filename.substr(start, end);
   for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
     if (cicmp(ext, backends[i].ext))
       return &backends[i];
@@ -44,6 +62,17 @@ const Backend *find_handler(const char *fname) {
   return NULL;
 }
 
+const FloatBackend *find_float_handler(const char *fname) {
+  string ext = extension(fname);
+  if (ext.empty())
+    return NULL;
+  for (const FloatBackend &backend : float_backends) {
+    if (cicmp(ext, backend.ext))
+      return &backend;
+  }
+  return NULL;
+}
+
 }; // namespace
 
 std::vector<uint8_t> readImage(const char *fname, int &width, int &height) {
@@ -62,3 +91,27 @@ void writeImage(const char *fname, int width, int height, const void *data) {
   }
   handler->writer(fname, width, height, data);
 }
+
+bool isPNGImage(const char *fname) {
+  return find_handler(fname) == &backends[1];
+}
+
+bool recordsWindow(const char *fname) {
+  return isPNGImage(fname) || find_float_handler(fname) == &float_backends[1];
+}
+
+bool isFloatImage(const char *fname) {
+  return find_float_handler(fname) != NULL;
+}
+
+void writeFloatImage(const char *fname, int width, int height,
+                     const std::vector<ImagePlane> &planes,
+                     const ImageWindow &window) {
+  auto handler = find_float_handler(fname);
+  if (!handler) {
+    std::cerr << "Unrecognized extension for file " << fname
+              << ", writing exr format" << std::endl;
+    handler = &float_backends[1];
+  }
+  handler->writer(fname, width, height, planes, window);
+}
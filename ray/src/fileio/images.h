@@ -1,6 +1,7 @@
 #ifndef FILEIO_IMAGES_H
 #define FILEIO_IMAGES_H
 
+#include "hdrimage.h"
 #include <stdint.h>
 #include <vector>
 
@@ -14,5 +15,16 @@ extern std::vector<uint8_t> readImage(const char *fname, int &width,
                                       int &height);
 extern void writeImage(const char *iname, int width, int height,
                        const void *data);
+extern bool isPNGImage(const char *fname);
+// Whether the format can record where a partial image goes in its frame.
+extern bool recordsWindow(const char *fname);
+
+/*
+ * The same for floating point images: pfm, exr.
+ */
+extern bool isFloatImage(const char *fname);
+extern void writeFloatImage(const char *iname, int width, int height,
+                            const std::vector<ImagePlane> &planes,
+                            const ImageWindow &window = ImageWindow());
 
 #endif
@@ -0,0 +1,12 @@
+#ifndef FILEIO_IMAGEWINDOW_H
+#define FILEIO_IMAGEWINDOW_H
+
+// Where an image sits in a larger frame it is part of: the frame's pixel
+// coordinates of its top left corner, and the frame's size. A fullWidth
+// of zero means the image is the whole frame.
+struct ImageWindow {
+  int x = 0, y = 0;
+  int fullWidth = 0, fullHeight = 0;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "mappedfile.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string &path) {
+#ifndef _WIN32
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    length = (size_t)st.st_size;
+    if (length == 0) {
+      opened = true;
+    } else {
+      void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        bytes = (const char *)p;
+        mapped = true;
+        opened = true;
+      }
+    }
+  }
+  close(fd);
+  if (opened)
+    return;
+#endif
+
+  // No mmap (or it failed): read the whole file instead.
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  if (!in)
+    return;
+  std::streamsize n = in.tellg();
+  if (n < 0)
+    return;
+  fallback.resize((size_t)n);
+  in.seekg(0);
+  if (n > 0 && !in.read(fallback.data(), n))
+    return;
+  bytes = fallback.data();
+  length = (size_t)n;
+  opened = true;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (mapped)
+    munmap((void *)bytes, length);
+#endif
+}
+
+uint64_t fnv1a64(const void *data, size_t size, uint64_t seed) {
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = seed;
+  for (size_t i = 0; i < size; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+bool writeFileAtomically(const std::string &path, const void *data,
+                         size_t size) {
+  std::string tmp = path + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    if (!out)
+      return false;
+    out.write((const char *)data, (std::streamsize)size);
+    if (!out)
+      return false;
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec) {
+    std::remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,48 @@
+#ifndef FILEIO_MAPPEDFILE_H
+#define FILEIO_MAPPEDFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+ * Read-only view of a whole file. Where the platform supports it the file
+ * is memory mapped, so nothing is copied until a page is touched; otherwise
+ * it is read into memory up front. Either way data() stays valid for the
+ * lifetime of the object.
+ */
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool isOpen() const { return opened; }
+  const char *data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  bool opened = false;
+  const char *bytes = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+  std::vector<char> fallback;
+};
+
+/*
+ * 64-bit FNV-1a hash of a block of memory.
+ */
+extern uint64_t fnv1a64(const void *data, size_t size,
+                        uint64_t seed = 0xcbf29ce484222325ull);
+
+/*
+ * Write data to path by way of a temporary file in the same directory, so
+ * readers never see a half-written file. Returns false on failure.
+ */
+extern bool writeFileAtomically(const std::string &path, const void *data,
+                                size_t size);
+
+#endif
@@ -0,0 +1,204 @@
+#include "pngstream.h"
+
+#include <algorithm>
+#include <zlib.h>
+
+using std::string;
+
+namespace {
+
+// About this many bytes of image per band: enough that the deflate window
+// lost at each band boundary doesn't matter, small enough that there are
+// plenty of bands to share out.
+const size_t BAND_BYTES = 256 * 1024;
+
+void putBE32(unsigned char *p, uint32_t v) {
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+} // namespace
+
+PNGStreamWriter::PNGStreamWriter(const char *fname, int width, int height,
+                                 const ImageWindow &window)
+    : fp(fopen(fname, "wb")), width(width), height(height) {
+  size_t rowBytes = size_t(width) * 3 + 1;
+  bandRows = (int)std::max<size_t>(1, BAND_BYTES / rowBytes);
+  bands.resize((height + bandRows - 1) / bandRows);
+  for (size_t b = 0; b < bands.size(); b++)
+    bands[b].rowsLeft = std::min(bandRows, height - int(b) * bandRows);
+
+  if (!fp) {
+    failure = string("File could not be opened for writing: ") + fname;
+    return;
+  }
+
+  static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  if (fwrite(signature, 1, 8, fp) != 8)
+    failure = "Error writing PNG signature";
+
+  unsigned char ihdr[13];
+  putBE32(ihdr, width);
+  putBE32(ihdr + 4, height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 2;  // RGB
+  ihdr[10] = 0; // deflate
+  ihdr[11] = 0; // adaptive filtering
+  ihdr[12] = 0; // not interlaced
+  writeChunk("IHDR", ihdr, sizeof ihdr);
+
+  if (window.fullWidth) {
+    unsigned char offs[9];
+    putBE32(offs, window.x);
+    putBE32(offs + 4, window.y);
+    offs[8] = 0; // in pixels
+    writeChunk("oFFs", offs, sizeof offs);
+
+    string text = "Full size";
+    text += '\0';
+    text += std::to_string(window.fullWidth) + "x" +
+            std::to_string(window.fullHeight);
+    writeChunk("tEXt", (const unsigned char *)text.data(), text.size());
+  }
+}
+
+PNGStreamWriter::~PNGStreamWriter() {
+  if (fp)
+    fclose(fp);
+}
+
+bool PNGStreamWriter::ok() {
+  std::lock_guard<std::mutex> guard(lock);
+  return failure.empty();
+}
+
+void PNGStreamWriter::addRows(int y0, int y1, const unsigned char *data) {
+  size_t rowBytes = size_t(width) * 3 + 1;
+
+  // PNG goes top down; row y of ours is row height - 1 - y of the file.
+  int first = height - y1, last = height - 1 - y0;
+  int b0 = first / bandRows, b1 = last / bandRows;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int b = b0; b <= b1; b++)
+      if (bands[b].raw.empty())
+        bands[b].raw.resize(size_t(bands[b].rowsLeft) * rowBytes);
+  }
+
+  for (int y = y0; y < y1; y++) {
+    int row = height - 1 - y;
+    const unsigned char *in = data + size_t(y - y0) * width * 3;
+    unsigned char *out = bands[row / bandRows].raw.data() +
+                         size_t(row % bandRows) * rowBytes;
+    out[0] = 1; // Sub
+    for (int x = 0; x < 3; x++)
+      out[1 + x] = in[x];
+    for (int x = 3; x < width * 3; x++)
+      out[1 + x] = (unsigned char)(in[x] - in[x - 3]);
+  }
+
+  std::vector<int> complete;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int b = b0; b <= b1; b++) {
+      int lo = std::max(first, b * bandRows);
+      int hi = std::min(last + 1, (b + 1) * bandRows);
+      if ((bands[b].rowsLeft -= hi - lo) == 0)
+        complete.push_back(b);
+    }
+  }
+
+  for (int b : complete)
+    compress(b);
+
+  if (!complete.empty()) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int b : complete)
+      bands[b].ready = true;
+    writeReady();
+  }
+}
+
+// Deflate band b on its own. All but the last band end on a full flush,
+// which leaves the output byte aligned and refers to nothing before it,
+// so the bands can be joined into one stream in any order of compression.
+void PNGStreamWriter::compress(int b) {
+  Band &band = bands[b];
+  bool lastBand = b + 1 == (int)bands.size();
+
+  z_stream zs = {};
+  if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    std::lock_guard<std::mutex> guard(lock);
+    failure = "Couldn't start the compressor";
+    return;
+  }
+  band.packed.resize(deflateBound(&zs, band.raw.size()) + 16);
+  zs.next_in = band.raw.data();
+  zs.avail_in = (uInt)band.raw.size();
+  zs.next_out = band.packed.data();
+  zs.avail_out = (uInt)band.packed.size();
+  int status = deflate(&zs, lastBand ? Z_FINISH : Z_FULL_FLUSH);
+  band.packed.resize(zs.total_out);
+  deflateEnd(&zs);
+  if (status != (lastBand ? Z_STREAM_END : Z_OK) || zs.avail_in != 0) {
+    std::lock_guard<std::mutex> guard(lock);
+    failure = "Error compressing PNG rows";
+    return;
+  }
+
+  band.adler = adler32(1, band.raw.data(), (uInt)band.raw.size());
+  band.rawSize = band.raw.size();
+  std::vector<unsigned char>().swap(band.raw);
+}
+
+// Write out the compressed bands that are next in line. Called locked.
+void PNGStreamWriter::writeReady() {
+  while (nextBand < (int)bands.size() && bands[nextBand].ready &&
+         failure.empty()) {
+    Band &band = bands[nextBand];
+    std::vector<unsigned char> &data = band.packed;
+    if (nextBand == 0)
+      data.insert(data.begin(), {0x78, 0x9c}); // zlib header
+    adler = adler32_combine(adler, band.adler, (z_off_t)band.rawSize);
+    if (nextBand + 1 == (int)bands.size()) {
+      unsigned char trailer[4];
+      putBE32(trailer, adler);
+      data.insert(data.end(), trailer, trailer + 4);
+    }
+    writeChunk("IDAT", data.data(), data.size());
+    std::vector<unsigned char>().swap(data);
+    nextBand++;
+  }
+}
+
+void PNGStreamWriter::writeChunk(const char *type, const unsigned char *data,
+                                 size_t n) {
+  if (!fp || !failure.empty())
+    return;
+  unsigned char head[8];
+  putBE32(head, (uint32_t)n);
+  std::copy(type, type + 4, head + 4);
+  uint32_t crc = crc32(0, head + 4, 4);
+  if (n)
+    crc = crc32(crc, data, (uInt)n);
+  unsigned char tail[4];
+  putBE32(tail, crc);
+  if (fwrite(head, 1, 8, fp) != 8 || fwrite(data, 1, n, fp) != n ||
+      fwrite(tail, 1, 4, fp) != 4)
+    failure = "Error writing PNG data";
+}
+
+bool PNGStreamWriter::finish(string &error) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (failure.empty() && nextBand != (int)bands.size())
+    failure = "Not every row of the PNG image was given";
+  writeChunk("IEND", nullptr, 0);
+  if (fp && fclose(fp) != 0 && failure.empty())
+    failure = "Error closing PNG file";
+  fp = nullptr;
+  error = failure;
+  return failure.empty();
+}
@@ -0,0 +1,69 @@
+#ifndef FILEIO_PNGSTREAM_H
+#define FILEIO_PNGSTREAM_H
+
+#include "imagewindow.h"
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+/*
+ * A PNG writer that takes the image a few rows at a time, as the tracer
+ * finishes them, instead of all at once at the end.
+ *
+ * The image is cut into bands of rows. Every row uses the Sub filter,
+ * which only looks at its own pixels, and every band is deflated on its
+ * own, ending on a full flush so the pieces can simply be concatenated
+ * into one zlib stream; the Adler-32 checksums of the bands are combined
+ * for the trailer. A band is compressed by whichever thread hands in its
+ * last row, so compression runs in parallel and alongside the render, and
+ * bands are written to the file as soon as those above them are out.
+ *
+ * An image that is part of a larger frame records where it goes with an
+ * oFFs chunk (its offset in pixels) and a "Full size" text chunk.
+ */
+class PNGStreamWriter {
+public:
+  PNGStreamWriter(const char *fname, int width, int height,
+                  const ImageWindow &window = ImageWindow());
+  ~PNGStreamWriter();
+
+  // False if the file couldn't be created or something since has failed;
+  // finish() says why.
+  bool ok();
+
+  // Rows [y0, y1) are final. data holds them, bottom row first and three
+  // bytes a pixel, like the tracer's buffer. May be called from several
+  // threads at once, but each row must be given exactly once.
+  void addRows(int y0, int y1, const unsigned char *data);
+
+  // Close the file once every row has been added. Returns false, with the
+  // reason in error, if the image couldn't be written.
+  bool finish(std::string &error);
+
+private:
+  struct Band {
+    std::vector<unsigned char> raw;    // filtered rows, then freed
+    std::vector<unsigned char> packed; // raw deflated
+    size_t rawSize = 0;
+    uint32_t adler = 1;
+    int rowsLeft = 0;
+    bool ready = false;
+  };
+
+  void compress(int b);
+  void writeReady();
+  void writeChunk(const char *type, const unsigned char *data, size_t n);
+
+  FILE *fp;
+  int width, height;
+  int bandRows;
+  std::vector<Band> bands;
+  int nextBand = 0;     // first band not yet in the file
+  uint32_t adler = 1;   // of everything written so far
+  std::string failure;
+  std::mutex lock;
+};
+
+#endif
@@ -11,6 +11,8 @@ RayTracer *theRayTracer;
 TraceUI *traceUI;
 int TraceUI::m_threads = max(std::thread::hardware_concurrency(), (unsigned)1);
 int TraceUI::rayCount[MAX_THREADS];
+long long TraceUI::statCount[TraceUI::NUM_STATS][MAX_THREADS];
+bool TraceUI::m_stats = false;
 
 // usage : ray [option] in.ray out.bmp
 // Simply keying in ray will invoke a graphics mode version.
@@ -1,4 +1,6 @@
 #include "JsonParser.h"
+#include "MeshCache.h"
+#include "ObjLoader.h"
 #include "ParserException.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
@@ -8,6 +10,9 @@
 
 #include <glm/gtc/type_ptr.hpp>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
 #include <unordered_map>
 
 #include <json.hpp>
@@ -124,8 +129,10 @@ PointLight *parsePointLight(const json &j, ParseData &pd) {
   IGNORE_MISSING(j.at("constant_attenuation_coeff").get_to(atten_pow_0));
   IGNORE_MISSING(j.at("linear_attenuation_coeff").get_to(atten_pow_1));
   IGNORE_MISSING(j.at("quadratic_attenuation_coeff").get_to(atten_pow_2));
-  return new PointLight(pd.s, position, color, atten_pow_0, atten_pow_1,
-                        atten_pow_2);
+  PointLight *light = new PointLight(pd.s, position, color, atten_pow_0,
+                                     atten_pow_1, atten_pow_2);
+  IGNORE_MISSING(light->setCutoff(j.at("cutoff_intensity").get<double>()));
+  return light;
 }
 
 glm::dvec3 parseAmbientLight(const json &j) {
@@ -135,28 +142,28 @@ glm::dvec3 parseAmbientLight(const json &j) {
 
 Sphere *parseSphereBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto s = new Sphere(pd.s, &m);
+  auto s = pd.s->make<Sphere>(pd.s, &m);
   s->setTransform(pd.getCurrentTransform());
   return s;
 }
 
 Box *parseBoxBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto b = new Box(pd.s, &m);
+  auto b = pd.s->make<Box>(pd.s, &m);
   b->setTransform(pd.getCurrentTransform());
   return b;
 }
 
 Square *parseSquareBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto s = new Square(pd.s, &m);
+  auto s = pd.s->make<Square>(pd.s, &m);
   s->setTransform(pd.getCurrentTransform());
   return s;
 }
 
 Cylinder *parseCylinderBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto c = new Cylinder(pd.s, &m);
+  auto c = pd.s->make<Cylinder>(pd.s, &m);
   c->setTransform(pd.getCurrentTransform());
   IGNORE_MISSING(c->setCapped(j.at("capped").get<bool>()));
   return c;
@@ -175,44 +182,80 @@ Cone *parseConeBody(const json &j, ParseData &pd) {
   IGNORE_MISSING(j.at("height").get_to(height));
   IGNORE_MISSING(j.at("capped").get_to(capped));
 
-  auto c = new Cone(pd.s, &m, height, bottomRadius, topRadius, capped);
+  auto c = pd.s->make<Cone>(pd.s, &m, height, bottomRadius, topRadius,
+                            capped);
   c->setTransform(pd.getCurrentTransform());
   return c;
 }
 
+// Key under which the streaming reader records where a tri_mesh's arrays
+// went (an index into ParseData::inlineMeshes).
+static const char *INLINE_MESH_KEY = "$inline_mesh";
+
+static void addTrimeshFace(Trimesh *t, const int *face, size_t size) {
+  bool success = false;
+  if (size == 3) {
+    success = t->addFace(face[0], face[1], face[2]);
+  } else if (size == 4) {
+    success = t->addFace(face[0], face[1], face[2]);
+    success &= t->addFace(face[0], face[2], face[3]);
+  } else {
+    auto s = std::to_string(size);
+    throw ParserException("Got " + s +
+                          " indices in a face: must be 3 or 4 indices");
+  }
+
+  if (!success) {
+    json f_json(std::vector<int>(face, face + size));
+    throw ParserException("Error while adding face " + to_string(f_json) +
+                          ". Maybe the point doesn't exist?");
+  }
+}
+
 Trimesh *parseTrimeshBody(const json &j, ParseData &pd) {
   Material m = GET_MAT_W_CUR(j, pd);
-  auto t = new Trimesh(pd.s, &m, pd.getCurrentTransform());
+  auto t = pd.s->make<Trimesh>(pd.s, &m, pd.getCurrentTransform());
   bool genNormals = false;
 
-  glm::dvec3 point;
-  for (const json &pt_json : j.at("points")) {
-    pt_json.get_to(point);
-    t->addVertex(point);
-  }
-
-  std::vector<int> face;
-  for (const json &f_json : j.at("faces")) {
-    bool success = false;
-    f_json.get_to(face);
-    if (face.size() == 3) {
-      success = t->addFace(face[0], face[1], face[2]);
-    } else if (face.size() == 4) {
-      success = t->addFace(face[0], face[1], face[2]);
-      success &= t->addFace(face[0], face[2], face[3]);
-    } else {
-      auto s = std::to_string(face.size());
-      throw ParserException("Got " + s +
-                            " indices in a face: must be 3 or 4 indices");
+  const InlineMesh *inl = nullptr;
+  if (hasKey(j, INLINE_MESH_KEY)) {
+    inl = &pd.inlineMeshes.at(j.at(INLINE_MESH_KEY).get<size_t>());
+  }
+
+  if (inl && inl->hasPoints) {
+    size_t n = inl->points.size() / 3;
+    t->reserve(n, inl->faceSizes.size(), inl->hasNormals, false, false);
+    for (size_t i = 0; i < n; i++) {
+      t->addVertex(glm::make_vec3(&inl->points[3 * i]));
     }
+  } else {
+    glm::dvec3 point;
+    for (const json &pt_json : j.at("points")) {
+      pt_json.get_to(point);
+      t->addVertex(point);
+    }
+  }
 
-    if (!success) {
-      throw ParserException("Error while adding face " + to_string(f_json) +
-                            ". Maybe the point doesn't exist?");
+  if (inl && inl->hasFaces) {
+    const int *face = inl->faces.data();
+    for (unsigned char size : inl->faceSizes) {
+      addTrimeshFace(t, face, size);
+      face += size;
+    }
+  } else {
+    std::vector<int> face;
+    for (const json &f_json : j.at("faces")) {
+      f_json.get_to(face);
+      addTrimeshFace(t, face.data(), face.size());
     }
   }
 
-  if (hasKey(j, "normals")) {
+  if (inl && inl->hasNormals) {
+    for (size_t i = 0; i < inl->normals.size() / 3; i++) {
+      t->addNormal(glm::make_vec3(&inl->normals[3 * i]));
+    }
+    t->vertNorms = true;
+  } else if (hasKey(j, "normals")) {
     glm::dvec3 normal;
     for (const json &n_json : j.at("normals")) {
       n_json.get_to(normal);
@@ -227,8 +270,9 @@ Trimesh *parseTrimeshBody(const json &j, ParseData &pd) {
   }
 
   IGNORE_MISSING(j.at("gennormals").get_to(genNormals));
-  if (t->doubleCheck() != nullptr) {
-    throw ParserException("Error in mesh: " + std::string(t->doubleCheck()));
+  const char *err = t->doubleCheck();
+  if (err != nullptr) {
+    throw ParserException("Error in mesh: " + std::string(err));
   }
   if (genNormals) {
     t->generateNormals();
@@ -252,7 +296,7 @@ std::vector<Geometry *> parseGeometry(const json &j, ParseData &pd) {
 
   auto it = j.begin();
   std::string key = it.key();
-  json val = it.value();
+  const json &val = it.value();
 
   if (key == "sphere") {
     return {parseSphereBody(val, pd)};
@@ -293,19 +337,19 @@ bool isGeometryKey(const std::string &s) {
 std::vector<Geometry *> parseTransform(const json &j, ParseData &pd) {
   auto it = j.begin();
   std::string key = it.key();
-  json val = it.value();
+  const json &val = it.value();
 
   std::vector<Geometry *> geoms;
   // For all except "rotate", this is the right location for the child
   // data. We will need to overwrite this when dealing with a rotate key.
-  json &children = val.at(1);
+  const json *children = &val.at(1);
 
   if (key == "rotate") {
     glm::dvec3 axis = val.at(0).get<glm::dvec3>();
     double angle = val.at(1).get<double>();
     glm::dmat4 transform = glm::rotate(glm::dmat4(1.0), angle, axis);
     pd.transformStack.push_back(transform);
-    children = val.at(2);
+    children = &val.at(2);
   } else if (key == "scale") {
     glm::dvec3 scale = val.at(0).get<glm::dvec3>();
     glm::dmat4 transform = glm::scale(glm::dmat4(1.0), scale);
@@ -324,7 +368,7 @@ std::vector<Geometry *> parseTransform(const json &j, ParseData &pd) {
 
   // Recursively process each child element which has this transform
   // applied.
-  for (const auto &obj : children) {
+  for (const auto &obj : *children) {
     std::string key = obj.begin().key();
     if (isTransformKey(key)) {
       auto subgeoms = parseTransform(obj, pd);
@@ -339,49 +383,276 @@ std::vector<Geometry *> parseTransform(const json &j, ParseData &pd) {
   return geoms;
 }
 
-Scene *JsonParser::parseScene() {
-  // Allow comments and exceptions while parsing
-  json j = json::parse(this->contents);
+// Add one element of the top-level array to the scene.
+static void parseSceneElement(const json &object, ParseData &pd) {
+  if (!object.is_object() || object.empty()) {
+    throw ParserException("Scene elements must be single-key objects, got " +
+                          object.dump());
+  }
 
-  Scene *scene = new Scene();
-  ParseData pd;
-  pd.s = scene;
-  pd.scene_dir = this->fileDirPath;
+  Scene *scene = pd.s;
+  std::string key = object.begin().key();
+  const json &val = object.begin().value();
+
+  if (key == "camera") {
+    scene->getCamera() = parseCamera(val);
+  } else if (key == "material") {
+    // Need to reset the top-level material so that we don't
+    // pollute the new material with old values
+    pd.cur_mat = Material{};
+    pd.cur_mat = parseMaterial(val, pd);
+  } else if (key == "ambient_light") {
+    scene->addAmbient(parseAmbientLight(val));
+  } else if (key == "directional_light") {
+    scene->add(parseDirectionalLight(val, pd));
+  } else if (key == "point_light") {
+    scene->add(parsePointLight(val, pd));
+  } else if (isTransformKey(key)) {
+    auto geoms = parseTransform(object, pd);
+    for (auto g : geoms) {
+      scene->add(g);
+    }
+  } else if (isGeometryKey(key)) {
+    auto geoms = parseGeometry(object, pd);
+    for (const auto &geom : geoms) {
+      scene->add(geom);
+    }
+  } else {
+    throw ParserException("Unknown scene object type: " + key);
+  }
+}
 
-  for (const auto &object : j) {
-    std::string key = object.begin().key();
-    json val = object.begin().value();
-
-    if (key == "camera") {
-      scene->getCamera() = parseCamera(val);
-    } else if (key == "material") {
-      // Need to reset the top-level material so that we don't
-      // pollute the new material with old values
-      pd.cur_mat = Material{};
-      pd.cur_mat = parseMaterial(val, pd);
-    } else if (key == "ambient_light") {
-      scene->addAmbient(parseAmbientLight(val));
-    } else if (key == "directional_light") {
-      scene->add(parseDirectionalLight(val, pd));
-    } else if (key == "point_light") {
-      scene->add(parsePointLight(val, pd));
-    } else if (isTransformKey(key)) {
-      auto geoms = parseTransform(object, pd);
-      for (auto g : geoms) {
-        scene->add(g);
-      }
-    } else if (isGeometryKey(key)) {
-      auto geoms = parseGeometry(object, pd);
-      for (const auto &geom : geoms) {
-        scene->add(geom);
+namespace {
+
+/* SAX handler for scene files. It builds the JSON tree of one element of the
+top-level array at a time and hands it to parseSceneElement as soon as the
+element is complete, then throws the tree away.
+
+The "points", "normals" and "faces" arrays of a tri_mesh (at any depth) are
+not put in the tree. Their numbers go straight into an InlineMesh, and the
+tri_mesh object gets an INLINE_MESH_KEY entry pointing at it instead. */
+class SceneReader : public nlohmann::json_sax<json> {
+public:
+  explicit SceneReader(ParseData &pd) : pd(pd) {}
+
+  bool null() override { return value(json()); }
+  bool boolean(bool b) override { return value(json(b)); }
+  bool number_integer(number_integer_t n) override {
+    return number((double)n, (int)n) || value(json(n));
+  }
+  bool number_unsigned(number_unsigned_t n) override {
+    return number((double)n, (int)n) || value(json(n));
+  }
+  bool number_float(number_float_t n, const string_t &) override {
+    return number(n, (int)n) || value(json(n));
+  }
+  bool string(string_t &s) override { return value(json(std::move(s))); }
+  bool binary(binary_t &b) override {
+    return value(json::binary(std::move(b)));
+  }
+
+  bool start_object(std::size_t) override {
+    bool meshBody = !stack.empty() && stack.back()->is_object() &&
+                    lastKey == "tri_mesh";
+    open(json::object(), meshBody);
+    return true;
+  }
+
+  bool key(string_t &k) override {
+    lastKey = std::move(k);
+    pending = NONE;
+    if (!meshBody.empty() && meshBody.back()) {
+      if (lastKey == "points")
+        pending = POINTS;
+      else if (lastKey == "normals")
+        pending = NORMALS;
+      else if (lastKey == "faces")
+        pending = FACES;
+    }
+    return true;
+  }
+
+  bool end_object() override {
+    close();
+    return true;
+  }
+
+  bool start_array(std::size_t) override {
+    if (active != NONE) {
+      if (inRow)
+        badMeshArray();
+      inRow = true;
+      rowLength = 0;
+      return true;
+    }
+    if (pending != NONE) {
+      startMeshArray();
+      return true;
+    }
+    if (!started) {
+      started = true; // the top-level array itself
+      return true;
+    }
+    open(json::array(), false);
+    return true;
+  }
+
+  bool end_array() override {
+    if (active != NONE) {
+      if (inRow)
+        endRow();
+      else
+        active = NONE;
+      return true;
+    }
+    if (stack.empty()) {
+      return true; // end of the top-level array
+    }
+    close();
+    return true;
+  }
+
+  bool parse_error(std::size_t, const std::string &,
+                   const nlohmann::detail::exception &ex) override {
+    throw ex;
+  }
+
+private:
+  enum MeshArray { NONE, POINTS, NORMALS, FACES };
+
+  ParseData &pd;
+  bool started = false;
+  json element;              // top-level element being read
+  std::vector<json *> stack; // open objects and arrays within element
+  std::vector<bool> meshBody; // whether each of those is a tri_mesh body
+  std::string lastKey;
+
+  MeshArray pending = NONE; // a tri_mesh key was just read
+  MeshArray active = NONE;  // streaming this tri_mesh array
+  InlineMesh *mesh = nullptr;
+  bool inRow = false;
+  size_t rowLength = 0;
+
+  // Put a value where the next one goes in the tree.
+  json *insert(json &&v) {
+    pending = NONE;
+    if (stack.empty()) {
+      if (!started) {
+        throw ParserException("A scene file must contain an array of "
+                              "scene elements");
       }
+      element = std::move(v);
+      return &element;
+    }
+    json &top = *stack.back();
+    if (top.is_array()) {
+      top.push_back(std::move(v));
+      return &top.back();
+    }
+    json &slot = top[lastKey];
+    slot = std::move(v);
+    return &slot;
+  }
+
+  bool value(json &&v) {
+    if (active != NONE)
+      badMeshArray();
+    bool topLevel = stack.empty();
+    insert(std::move(v));
+    if (topLevel)
+      finishElement();
+    return true;
+  }
+
+  void open(json &&container, bool isMeshBody) {
+    if (active != NONE)
+      badMeshArray();
+    stack.push_back(insert(std::move(container)));
+    meshBody.push_back(isMeshBody);
+  }
+
+  void close() {
+    stack.pop_back();
+    meshBody.pop_back();
+    if (stack.empty())
+      finishElement();
+  }
+
+  void finishElement() {
+    parseSceneElement(element, pd);
+    element = json();
+    pd.inlineMeshes.clear();
+  }
+
+  void startMeshArray() {
+    json &body = *stack.back();
+    if (!body.contains(INLINE_MESH_KEY)) {
+      body[INLINE_MESH_KEY] = pd.inlineMeshes.size();
+      pd.inlineMeshes.emplace_back();
+    }
+    mesh = &pd.inlineMeshes[body[INLINE_MESH_KEY].get<size_t>()];
+    active = pending;
+    pending = NONE;
+    inRow = false;
+    if (active == POINTS) {
+      mesh->points.clear();
+      mesh->hasPoints = true;
+    } else if (active == NORMALS) {
+      mesh->normals.clear();
+      mesh->hasNormals = true;
     } else {
-      throw ParserException("Unknown scene object type: " + key);
+      mesh->faces.clear();
+      mesh->faceSizes.clear();
+      mesh->hasFaces = true;
     }
   }
 
+  // A number inside a tri_mesh array. Returns false for any other number.
+  bool number(double d, int i) {
+    if (active == NONE)
+      return false;
+    if (!inRow)
+      badMeshArray();
+    if (active == FACES)
+      mesh->faces.push_back(i);
+    else if (rowLength < 3)
+      (active == POINTS ? mesh->points : mesh->normals).push_back(d);
+    rowLength++;
+    return true;
+  }
+
+  void endRow() {
+    inRow = false;
+    if (active == FACES) {
+      if (rowLength != 3 && rowLength != 4) {
+        throw ParserException("Got " + std::to_string(rowLength) +
+                              " indices in a face: must be 3 or 4 indices");
+      }
+      mesh->faceSizes.push_back((unsigned char)rowLength);
+    } else if (rowLength < 3) {
+      throw ParserException("tri_mesh points and normals must have 3 "
+                            "coordinates");
+    }
+  }
+
+  [[noreturn]] void badMeshArray() {
+    throw ParserException("tri_mesh points, normals and faces must be arrays "
+                          "of arrays of numbers");
+  }
+};
 
-  return scene;
+} // anonymous namespace
+
+Scene *JsonParser::parseScene() {
+  std::unique_ptr<Scene> scene(new Scene());
+  ParseData pd;
+  pd.s = scene.get();
+  pd.scene_dir = this->fileDirPath;
+
+  SceneReader reader(pd);
+  json::sax_parse(in, &reader);
+
+  return scene.release();
 }
 
 // Helper function to set parts of a Material from a tinyobj material
@@ -414,6 +685,53 @@ struct TinyObjIndexEq {
   }
 };
 
+// The first material of an OBJ file, which is the one we use for every
+// mesh in it (see loadObjToTrimesh).
+ObjMaterialInfo objMaterialInfo(const std::vector<tinyobj::material_t> &mtls) {
+  ObjMaterialInfo info;
+  if (mtls.empty())
+    return info;
+  const tinyobj::material_t &mtl = mtls[0];
+  info.present = true;
+  for (int k = 0; k < 3; k++) {
+    info.diffuse[k] = mtl.diffuse[k];
+    info.specular[k] = mtl.specular[k];
+    info.ambient[k] = mtl.ambient[k];
+    info.transmissive[k] = mtl.transmittance[k];
+    info.emissive[k] = mtl.emission[k];
+  }
+  info.shininess = mtl.shininess;
+  info.ior = mtl.ior;
+  info.diffuseTex = mtl.diffuse_texname;
+  info.specularTex = mtl.specular_texname;
+  return info;
+}
+
+void applyObjMaterial(Trimesh *t, const ObjMaterialInfo &mtl, ParseData &pd) {
+  Material m;
+  if (mtl.present) {
+    m.setDiffuse(glm::make_vec3(mtl.diffuse));
+    m.setSpecular(glm::make_vec3(mtl.specular));
+    m.setAmbient(glm::make_vec3(mtl.ambient));
+    m.setTransmissive(glm::make_vec3(mtl.transmissive));
+    m.setEmissive(glm::make_vec3(mtl.emissive));
+    m.setShininess(mtl.shininess);
+    m.setIndex(mtl.ior);
+
+    if (!mtl.diffuseTex.empty()) {
+      std::string texPath = (pd.scene_dir / mtl.diffuseTex).string();
+      m.setDiffuse(MaterialParameter(pd.s->getTexture(texPath)));
+    }
+
+    if (!mtl.specularTex.empty()) {
+      std::string texPath = (pd.scene_dir / mtl.specularTex).string();
+      m.setSpecular(MaterialParameter(pd.s->getTexture(texPath)));
+    }
+  }
+
+  t->setMaterial(&m);
+}
+
 /* The full OBJ file format is chaotic neutral. To try to tame some of this, we
 only support certain features. See jsonformat.md for the limitations.
 */
@@ -445,7 +763,8 @@ Trimesh *loadObjToTrimesh(const tinyobj::ObjReader &rdr,
   // mesh.
   auto getOrCreateLinearIndex = [&attrib, &indexMap, &warned,
                                  t](tinyobj::index_t i) {
-    if (indexMap.find(i) == indexMap.end()) {
+    auto inserted = indexMap.try_emplace(i, (int)indexMap.size());
+    if (inserted.second) {
       if (indexMap.size() > MAX_RECOMMENDED_VERTS && !warned) {
         std::cerr << "WARN: Detected many vertices in OBJ input. This may "
                      "cause memory problems. Consider decimating the mesh."
@@ -453,7 +772,6 @@ Trimesh *loadObjToTrimesh(const tinyobj::ObjReader &rdr,
         warned = true;
       }
 
-      indexMap[i] = indexMap.size();
       t->addVertex(glm::make_vec3(&attrib.vertices[3 * i.vertex_index]));
       if (i.normal_index != -1) {
         auto n = glm::make_vec3(&attrib.normals[3 * i.normal_index]);
@@ -468,9 +786,16 @@ Trimesh *loadObjToTrimesh(const tinyobj::ObjReader &rdr,
         t->addColor(glm::make_vec3(&attrib.colors[3 * i.vertex_index]));
       }
     }
-    return indexMap[i];
+    return inserted.first->second;
   };
 
+  // Each distinct v/vt/vn combination becomes a vertex, so there are at
+  // least as many as there are positions in use; usually not many more.
+  size_t corners = s.mesh.indices.size();
+  t->reserve(std::min(corners, attrib.vertices.size() / 3), corners / 3,
+             !attrib.normals.empty(), !attrib.texcoords.empty(),
+             !attrib.colors.empty());
+
   // TinyOBJ triangulates for us, so we don't have to check for larger
   // faces
   for (long unsigned f = 0; f < s.mesh.indices.size(); f += 3) {
@@ -504,31 +829,55 @@ auto k = s.mesh.material_ids[f];
 */
 
   // Take the first material associated with the mesh and use it.
-  Material *m = new Material();
-  if (materials.size() > 0) {
-    tinyobj::material_t mtl = materials[0];
-    m->setDiffuse(glm::make_vec3(mtl.diffuse));
-    m->setSpecular(glm::make_vec3(mtl.specular));
-    m->setAmbient(glm::make_vec3(mtl.ambient));
-    m->setTransmissive(glm::make_vec3(mtl.transmittance));
-    m->setEmissive(glm::make_vec3(mtl.emission));
-    m->setShininess(mtl.shininess);
-    m->setIndex(mtl.ior);
+  applyObjMaterial(t, objMaterialInfo(materials), pd);
 
-    if (!mtl.diffuse_texname.empty()) {
-      std::string texPath = (pd.scene_dir / mtl.diffuse_texname).string();
-      m->setDiffuse(MaterialParameter(pd.s->getTexture(texPath)));
-    }
+  if (attrib.normals.size() > 0) {
+    t->vertNorms = true;
+  }
+
+  const char *err = t->doubleCheck();
+  if (err != nullptr) {
+    throw ParserException("Error while parsing OBJ file: " + std::string(err));
+  }
+
+  return t;
+}
 
-    if (!mtl.specular_texname.empty()) {
-      std::string texPath = (pd.scene_dir / mtl.specular_texname).string();
-      m->setSpecular(MaterialParameter(pd.s->getTexture(texPath)));
+// Fill a Trimesh from a shape read by loadObjParallel. This is the same as
+// loadObjToTrimesh, except that the corners are already de-duplicated.
+Trimesh *loadObjShapeToTrimesh(const ObjData &obj, const ObjShape &s,
+                               const ObjMaterialInfo &material, Trimesh *t,
+                               ParseData &pd) {
+  if (s.vertices.size() > MAX_RECOMMENDED_VERTS) {
+    std::cerr << "WARN: Detected many vertices in OBJ input. This may "
+                 "cause memory problems. Consider decimating the mesh."
+              << std::endl;
+  }
+
+  t->reserve(s.vertices.size(), s.indices.size() / 3, !obj.normals.empty(),
+             !obj.texcoords.empty(), !obj.colors.empty());
+  for (const ObjCorner &c : s.vertices) {
+    t->addVertex(glm::make_vec3(&obj.positions[3 * c.v]));
+    if (c.vn != -1) {
+      auto n = glm::make_vec3(&obj.normals[3 * c.vn]);
+      // OBJ normals are not required to be normalized; ours are
+      t->addNormal(glm::normalize(n));
+    }
+    if (c.vt != -1) {
+      t->addUV(glm::make_vec2(&obj.texcoords[2 * c.vt]));
+    }
+    if (!obj.colors.empty()) {
+      t->addColor(glm::make_vec3(&obj.colors[3 * c.v]));
     }
   }
 
-  t->setMaterial(m);
+  for (size_t f = 0; f + 2 < s.indices.size(); f += 3) {
+    t->addFace(s.indices[f], s.indices[f + 1], s.indices[f + 2]);
+  }
 
-  if (attrib.normals.size() > 0) {
+  applyObjMaterial(t, material, pd);
+
+  if (!obj.normals.empty()) {
     t->vertNorms = true;
   }
 
@@ -540,14 +889,53 @@ auto k = s.mesh.material_ids[f];
   return t;
 }
 
-std::vector<Trimesh *> parseObjmeshBody(const json &j, ParseData &pd) {
-  std::string objFile = j.at("objfile").get<std::string>();
-  std::string path = (pd.scene_dir / objFile).string();
-  bool genNormals = false;
-  IGNORE_MISSING(j.at("gennormals").get_to(genNormals));
+// Load the MTL libraries named by an OBJ file the way tinyobj does: from
+// each mtllib line, the first of its files that can be read.
+std::vector<tinyobj::material_t>
+loadObjMaterials(const std::vector<std::vector<std::string>> &mtllibs,
+                 ParseData &pd) {
+  tinyobj::MaterialFileReader readMtl(pd.scene_dir.string());
+  std::vector<tinyobj::material_t> materials;
+  std::map<std::string, int> materialMap;
+  std::set<std::string> loaded;
+  std::string warn, err;
+
+  for (const std::vector<std::string> &line : mtllibs) {
+    bool found = false;
+    for (const std::string &name : line) {
+      if (loaded.count(name)) {
+        found = true;
+        continue;
+      }
+      // The reader overwrites rather than appends to its messages
+      std::string mtlWarn, mtlErr;
+      bool ok = readMtl(name, &materials, &materialMap, &mtlWarn, &mtlErr);
+      warn += mtlWarn;
+      err += mtlErr;
+      if (ok) {
+        found = true;
+        loaded.insert(name);
+        break;
+      }
+    }
+    if (!found) {
+      warn += "Failed to load material file(s). Use default material.\n";
+    }
+  }
 
-  std::vector<Trimesh *> results;
+  if (!err.empty()) {
+    throw ParserException("Error while parsing OBJ file: " + err);
+  }
+  if (!warn.empty()) {
+    std::cerr << "TinyObj warnings: " << warn;
+  }
+  return materials;
+}
 
+// Read an OBJ file with tinyobj, which understands more of the format than
+// loadObjParallel does but is much slower.
+void loadObjWithTinyObj(const std::string &path, const std::string &objFile,
+                        ParseData &pd, std::vector<CachedShape> &shapes) {
   tinyobj::ObjReaderConfig reader_config;
   reader_config.mtl_search_path = pd.scene_dir.string();
   reader_config.triangulate = true;
@@ -569,7 +957,6 @@ std::vector<Trimesh *> parseObjmeshBody(const json &j, ParseData &pd) {
   }
 
   auto &attrib = reader.GetAttrib();
-  auto &shapes = reader.GetShapes();
 
   if (attrib.vertices.size() / 3 > MAX_RECOMMENDED_VERTS) {
     std::cerr << "Warning: OBJ file " << objFile << " has "
@@ -580,18 +967,80 @@ std::vector<Trimesh *> parseObjmeshBody(const json &j, ParseData &pd) {
               << std::endl;
   }
 
-  for (const tinyobj::shape_t &s : shapes) {
-    Trimesh *t = new Trimesh(pd.s, &pd.cur_mat, pd.getCurrentTransform());
+  ObjMaterialInfo material = objMaterialInfo(reader.GetMaterials());
+  for (const tinyobj::shape_t &s : reader.GetShapes()) {
+    Trimesh *t =
+        pd.s->make<Trimesh>(pd.s, &pd.cur_mat, pd.getCurrentTransform());
 
     loadObjToTrimesh(reader, s, t, pd);
 
-    if (genNormals) {
-      t->generateNormals();
+    shapes.push_back({t, material});
+  }
+}
+
+std::vector<Trimesh *> parseObjmeshBody(const json &j, ParseData &pd) {
+  std::string objFile = j.at("objfile").get<std::string>();
+  std::string path = (pd.scene_dir / objFile).string();
+  bool genNormals = false;
+  IGNORE_MISSING(j.at("gennormals").get_to(genNormals));
+
+  std::vector<Trimesh *> results;
+  std::vector<CachedShape> shapes;
+
+  uint64_t hash = 0;
+  std::string cachePath;
+  if (MeshCache::enabled &&
+      MeshCache::hashObj(path, pd.scene_dir.string(), hash)) {
+    cachePath = MeshCache::pathFor(path, hash);
+    MeshCache::load(cachePath, hash, pd.s, &pd.cur_mat,
+                    pd.getCurrentTransform(), shapes);
+    for (CachedShape &cached : shapes) {
+      applyObjMaterial(cached.mesh, cached.material, pd);
+      const char *err = cached.mesh->doubleCheck();
+      if (err != nullptr) {
+        throw ParserException("Error while parsing OBJ file: " +
+                              std::string(err));
+      }
+    }
+  }
+
+  if (shapes.empty()) {
+    ObjData obj;
+    if (loadObjParallel(path, obj)) {
+      if (obj.positions.size() / 3 > MAX_RECOMMENDED_VERTS) {
+        std::cerr << "Warning: OBJ file " << objFile << " has "
+                  << obj.positions.size() / 3 << " vertices. "
+                  << "This may cause an out-of-memory condition. "
+                  << "Consider reducing the number of vertices in the "
+                     "OBJ file."
+                  << std::endl;
+      }
+
+      ObjMaterialInfo material =
+          objMaterialInfo(loadObjMaterials(obj.mtllibs, pd));
+      for (const ObjShape &s : obj.shapes) {
+        Trimesh *t =
+        pd.s->make<Trimesh>(pd.s, &pd.cur_mat, pd.getCurrentTransform());
+        loadObjShapeToTrimesh(obj, s, material, t, pd);
+        shapes.push_back({t, material});
+      }
+    } else {
+      loadObjWithTinyObj(path, objFile, pd, shapes);
     }
 
+    // Save before generating normals, which depends on the scene file
+    // rather than the OBJ.
+    if (!cachePath.empty()) {
+      MeshCache::save(cachePath, hash, shapes);
+    }
+  }
 
+  for (CachedShape &cached : shapes) {
+    if (genNormals) {
+      cached.mesh->generateNormals();
+    }
 
-    results.push_back(t);
+    results.push_back(cached.mesh);
   }
   return results;
 }
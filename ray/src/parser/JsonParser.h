@@ -40,19 +40,35 @@ using json = nlohmann::json;
 
 typedef std::map<string, Material> mmap;
 
+/* The points, normals and faces of a tri_mesh can be huge. Rather than
+build a JSON tree for them, the streaming reader puts them straight into
+flat arrays, and the tri_mesh object in the tree refers to them by index
+(see JsonParser::parseScene). */
+struct InlineMesh {
+  std::vector<double> points;  // xyz per point
+  std::vector<double> normals; // xyz per normal
+  std::vector<int> faces;      // faceSizes[i] indices per face
+  std::vector<unsigned char> faceSizes;
+  bool hasPoints = false;
+  bool hasNormals = false;
+  bool hasFaces = false;
+};
+
 /* While parsing, we need to track certain data, such as the current
 scene, the directory of the scene file (for loading textures + cubemaps),
 the stack of transforms that is currently active, and the last material
 specified at the top-level of the file (which overrides material defaults
 for all objects that come after it). Since this data is only needed while
 parsing and not afterwards, we store it in a struct which is threaded
-through all parsing functions by reference. This does preclude
-multithreaded parsing, but the file format inherently puts a cap on that. */
+through all parsing functions by reference. The scene file itself is
+walked on one thread; the OBJ files it names are read in parallel (see
+ObjLoader.h), without touching this struct. */
 struct ParseData {
   Material cur_mat;
   std::vector<glm::dmat4> transformStack;
   Scene *s;
   std::filesystem::path scene_dir;
+  std::vector<InlineMesh> inlineMeshes;
 
   glm::dmat4 getCurrentTransform();
 };
@@ -61,10 +77,11 @@ Camera parseCamera(const json &j);
 MaterialParameter parseMaterialParameter(const json &j, ParseData &pd);
 Material parseMaterial(const json &j, ParseData &pd);
 
-/* Because the Scene manages Lights and Geometry lifetimes (calling delete when
-the Scene is dropped), we allocate our lights as raw pointers with new and
-pass those pointers into the Scene. AmbientLight is weird because it's not
-actually a light (see comments in scene.h for details) */
+/* Because the Scene manages Lights and Geometry lifetimes (calling delete on
+lights when the Scene is dropped), we allocate our lights as raw pointers with
+new and pass those pointers into the Scene; geometry is made in the Scene's
+arena with Scene::make. AmbientLight is weird because it's not actually a light
+(see comments in scene.h for details) */
 
 DirectionalLight *parseDirectionalLight(const json &j);
 PointLight *parsePointLight(const json &j);
@@ -82,18 +99,18 @@ std::vector<Geometry *> parseGeometry(const json &j, ParseData &pd);
 std::vector<Geometry *> parseTransform(const json &j, ParseData &pd);
 std::vector<Geometry *> parseGeometryOrTransform(const json &j, ParseData &pd);
 
+/* The scene is read with a SAX parser straight from the stream. Each
+element of the top-level array is turned into a Scene object as soon as it
+has been read, so only one element's JSON tree exists at a time, and inline
+tri_mesh arrays never become JSON at all. */
 class JsonParser {
 public:
-  JsonParser(std::string pathToJson, std::ifstream &ifs)
-      : fileDirPath(pathToJson) {
-    std::ostringstream sstr;
-    sstr << ifs.rdbuf();
-    this->contents = sstr.str();
-  };
+  JsonParser(std::string pathToJson, std::istream &ifs)
+      : in(ifs), fileDirPath(pathToJson) {}
 
   Scene *parseScene();
 
 private:
-  std::string contents;
+  std::istream &in;
   std::string fileDirPath;
 };
\ No newline at end of file
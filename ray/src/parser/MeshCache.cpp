@@ -0,0 +1,207 @@
+#include "MeshCache.h"
+
+#include "../SceneObjects/trimesh.h"
+#include "../fileio/binaryio.h"
+#include "../fileio/mappedfile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+
+bool MeshCache::enabled = true;
+std::string MeshCache::directory;
+
+namespace {
+
+const char MAGIC[8] = {'R', 'A', 'Y', 'M', 'E', 'S', 'H', '\0'};
+const uint32_t VERSION = 1;
+const uint32_t ENDIAN_MARK = 0x01020304;
+
+static_assert(sizeof(glm::dvec3) == 3 * sizeof(double),
+              "mesh cache copies dvec3 arrays as raw doubles");
+static_assert(sizeof(glm::dvec2) == 2 * sizeof(double),
+              "mesh cache copies dvec2 arrays as raw doubles");
+
+void putMaterial(BinaryWriter &w, const ObjMaterialInfo &m) {
+  w.put((uint8_t)m.present);
+  w.putBytes(m.diffuse, sizeof(m.diffuse));
+  w.putBytes(m.specular, sizeof(m.specular));
+  w.putBytes(m.ambient, sizeof(m.ambient));
+  w.putBytes(m.transmissive, sizeof(m.transmissive));
+  w.putBytes(m.emissive, sizeof(m.emissive));
+  w.put(m.shininess);
+  w.put(m.ior);
+  w.putString(m.diffuseTex);
+  w.putString(m.specularTex);
+}
+
+void getMaterial(BinaryReader &r, ObjMaterialInfo &m) {
+  m.present = r.get<uint8_t>() != 0;
+  r.getBytes(m.diffuse, sizeof(m.diffuse));
+  r.getBytes(m.specular, sizeof(m.specular));
+  r.getBytes(m.ambient, sizeof(m.ambient));
+  r.getBytes(m.transmissive, sizeof(m.transmissive));
+  r.getBytes(m.emissive, sizeof(m.emissive));
+  m.shininess = r.get<double>();
+  m.ior = r.get<double>();
+  m.diffuseTex = r.getString();
+  m.specularTex = r.getString();
+}
+
+// Names of the MTL libraries an OBJ file pulls in.
+std::vector<std::string> mtlLibraries(const char *p, size_t n) {
+  std::vector<std::string> libs;
+  const char *end = p + n;
+  while (p < end) {
+    const char *eol = (const char *)std::memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    while (p < eol && (*p == ' ' || *p == '\t'))
+      p++;
+    if (eol - p > 7 && std::strncmp(p, "mtllib", 6) == 0 &&
+        (p[6] == ' ' || p[6] == '\t')) {
+      std::istringstream names(std::string(p + 7, eol));
+      std::string name;
+      while (names >> name)
+        libs.push_back(name);
+    }
+    p = eol + 1;
+  }
+  return libs;
+}
+
+} // anonymous namespace
+
+bool MeshCache::hashObj(const std::string &objPath, const std::string &mtlDir,
+                        uint64_t &hash) {
+  MappedFile obj(objPath);
+  if (!obj.isOpen())
+    return false;
+  hash = fnv1a64(obj.data(), obj.size());
+  for (const std::string &lib : mtlLibraries(obj.data(), obj.size())) {
+    hash = fnv1a64(lib.data(), lib.size(), hash);
+    MappedFile mtl((std::filesystem::path(mtlDir) / lib).string());
+    if (mtl.isOpen())
+      hash = fnv1a64(mtl.data(), mtl.size(), hash);
+  }
+  return true;
+}
+
+std::string MeshCache::pathFor(const std::string &objPath, uint64_t hash) {
+  std::filesystem::path obj(objPath);
+  std::filesystem::path dir =
+      directory.empty() ? obj.parent_path() : std::filesystem::path(directory);
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+  return (dir / (obj.stem().string() + "-" + hex + ".meshcache")).string();
+}
+
+bool MeshCache::load(const std::string &cachePath, uint64_t hash,
+                     Scene *scene, Material *mat, const glm::dmat4 &transform,
+                     std::vector<CachedShape> &shapes) {
+  MappedFile file(cachePath);
+  if (!file.isOpen())
+    return false;
+
+  BinaryReader r(file.data(), file.size());
+  char magic[sizeof(MAGIC)];
+  r.getBytes(magic, sizeof(magic));
+  if (!r.ok() || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+    return false;
+  if (r.get<uint32_t>() != VERSION || r.get<uint32_t>() != ENDIAN_MARK ||
+      r.get<uint64_t>() != hash || !r.ok())
+    return false;
+
+  uint64_t count = r.get<uint64_t>();
+  std::vector<int32_t> ids;
+  std::vector<PackedBVHNode> packed;
+  for (uint64_t s = 0; s < count && r.ok(); s++) {
+    Trimesh *t = scene->make<Trimesh>(scene, mat, transform);
+    shapes.push_back({t, ObjMaterialInfo()});
+
+    t->vertNorms = r.get<uint8_t>() != 0;
+    r.getArray(t->vertices);
+    r.getArray(t->normals);
+    r.getArray(t->uvCoords);
+    r.getArray(t->vertColors);
+    r.getArray(ids);
+    r.getArray(packed);
+    r.getArray(t->bvh.faceOrder);
+    getMaterial(r, shapes.back().material);
+    if (!r.ok() || ids.size() % 3 != 0)
+      break;
+
+    // Faces were checked when the cache was written, but a damaged file
+    // must not make us index out of bounds.
+    size_t nverts = t->vertices.size();
+    size_t nfaces = ids.size() / 3;
+    bool valid = t->bvh.faceOrder.size() == nfaces;
+    for (int32_t id : ids)
+      valid = valid && id >= 0 && (size_t)id < nverts;
+    for (int32_t f : t->bvh.faceOrder)
+      valid = valid && f >= 0 && (size_t)f < nfaces;
+    valid = valid && validBVHNodes(packed, nfaces);
+    if (!valid) {
+      r.fail();
+      break;
+    }
+
+    t->faces.reserve(nfaces);
+    t->faceArena.reserve(nfaces * sizeof(TrimeshFace));
+    for (size_t f = 0; f < nfaces; f++)
+      t->faces.push_back(
+          t->makeFace(ids[3 * f], ids[3 * f + 1], ids[3 * f + 2]));
+
+    unpackBVHNodes(packed, t->bvh.nodes);
+    t->bvh.resolveFaces(t->faces);
+    t->bvh.built = true;
+  }
+
+  if (!r.ok() || shapes.size() != count) {
+    // The meshes made so far are in the scene's arena and go with it.
+    shapes.clear();
+    return false;
+  }
+  return true;
+}
+
+void MeshCache::save(const std::string &cachePath, uint64_t hash,
+                     const std::vector<CachedShape> &shapes) {
+  BinaryWriter w;
+  w.putBytes(MAGIC, sizeof(MAGIC));
+  w.put(VERSION);
+  w.put(ENDIAN_MARK);
+  w.put(hash);
+  w.put((uint64_t)shapes.size());
+
+  std::vector<int32_t> ids;
+  std::vector<PackedBVHNode> packed;
+  for (const CachedShape &s : shapes) {
+    const Trimesh *t = s.mesh;
+    if (!t->bvh.isBuilt())
+      return;
+
+    ids.clear();
+    for (const TrimeshFace *f : t->faces)
+      for (int k = 0; k < 3; k++)
+        ids.push_back((*f)[k]);
+
+    packBVHNodes(t->bvh.nodes, packed);
+
+    w.put((uint8_t)t->vertNorms);
+    w.putArray(t->vertices);
+    w.putArray(t->normals);
+    w.putArray(t->uvCoords);
+    w.putArray(t->vertColors);
+    w.putArray(ids);
+    w.putArray(packed);
+    w.putArray(t->bvh.faceOrder);
+    putMaterial(w, s.material);
+  }
+
+  if (!writeFileAtomically(cachePath, w.bytes.data(), w.bytes.size()))
+    std::cerr << "Warning: could not write mesh cache " << cachePath
+              << std::endl;
+}
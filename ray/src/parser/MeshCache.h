@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <glm/mat4x4.hpp>
+
+class Material;
+class Scene;
+class Trimesh;
+
+/* The parts of an OBJ/MTL material that we actually use. Texture names are
+kept as written in the MTL file and resolved against the scene directory
+when the material is applied, so a cache stays valid if the scene moves. */
+struct ObjMaterialInfo {
+  bool present = false;
+  double diffuse[3] = {0, 0, 0};
+  double specular[3] = {0, 0, 0};
+  double ambient[3] = {0, 0, 0};
+  double transmissive[3] = {0, 0, 0};
+  double emissive[3] = {0, 0, 0};
+  double shininess = 0.0;
+  double ior = 1.0;
+  std::string diffuseTex;
+  std::string specularTex;
+};
+
+/* One shape of an OBJ file, as it comes out of (or goes into) the cache. */
+struct CachedShape {
+  Trimesh *mesh;
+  ObjMaterialInfo material;
+};
+
+/* Binary cache of parsed OBJ meshes.
+
+Parsing a large OBJ file is slow: it is text, the v/vt/vn triples have to
+be deduplicated, and the BVH has to be built afterwards. Since none of that
+depends on anything but the file contents, we save the result next to the
+OBJ (or in a cache directory) and load it from there the next time.
+
+The cache file is named after the OBJ file and a hash of its contents and of
+the MTL files it references, so editing any of them simply produces a new
+cache file. Loading maps the file and copies the vertex, normal, UV, color,
+face and BVH arrays straight out of it; nothing is parsed. Any problem with a
+cache file (wrong version, other endianness, truncated) makes it a miss and
+the OBJ is parsed as usual. */
+class MeshCache {
+public:
+  static bool enabled;          // "mesh_cache" in the settings
+  static std::string directory; // "mesh_cache_dir"; empty = next to the OBJ
+
+  // Hash of the OBJ file and its MTL libraries. Returns false if the OBJ
+  // could not be read.
+  static bool hashObj(const std::string &objPath, const std::string &mtlDir,
+                      uint64_t &hash);
+
+  static std::string pathFor(const std::string &objPath, uint64_t hash);
+
+  // Create Trimeshes for every shape in the cache file. Returns false (and
+  // leaves shapes empty) on a miss.
+  static bool load(const std::string &cachePath, uint64_t hash, Scene *scene,
+                   Material *mat, const glm::dmat4 &transform,
+                   std::vector<CachedShape> &shapes);
+
+  // Write the shapes to the cache file. Failure is not an error; the cache
+  // just won't be there next time.
+  static void save(const std::string &cachePath, uint64_t hash,
+                   const std::vector<CachedShape> &shapes);
+};
@@ -0,0 +1,515 @@
+#include "ObjLoader.h"
+
+#include "../fileio/mappedfile.h"
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <stdint.h>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+// Below these sizes a single thread is faster than splitting the work.
+const size_t MIN_CHUNK_BYTES = size_t(1) << 20;
+const size_t MIN_PARTITION_CORNERS = size_t(1) << 16;
+
+size_t workerCount() {
+  unsigned n = std::thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+// Run body(0), ..., body(n - 1) spread over the available cores.
+void parallelFor(size_t n, const std::function<void(size_t)> &body) {
+  size_t threads = std::min(n, workerCount());
+  if (threads <= 1) {
+    for (size_t i = 0; i < n; i++)
+      body(i);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> pool;
+  for (size_t t = 0; t < threads; t++)
+    pool.emplace_back([&]() {
+      for (size_t i; (i = next++) < n;)
+        body(i);
+    });
+  for (std::thread &t : pool)
+    t.join();
+}
+
+inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+
+/* A range of complete lines of the file and what was found in it. */
+struct Chunk {
+  const char *begin;
+  const char *end;
+
+  // Counting pass: how many of each vertex attribute the chunk defines, and
+  // (after the prefix sum) the index of the first one in the whole file.
+  size_t nv = 0, nvn = 0, nvt = 0;
+  size_t v0 = 0, vn0 = 0, vt0 = 0;
+
+  // Parsing pass
+  std::vector<ObjCorner> corners; // polygon corners, absolute indices
+  std::vector<unsigned char> sides; // corners per polygon (3 or 4)
+  std::vector<size_t> breaks; // polygon count at each 'o' or 'g' line
+  std::vector<std::vector<std::string>> mtllibs;
+  bool allColors = true;
+  bool ok = true;
+
+  // Triangulation pass: the triangles' corners, and where each polygon's
+  // triangles start in them.
+  std::vector<ObjCorner> tris;
+  std::vector<size_t> triStart;
+};
+
+/* Cursor over one line, without its line terminator. */
+struct Line {
+  const char *p;
+  const char *end;
+
+  void skipSpace() {
+    while (p < end && isSpace(*p))
+      p++;
+  }
+  bool atEnd() const { return p >= end || *p == '\r'; }
+  const char *tokenEnd() const {
+    const char *e = p;
+    while (e < end && !isSpace(*e) && *e != '\r')
+      e++;
+    return e;
+  }
+
+  // Like tinyobj's parseReal: the next whitespace-separated token as a
+  // number, or false (and def) if there is none or it is not a number.
+  bool real(double &out, double def = 0.0) {
+    skipSpace();
+    const char *e = tokenEnd();
+    const char *s = p;
+    p = e;
+    out = def;
+    if (s < e && *s == '+')
+      s++;
+    if (s == e)
+      return false;
+#if defined(__cpp_lib_to_chars)
+    double v;
+    std::from_chars_result r = std::from_chars(s, e, v);
+    if (r.ec != std::errc())
+      return false;
+    out = v;
+    return true;
+#else
+    char buf[64];
+    size_t n = std::min((size_t)(e - s), sizeof(buf) - 1);
+    std::memcpy(buf, s, n);
+    buf[n] = '\0';
+    char *stop;
+    double v = std::strtod(buf, &stop);
+    if (stop == buf)
+      return false;
+    out = v;
+    return true;
+#endif
+  }
+
+  // atoi, bounded by the line.
+  int integer() {
+    const char *s = p;
+    bool neg = false;
+    if (s < end && (*s == '-' || *s == '+'))
+      neg = *s++ == '-';
+    long long v = 0;
+    while (s < end && *s >= '0' && *s <= '9' && v < (1ll << 40))
+      v = v * 10 + (*s++ - '0');
+    return (int)(neg ? -v : v);
+  }
+
+  // Skip to the next '/' or whitespace, as tinyobj's strcspn("/ \t\r").
+  void skipIndex() {
+    while (p < end && *p != '/' && !isSpace(*p) && *p != '\r')
+      p++;
+  }
+};
+
+// OBJ indices are 1-based, or relative to the end if negative.
+inline bool fixIndex(int idx, size_t n, int &out) {
+  if (idx > 0) {
+    out = idx - 1;
+    return true;
+  }
+  if (idx < 0) {
+    out = (int)n + idx;
+    return true;
+  }
+  return false;
+}
+
+// One v, v/vt, v//vn or v/vt/vn corner, the way tinyobj's parseTriple reads
+// it. nv, nvt and nvn are the number of each attribute defined so far.
+bool parseCorner(Line &l, size_t nv, size_t nvt, size_t nvn, ObjCorner &c) {
+  c.v = c.vt = c.vn = -1;
+  if (!fixIndex(l.integer(), nv, c.v))
+    return false;
+  l.skipIndex();
+  if (l.p >= l.end || *l.p != '/')
+    return true;
+  l.p++;
+
+  if (l.p < l.end && *l.p == '/') {
+    l.p++;
+    if (!fixIndex(l.integer(), nvn, c.vn))
+      return false;
+    l.skipIndex();
+    return true;
+  }
+
+  if (!fixIndex(l.integer(), nvt, c.vt))
+    return false;
+  l.skipIndex();
+  if (l.p >= l.end || *l.p != '/')
+    return true;
+  l.p++;
+
+  if (!fixIndex(l.integer(), nvn, c.vn))
+    return false;
+  l.skipIndex();
+  return true;
+}
+
+// Call fn(line) for every line in [begin, end).
+template <typename F> void forEachLine(const char *begin, const char *end, F fn) {
+  const char *p = begin;
+  while (p < end) {
+    const char *eol = (const char *)std::memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    Line l{p, eol};
+    l.skipSpace();
+    fn(l);
+    p = eol + 1;
+  }
+}
+
+void countChunk(Chunk &c) {
+  forEachLine(c.begin, c.end, [&c](Line &l) {
+    if (l.end - l.p < 2 || l.p[0] != 'v')
+      return;
+    if (isSpace(l.p[1]))
+      c.nv++;
+    else if (l.end - l.p >= 3 && isSpace(l.p[2])) {
+      if (l.p[1] == 'n')
+        c.nvn++;
+      else if (l.p[1] == 't')
+        c.nvt++;
+    }
+  });
+}
+
+void parseChunk(Chunk &c, ObjData &out) {
+  size_t nv = c.v0, nvn = c.vn0, nvt = c.vt0;
+  forEachLine(c.begin, c.end, [&](Line &l) {
+    if (!c.ok || l.atEnd() || l.p[0] == '#')
+      return;
+    size_t len = l.end - l.p;
+    char k0 = l.p[0];
+    char k1 = len > 1 ? l.p[1] : '\0';
+    char k2 = len > 2 ? l.p[2] : '\0';
+
+    if (k0 == 'v' && isSpace(k1)) {
+      l.p += 2;
+      double *pos = &out.positions[3 * nv];
+      l.real(pos[0]);
+      l.real(pos[1]);
+      l.real(pos[2]);
+      double *col = &out.colors[3 * nv];
+      bool color = l.real(col[0]) && l.real(col[1]) && l.real(col[2]);
+      if (!color)
+        col[0] = col[1] = col[2] = 1.0;
+      c.allColors = c.allColors && color;
+      nv++;
+    } else if (k0 == 'v' && k1 == 'n' && isSpace(k2)) {
+      l.p += 3;
+      double *n = &out.normals[3 * nvn++];
+      l.real(n[0]);
+      l.real(n[1]);
+      l.real(n[2]);
+    } else if (k0 == 'v' && k1 == 't' && isSpace(k2)) {
+      l.p += 3;
+      double *uv = &out.texcoords[2 * nvt++];
+      l.real(uv[0]);
+      l.real(uv[1]);
+    } else if ((k0 == 'l' || k0 == 'p') && isSpace(k1)) {
+      c.ok = false; // lines and points are left to tinyobj
+    } else if (k0 == 'f' && isSpace(k1)) {
+      l.p += 2;
+      l.skipSpace();
+      size_t n = 0;
+      while (!l.atEnd()) {
+        ObjCorner corner;
+        if (!parseCorner(l, nv, nvt, nvn, corner)) {
+          c.ok = false;
+          return;
+        }
+        c.corners.push_back(corner);
+        n++;
+        while (l.p < l.end && (isSpace(*l.p) || *l.p == '\r'))
+          l.p++;
+      }
+      if (n < 3 || n > 4) {
+        c.ok = false;
+        return;
+      }
+      c.sides.push_back((unsigned char)n);
+    } else if ((k0 == 'g' || k0 == 'o') && isSpace(k1)) {
+      c.breaks.push_back(c.sides.size());
+    } else if (len > 6 && std::strncmp(l.p, "mtllib", 6) == 0 &&
+               isSpace(l.p[6])) {
+      l.p += 7;
+      c.mtllibs.emplace_back();
+      for (l.skipSpace(); !l.atEnd(); l.skipSpace()) {
+        const char *e = l.tokenEnd();
+        c.mtllibs.back().emplace_back(l.p, e);
+        l.p = e;
+      }
+    }
+  });
+}
+
+bool validCorner(const ObjCorner &c, const ObjData &d) {
+  return c.v >= 0 && (size_t)c.v < d.positions.size() / 3 && c.vt >= -1 &&
+         c.vt < (int)(d.texcoords.size() / 2) && c.vn >= -1 &&
+         c.vn < (int)(d.normals.size() / 3);
+}
+
+// Split quads along their shorter diagonal, as tinyobj does.
+void triangulateChunk(Chunk &c, const ObjData &d) {
+  size_t tris = 0;
+  for (unsigned char s : c.sides)
+    tris += s - 2;
+  c.tris.reserve(3 * tris);
+  c.triStart.reserve(c.sides.size() + 1);
+
+  const ObjCorner *poly = c.corners.data();
+  for (unsigned char s : c.sides) {
+    c.triStart.push_back(c.tris.size());
+    for (int k = 0; k < s; k++)
+      if (!validCorner(poly[k], d)) {
+        c.ok = false;
+        return;
+      }
+
+    if (s == 3) {
+      c.tris.insert(c.tris.end(), poly, poly + 3);
+    } else {
+      const double *v0 = &d.positions[3 * poly[0].v];
+      const double *v1 = &d.positions[3 * poly[1].v];
+      const double *v2 = &d.positions[3 * poly[2].v];
+      const double *v3 = &d.positions[3 * poly[3].v];
+      double sqr02 = 0, sqr13 = 0;
+      for (int k = 0; k < 3; k++) {
+        sqr02 += (v2[k] - v0[k]) * (v2[k] - v0[k]);
+        sqr13 += (v3[k] - v1[k]) * (v3[k] - v1[k]);
+      }
+      static const int split02[6] = {0, 1, 2, 0, 2, 3};
+      static const int split13[6] = {0, 1, 3, 1, 2, 3};
+      const int *order = sqr02 < sqr13 ? split02 : split13;
+      for (int k = 0; k < 6; k++)
+        c.tris.push_back(poly[order[k]]);
+    }
+    poly += s;
+  }
+  c.triStart.push_back(c.tris.size());
+}
+
+struct CornerHash {
+  size_t operator()(const ObjCorner &c) const {
+    uint64_t h = (uint64_t)(uint32_t)c.v * 0x9e3779b97f4a7c15ull;
+    h ^= (uint64_t)(uint32_t)c.vt + 0x7f4a7c159e3779b9ull + (h << 6) + (h >> 2);
+    h ^= (uint64_t)(uint32_t)c.vn + 0x94d049bb133111ebull + (h << 6) + (h >> 2);
+    h ^= h >> 31;
+    return (size_t)h;
+  }
+};
+
+struct CornerEq {
+  bool operator()(const ObjCorner &a, const ObjCorner &b) const {
+    return a.v == b.v && a.vt == b.vt && a.vn == b.vn;
+  }
+};
+
+/* Give every distinct corner an index, in order of first use. Corners are
+split between threads by hash, so each thread owns a disjoint part of the
+table and no locking is needed; each records, for its corners, where their
+combination first appears. A sequential sweep then numbers the first
+appearances in file order.
+
+Each corner is hashed once: the threads first bucket slices of the corner
+list by part (a count, a prefix sum and a scatter that keeps file order),
+so that each part's thread then reads only its own bucket. */
+void deduplicate(const std::vector<ObjCorner> &corners, ObjShape &shape) {
+  size_t n = corners.size();
+  size_t parts = n < MIN_PARTITION_CORNERS ? 1 : workerCount();
+  std::vector<int> firstUse(n);
+
+  if (parts == 1) {
+    std::unordered_map<ObjCorner, int, CornerHash, CornerEq> seen;
+    seen.reserve(n);
+    for (size_t c = 0; c < n; c++)
+      firstUse[c] = seen.try_emplace(corners[c], (int)c).first->second;
+  } else {
+    // Slice k is corners [n * k / parts, n * (k + 1) / parts); count[k][p]
+    // is how many of its corners belong to part p, and then where they go.
+    std::vector<uint32_t> partOf(n);
+    std::vector<std::vector<size_t>> count(parts,
+                                           std::vector<size_t>(parts, 0));
+    parallelFor(parts, [&](size_t k) {
+      CornerHash hash;
+      for (size_t c = n * k / parts; c < n * (k + 1) / parts; c++) {
+        partOf[c] = (uint32_t)((hash(corners[c]) >> 7) % parts);
+        count[k][partOf[c]]++;
+      }
+    });
+
+    // Part p's corners go to order[bucket[p], bucket[p + 1]).
+    std::vector<size_t> bucket(parts + 1, 0);
+    size_t at = 0;
+    for (size_t p = 0; p < parts; p++) {
+      bucket[p] = at;
+      for (size_t k = 0; k < parts; k++) {
+        size_t c = count[k][p];
+        count[k][p] = at;
+        at += c;
+      }
+    }
+    bucket[parts] = at;
+
+    std::vector<int> order(n);
+    parallelFor(parts, [&](size_t k) {
+      std::vector<size_t> &next = count[k];
+      for (size_t c = n * k / parts; c < n * (k + 1) / parts; c++)
+        order[next[partOf[c]]++] = (int)c;
+    });
+
+    parallelFor(parts, [&](size_t p) {
+      std::unordered_map<ObjCorner, int, CornerHash, CornerEq> seen;
+      seen.reserve(bucket[p + 1] - bucket[p]);
+      for (size_t b = bucket[p]; b < bucket[p + 1]; b++) {
+        int c = order[b];
+        firstUse[c] = seen.try_emplace(corners[c], c).first->second;
+      }
+    });
+  }
+
+  size_t unique = 0;
+  for (size_t c = 0; c < n; c++)
+    unique += firstUse[c] == (int)c;
+
+  shape.vertices.reserve(unique);
+  shape.indices.resize(n);
+  for (size_t c = 0; c < n; c++) {
+    if (firstUse[c] == (int)c) {
+      shape.indices[c] = (int)shape.vertices.size();
+      shape.vertices.push_back(corners[c]);
+    } else {
+      shape.indices[c] = shape.indices[firstUse[c]];
+    }
+  }
+}
+
+} // anonymous namespace
+
+bool loadObjParallel(const std::string &path, ObjData &out) {
+  MappedFile file(path);
+  if (!file.isOpen())
+    return false;
+  const char *data = file.data();
+  size_t size = file.size();
+
+  // A file with only '\r' line endings can't be split at newlines.
+  if (size > 0 && !std::memchr(data, '\n', size) &&
+      std::memchr(data, '\r', size))
+    return false;
+
+  // Split at the first newline after each of n evenly spaced points.
+  size_t n = std::max<size_t>(
+      1, std::min(size / MIN_CHUNK_BYTES, 4 * workerCount()));
+  std::vector<Chunk> chunks;
+  const char *begin = data;
+  for (size_t k = 1; k <= n && begin < data + size; k++) {
+    const char *end = data + size;
+    if (k < n) {
+      const char *at = std::max(begin, data + size * k / n);
+      const char *nl = (const char *)std::memchr(at, '\n', data + size - at);
+      end = nl ? nl + 1 : data + size;
+    }
+    Chunk c;
+    c.begin = begin;
+    c.end = end;
+    chunks.push_back(std::move(c));
+    begin = end;
+  }
+
+  parallelFor(chunks.size(), [&](size_t k) { countChunk(chunks[k]); });
+
+  size_t nv = 0, nvn = 0, nvt = 0;
+  for (Chunk &c : chunks) {
+    c.v0 = nv;
+    c.vn0 = nvn;
+    c.vt0 = nvt;
+    nv += c.nv;
+    nvn += c.nvn;
+    nvt += c.nvt;
+  }
+  out.positions.resize(3 * nv);
+  out.colors.resize(3 * nv);
+  out.normals.resize(3 * nvn);
+  out.texcoords.resize(2 * nvt);
+
+  parallelFor(chunks.size(), [&](size_t k) { parseChunk(chunks[k], out); });
+  for (const Chunk &c : chunks)
+    if (!c.ok)
+      return false;
+
+  parallelFor(chunks.size(), [&](size_t k) { triangulateChunk(chunks[k], out); });
+
+  bool allColors = true;
+  for (const Chunk &c : chunks) {
+    if (!c.ok)
+      return false;
+    allColors = allColors && c.allColors;
+    out.mtllibs.insert(out.mtllibs.end(), c.mtllibs.begin(), c.mtllibs.end());
+  }
+  if (!allColors)
+    out.colors.clear();
+
+  // A shape runs from one 'o' or 'g' line to the next, possibly across
+  // chunks. Shapes without faces are dropped, as tinyobj does.
+  std::vector<ObjCorner> corners;
+  auto finishShape = [&]() {
+    if (corners.empty())
+      return;
+    out.shapes.emplace_back();
+    deduplicate(corners, out.shapes.back());
+    corners.clear();
+  };
+  for (const Chunk &c : chunks) {
+    size_t from = 0;
+    for (size_t b : c.breaks) {
+      corners.insert(corners.end(), c.tris.begin() + c.triStart[from],
+                     c.tris.begin() + c.triStart[b]);
+      finishShape();
+      from = b;
+    }
+    corners.insert(corners.end(), c.tris.begin() + c.triStart[from],
+                   c.tris.end());
+  }
+  finishShape();
+
+  return true;
+}
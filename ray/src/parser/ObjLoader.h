@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/* A v/vt/vn combination from an OBJ face, with 0-based indices into the
+file's position, texcoord and normal arrays (-1 where absent). */
+struct ObjCorner {
+  int v, vt, vn;
+};
+
+/* One shape ('o' or 'g' block) of an OBJ file, triangulated and with its
+corners de-duplicated: every distinct v/vt/vn combination appears once in
+`vertices`, in order of first use, and `indices` holds three entries of
+`vertices` per triangle. This is the layout Trimesh wants. */
+struct ObjShape {
+  std::vector<ObjCorner> vertices;
+  std::vector<int> indices;
+};
+
+/* Everything we use from an OBJ file. Positions, normals and colors are
+flat xyz arrays and texcoords flat uv arrays, like tinyobj's attrib_t. */
+struct ObjData {
+  std::vector<double> positions;
+  std::vector<double> normals;
+  std::vector<double> texcoords;
+  std::vector<double> colors; // empty unless every vertex has a color
+  std::vector<std::vector<std::string>> mtllibs; // names per mtllib line
+  std::vector<ObjShape> shapes;
+};
+
+/* Multithreaded OBJ reader for the subset of the format that actual mesh
+files use: v/vn/vt, triangles and quads, o/g and mtllib. The file is split
+into chunks at line boundaries; the chunks are counted, then parsed, in
+parallel, with a prefix sum over the counts giving each chunk the absolute
+position of its vertices so relative (negative) indices resolve without
+a second pass. Corners are de-duplicated by a hash table partitioned across
+threads.
+
+The result matches what tinyobj gives for the same file. Anything we do not
+reproduce exactly (lines, points, polygons with more than four sides, bad
+indices, old Mac line endings) makes this return false, and the caller
+should use tinyobj instead. */
+bool loadObjParallel(const std::string &path, ObjData &out);
@@ -360,7 +360,7 @@ void Parser::parseSphere(Scene *scene, TransformNode *transform,
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      sphere = new Sphere(scene, newMat ? newMat : new Material(mat));
+      sphere = scene->make<Sphere>(scene, newMat ? newMat : new Material(mat));
       sphere->setTransform(transform->transform());
       scene->add(sphere);
       return;
@@ -391,7 +391,7 @@ void Parser::parseBox(Scene *scene, TransformNode *transform,
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      box = new Box(scene, newMat ? newMat : new Material(mat));
+      box = scene->make<Box>(scene, newMat ? newMat : new Material(mat));
       box->setTransform(transform->transform());
       scene->add(box);
       return;
@@ -422,7 +422,7 @@ void Parser::parseSquare(Scene *scene, TransformNode *transform,
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      square = new Square(scene, newMat ? newMat : new Material(mat));
+      square = scene->make<Square>(scene, newMat ? newMat : new Material(mat));
       square->setTransform(transform->transform());
       scene->add(square);
       return;
@@ -453,7 +453,8 @@ void Parser::parseCylinder(Scene *scene, TransformNode *transform,
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      cylinder = new Cylinder(scene, newMat ? newMat : new Material(mat));
+      cylinder = scene->make<Cylinder>(scene,
+                                       newMat ? newMat : new Material(mat));
       cylinder->setTransform(transform->transform());
       scene->add(cylinder);
       return;
@@ -501,8 +502,8 @@ void Parser::parseCone(Scene *scene, TransformNode *transform,
       break;
     case RBRACE:
       _tokenizer.Read(RBRACE);
-      cone = new Cone(scene, newMat ? newMat : new Material(mat), height,
-                      bottomRadius, topRadius, capped);
+      cone = scene->make<Cone>(scene, newMat ? newMat : new Material(mat),
+                               height, bottomRadius, topRadius, capped);
       cone->setTransform(transform->transform());
       scene->add(cone);
       return;
@@ -515,13 +516,13 @@ void Parser::parseCone(Scene *scene, TransformNode *transform,
 void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
                           const Material &mat) {
   Trimesh *tmesh =
-      new Trimesh(scene, new Material(mat), transform->transform());
+      scene->make<Trimesh>(scene, new Material(mat), transform->transform());
 
   _tokenizer.Read(TRIMESH);
   _tokenizer.Read(LBRACE);
 
   bool generateNormals(false);
-  list<glm::dvec3> faces;
+  vector<glm::dvec3> faces;
 
   const char *error;
   for (;;) {
@@ -607,12 +608,11 @@ void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
 
       // Now add all the faces into the trimesh, since
       // hopefully the vertices have been parsed out
-      for (list<glm::dvec3>::const_iterator vitr = faces.begin();
-           vitr != faces.end(); vitr++) {
-        if (!tmesh->addFace((*vitr)[0], (*vitr)[1], (*vitr)[2])) {
+      for (const glm::dvec3 &face : faces) {
+        if (!tmesh->addFace(face[0], face[1], face[2])) {
           ostringstream oss;
-          oss << "Bad face in trimesh: (" << (*vitr)[0] << ", " << (*vitr)[1]
-              << ", " << (*vitr)[2] << ")";
+          oss << "Bad face in trimesh: (" << face[0] << ", " << face[1]
+              << ", " << face[2] << ")";
           throw ParserException(oss.str());
         }
       }
@@ -634,8 +634,8 @@ void Parser::parseTrimesh(Scene *scene, TransformNode *transform,
   }
 }
 
-void Parser::parseFaces(list<glm::dvec3> &faces) {
-  list<double> points = parseScalarList();
+void Parser::parseFaces(vector<glm::dvec3> &faces) {
+  vector<double> points = parseScalarList();
 
   // triangulate here and now.  assume the poly is
   // concave (convex?) and we can triangulate using an arbitrary fan
@@ -643,14 +643,9 @@ void Parser::parseFaces(list<glm::dvec3> &faces) {
     throw SyntaxErrorException("Faces must have at least 3 vertices.",
                                _tokenizer);
 
-  list<double>::const_iterator i = points.begin();
-  double a = (*i++);
-  double b = (*i++);
-  while (i != points.end()) {
-    double c = (*i++);
-    faces.push_back(glm::dvec3(a, b, c));
-    b = c;
-  }
+  double a = points[0];
+  for (size_t i = 2; i < points.size(); i++)
+    faces.push_back(glm::dvec3(a, points[i - 1], points[i]));
 }
 
 // Ambient lights are a bit special in that we don't actually
@@ -676,6 +671,7 @@ PointLight *Parser::parsePointLight(Scene *scene) {
   float constantAttenuationCoefficient = 0.0f;
   float linearAttenuationCoefficient = 0.0f;
   float quadraticAttenuationCoefficient = 1.0f;
+  double cutoffIntensity = 0.0;
 
   bool hasPosition(false), hasColor(false);
 
@@ -711,22 +707,31 @@ PointLight *Parser::parsePointLight(Scene *scene) {
       quadraticAttenuationCoefficient = parseScalarExpression();
       break;
 
+    case CUTOFF_INTENSITY:
+      cutoffIntensity = parseScalarExpression();
+      break;
+
     case RBRACE:
       if (!hasColor)
         throw SyntaxErrorException("Expected: 'color'", _tokenizer);
       if (!hasPosition)
         throw SyntaxErrorException("Expected: 'position'", _tokenizer);
       _tokenizer.Read(RBRACE);
-      return new PointLight(
-          scene, position, color, constantAttenuationCoefficient,
-          linearAttenuationCoefficient, quadraticAttenuationCoefficient);
+      {
+        PointLight *light = new PointLight(
+            scene, position, color, constantAttenuationCoefficient,
+            linearAttenuationCoefficient, quadraticAttenuationCoefficient);
+        light->setCutoff(cutoffIntensity);
+        return light;
+      }
 
     default:
       throw SyntaxErrorException("expecting 'position' or 'color' "
                                  "attribute, or "
                                  "'constant_attenuation_coeff', "
-                                 "'linear_attenuation_coeff', or "
-                                 "'quadratic_attenuation_coeff'",
+                                 "'linear_attenuation_coeff', "
+                                 "'quadratic_attenuation_coeff', or "
+                                 "'cutoff_intensity'",
                                  _tokenizer);
     }
   }
@@ -840,8 +845,8 @@ string Parser::parseIdent() {
   return scalar->ident();
 }
 
-list<double> Parser::parseScalarList() {
-  list<double> ret;
+vector<double> Parser::parseScalarList() {
+  vector<double> ret;
 
   _tokenizer.Read(LPAREN);
   if (RPAREN != _tokenizer.Peek()->kind()) {
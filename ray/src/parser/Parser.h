@@ -9,6 +9,7 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "ParserException.h"
 #include "Tokenizer.h"
@@ -122,7 +123,7 @@ private:
   void parseCone(Scene *scene, TransformNode *transform, const Material &mat);
   void parseTrimesh(Scene *scene, TransformNode *transform,
                     const Material &mat);
-  void parseFaces(std::list<glm::dvec3> &faces);
+  void parseFaces(std::vector<glm::dvec3> &faces);
 
   // Parse transforms
   void parseTranslate(Scene *scene, TransformNode *transform,
@@ -147,7 +148,7 @@ private:
   // Helper functions for parsing things like vectors
   // and idents.
   double parseScalar();
-  std::list<double> parseScalarList();
+  std::vector<double> parseScalarList();
   glm::dvec3 parseVec3d();
   glm::dvec4 parseVec4d();
   bool parseBoolean();
@@ -46,6 +46,7 @@ string getNameForToken(const SYMBOL kind) {
     tokenNames[CONSTANT_ATTENUATION_COEFF] = "constant_attenuation_coeff";
     tokenNames[LINEAR_ATTENUATION_COEFF] = "linear_attenuation_coeff";
     tokenNames[QUADRATIC_ATTENUATION_COEFF] = "quadratic_attenuation_coeff";
+    tokenNames[CUTOFF_INTENSITY] = "cutoff_intensity";
     tokenNames[SPHERE] = "sphere";
     tokenNames[BOX] = "box";
     tokenNames[SQUARE] = "square";
@@ -119,6 +120,7 @@ SYMBOL lookupReservedWord(const string &ident) {
     reservedWords["colour"] = COLOR;
     reservedWords["cone"] = CONE;
     reservedWords["constant_attenuation_coeff"] = CONSTANT_ATTENUATION_COEFF;
+    reservedWords["cutoff_intensity"] = CUTOFF_INTENSITY;
     reservedWords["cylinder"] = CYLINDER;
     reservedWords["diffuse"] = DIFFUSE;
     reservedWords["direction"] = DIRECTION;
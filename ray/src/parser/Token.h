@@ -50,6 +50,7 @@ enum SYMBOL {
   CONSTANT_ATTENUATION_COEFF,  // Terms affecting the intensity dropoff
   LINEAR_ATTENUATION_COEFF,    // of point lights (see the PointLight
   QUADRATIC_ATTENUATION_COEFF, // class)
+  CUTOFF_INTENSITY,
 
   SPHERE, // primitives
   BOX,
@@ -1,5 +1,6 @@
 // Tokenizer.cpp
 // Breaks the input stream up into tokens
+#include <charconv>
 #include <map>
 #include <sstream>
 #include <stdlib.h>
@@ -41,6 +42,22 @@ Tokenizer::Tokenizer(istream &fp, bool printTokens) : buffer(fp, false, false) {
   _printTokens = printTokens;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// Tokenizer::Tokenizer(const string&) constructor
+//
+//   Same, but scans the named file through a memory mapping rather than
+// reading it through a stream.
+//
+
+Tokenizer::Tokenizer(const string &path, bool printTokens)
+    : buffer(path, false, false) {
+  TokenColumn = 0;
+  CurrentCh = ' ';
+  UnGetToken = NULL;
+  _printTokens = printTokens;
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // repeatedly scan tokens in and throw them away.  Useful if this is the
@@ -171,16 +188,19 @@ void Tokenizer::SkipWhiteSpace() {
 Token *Tokenizer::GetQuotedIdent() {
   GetCh(); // Throw out beginning '"'
 
-  std::ostringstream ident;
-  while ('"' != CurrentCh) {
-    if ('\n' == CurrentCh)
-      throw SyntaxErrorException("Unterminated string constant", *this);
-
-    ident << CurrentCh;
-    GetCh();
-  }
-  GetCh();
-  return new IdentToken(ident.str());
+  // Strings can't span lines, so the whole thing is right there in the
+  // buffer.
+  const char *start = buffer.Current();
+  const char *end = start;
+  const char *last = buffer.EndOfData();
+  while (end != last && '"' != *end && '\n' != *end)
+    end++;
+  if (end == last || '"' != *end)
+    throw SyntaxErrorException("Unterminated string constant", *this);
+
+  string ident(start, end);
+  CurrentCh = buffer.Skip(end - start + 1); // and the closing '"'
+  return new IdentToken(ident);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -193,31 +213,59 @@ Token *Tokenizer::GetQuotedIdent() {
 
 Token *Tokenizer::GetIdent() {
   // an IDENTIFIER or a RESERVED WORD token
-  std::ostringstream ident;
-  while (isalnum(CurrentCh) || '_' == CurrentCh || '-' == CurrentCh) {
+  const char *start = buffer.Current();
+  const char *end = start;
+  const char *last = buffer.EndOfData();
+  while (end != last &&
+         (isalnum((unsigned char)*end) || '_' == *end || '-' == *end)) {
     // While we still have something that can
-    ident << CurrentCh;
-    GetCh();
+    end++;
   }
-  return SearchReserved(ident.str());
+  CurrentCh = buffer.Skip(end - start);
+  return SearchReserved(string(start, end));
 }
 
 //////////////////////////////////////////////////////////////////////////
 //
-// Token* Tokenizer::GetInt method
+// double parseScalarText(const char*, const char*)
 //
-//   GetInt scans an integer.  It returns an integer token.
+//   Converts the text of a scalar token to its value.  A token is just a
+// run of digits, '-', '.' and 'e', so it needn't be well formed; like
+// atof(), we take the longest prefix that is a number, and 0 if there
+// is none.
+//
+
+static double parseScalarText(const char *begin, const char *end) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+  double value;
+  std::from_chars_result res = std::from_chars(begin, end, value);
+  if (res.ec == std::errc())
+    return value;
+#endif
+  // No floating point from_chars, or it gave up (no digits, out of
+  // range): strtod's answer is the one we have always used.
+  return atof(string(begin, end).c_str());
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Token* Tokenizer::GetScalar method
+//
+//   GetScalar scans a number.  It returns a scalar token.
 //
 
 Token *Tokenizer::GetScalar() {
-  // an INTEGER token
-  string ret("");
-  while (isdigit(CurrentCh) || '-' == CurrentCh || '.' == CurrentCh ||
-         'e' == CurrentCh) {
-    ret += CurrentCh;
-    GetCh();
+  // a SCALAR token
+  const char *start = buffer.Current();
+  const char *end = start;
+  const char *last = buffer.EndOfData();
+  while (end != last && (isdigit((unsigned char)*end) || '-' == *end ||
+                         '.' == *end || 'e' == *end)) {
+    end++;
   }
-  return new ScalarToken(atof(ret.c_str()));
+  double value = parseScalarText(start, end);
+  CurrentCh = buffer.Skip(end - start);
+  return new ScalarToken(value);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -34,6 +34,7 @@ using std::unique_ptr;
 class Tokenizer {
 public:
   Tokenizer(istream &fp, bool printTokens);
+  Tokenizer(const string &path, bool printTokens); // maps the file
 
   // destructively read & return the next token, skipping over whitespace
   unique_ptr<Token> Get();
@@ -77,7 +78,7 @@ protected:
   void SkipWhiteSpace(); // skip spaces, tabs, newlines
 
   Token *GetPunct();  // scan punctuation token
-  Token *GetScalar(); // scan integer token
+  Token *GetScalar(); // scan scalar token
   Token *GetIdent();  // scan identifier token
   Token *GetQuotedIdent();
 
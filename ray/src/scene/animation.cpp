@@ -0,0 +1,211 @@
+#include "animation.h"
+
+#include "../SceneObjects/trimesh.h"
+
+#include <algorithm>
+#include <fstream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <json.hpp>
+#include <memory>
+
+using json = nlohmann::json;
+
+namespace {
+
+glm::dvec3 toVec3(const json &j) {
+  return glm::dvec3(j.at(0).get<double>(), j.at(1).get<double>(),
+                    j.at(2).get<double>());
+}
+
+double lerp(double a, double b, double t) { return a + (b - a) * t; }
+
+glm::dvec3 lerp(const glm::dvec3 &a, const glm::dvec3 &b, double t) {
+  return a + (b - a) * t;
+}
+
+glm::dvec4 lerp(const glm::dvec4 &a, const glm::dvec4 &b, double t) {
+  return a + (b - a) * t;
+}
+
+std::vector<glm::dvec3> lerp(const std::vector<glm::dvec3> &a,
+                             const std::vector<glm::dvec3> &b, double t) {
+  std::vector<glm::dvec3> v(a.size());
+  for (size_t k = 0; k < a.size(); k++)
+    v[k] = a[k] + (b[k] - a[k]) * t;
+  return v;
+}
+
+} // namespace
+
+template <typename T> T SceneAnimation::Track<T>::at(double frame) const {
+  if (frame <= keys.front().first)
+    return keys.front().second;
+  if (frame >= keys.back().first)
+    return keys.back().second;
+  auto next = std::upper_bound(
+      keys.begin(), keys.end(), frame,
+      [](double f, const std::pair<double, T> &key) { return f < key.first; });
+  auto prev = next - 1;
+  double t = (frame - prev->first) / (next->first - prev->first);
+  return lerp(prev->second, next->second, t);
+}
+
+SceneAnimation *SceneAnimation::load(const std::string &path,
+                                     std::string &error) {
+  std::ifstream in(path);
+  if (!in) {
+    error = "could not read " + path;
+    return nullptr;
+  }
+  std::unique_ptr<SceneAnimation> anim(new SceneAnimation);
+  try {
+    json j = json::parse(in);
+    anim->frameCount = j.at("frames").get<int>();
+    if (anim->frameCount < 1) {
+      error = "there must be at least one frame";
+      return nullptr;
+    }
+    if (j.count("rebuild_threshold"))
+      anim->rebuildThreshold = j.at("rebuild_threshold").get<double>();
+
+    // Add key's value of field to track, if it has one.
+    auto keyed = [](auto &track, const json &key, const char *field,
+                    auto parse) {
+      if (key.count(field))
+        track.keys.emplace_back(key.at("frame").get<double>(),
+                                parse(key.at(field)));
+    };
+    auto number = [](const json &v) { return v.get<double>(); };
+    auto vec4 = [](const json &v) {
+      return glm::dvec4(toVec3(v), v.at(3).get<double>());
+    };
+    auto points = [](const json &v) {
+      std::vector<glm::dvec3> p;
+      for (const json &e : v)
+        p.push_back(toVec3(e));
+      return p;
+    };
+    auto sorted = [](auto &track) {
+      std::stable_sort(track.keys.begin(), track.keys.end(),
+                       [](const auto &a, const auto &b) {
+                         return a.first < b.first;
+                       });
+    };
+
+    if (j.count("camera")) {
+      for (const json &key : j.at("camera")) {
+        keyed(anim->eye, key, "position", toVec3);
+        keyed(anim->viewDir, key, "viewdir", toVec3);
+        keyed(anim->upDir, key, "updir", toVec3);
+        keyed(anim->fov, key, "fov", number);
+      }
+      sorted(anim->eye);
+      sorted(anim->viewDir);
+      sorted(anim->upDir);
+      sorted(anim->fov);
+    }
+
+    if (j.count("objects")) {
+      for (const json &entry : j.at("objects")) {
+        AnimatedObject obj;
+        obj.index = entry.at("index").get<int>();
+        for (const json &key : entry.at("keys")) {
+          keyed(obj.translate, key, "translate", toVec3);
+          keyed(obj.rotate, key, "rotate", vec4);
+          keyed(obj.scale, key, "scale", toVec3);
+          keyed(obj.vertices, key, "vertices", points);
+        }
+        sorted(obj.translate);
+        sorted(obj.rotate);
+        sorted(obj.scale);
+        sorted(obj.vertices);
+        for (const auto &key : obj.vertices.keys) {
+          if (key.second.size() != obj.vertices.keys[0].second.size()) {
+            error = "object " + std::to_string(obj.index) +
+                    " has keys with different numbers of vertices";
+            return nullptr;
+          }
+        }
+        anim->objects.push_back(obj);
+      }
+    }
+  } catch (const json::exception &e) {
+    error = std::string("bad sequence file: ") + e.what();
+    return nullptr;
+  }
+  return anim.release();
+}
+
+bool SceneAnimation::bind(Scene &s, std::string &error) {
+  const auto &all = s.getAllObjects();
+  for (AnimatedObject &obj : objects) {
+    if (obj.index < 0 || obj.index >= (int)all.size()) {
+      error = "there is no object " + std::to_string(obj.index) +
+              " (the scene has " + std::to_string(all.size()) + ")";
+      return false;
+    }
+    obj.geometry = all[obj.index];
+    obj.base = obj.geometry->getTransform();
+    if (!obj.vertices.empty()) {
+      obj.mesh = dynamic_cast<Trimesh *>(obj.geometry);
+      if (!obj.mesh) {
+        error = "object " + std::to_string(obj.index) +
+                " has vertices keyed but is not a trimesh";
+        return false;
+      }
+      if (obj.vertices.keys[0].second.size() != obj.mesh->vertexCount()) {
+        error = "object " + std::to_string(obj.index) + " has " +
+                std::to_string(obj.mesh->vertexCount()) +
+                " vertices, but its keys have " +
+                std::to_string(obj.vertices.keys[0].second.size());
+        return false;
+      }
+    }
+  }
+  const Camera &camera = s.getCamera();
+  baseEye = camera.getEye();
+  baseViewDir = camera.getLook();
+  baseUpDir = glm::normalize(camera.getV());
+  scene = &s;
+  return true;
+}
+
+SceneAnimation::FrameStats SceneAnimation::apply(int frame) {
+  FrameStats stats;
+  double f = frame;
+
+  Camera &camera = scene->getCamera();
+  if (!eye.empty())
+    camera.setEye(eye.at(f));
+  if (!viewDir.empty() || !upDir.empty())
+    camera.setLook(
+        glm::normalize(viewDir.empty() ? baseViewDir : viewDir.at(f)),
+        glm::normalize(upDir.empty() ? baseUpDir : upDir.at(f)));
+  if (!fov.empty())
+    camera.setFOV(fov.at(f));
+
+  for (AnimatedObject &obj : objects) {
+    if (!obj.translate.empty() || !obj.rotate.empty() || !obj.scale.empty()) {
+      glm::dmat4 m(1.0);
+      if (!obj.translate.empty())
+        m = glm::translate(m, obj.translate.at(f));
+      if (!obj.rotate.empty()) {
+        glm::dvec4 r = obj.rotate.at(f);
+        m = glm::rotate(m, r[3], glm::dvec3(r[0], r[1], r[2]));
+      }
+      if (!obj.scale.empty())
+        m = glm::scale(m, obj.scale.at(f));
+      obj.geometry->setTransform(MatrixTransform(m * obj.base.transform()));
+      obj.geometry->ComputeBoundingBox();
+    }
+    if (obj.mesh) {
+      if (obj.mesh->setVertices(obj.vertices.at(f), rebuildThreshold))
+        stats.meshesRebuilt++;
+      else
+        stats.meshesRefit++;
+    }
+  }
+
+  stats.sceneRebuilt = scene->refitAccelerators(rebuildThreshold);
+  return stats;
+}
@@ -0,0 +1,94 @@
+#ifndef SCENE_ANIMATION_H
+#define SCENE_ANIMATION_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "scene.h"
+
+class Trimesh;
+
+/*
+ * Keyframes for rendering a scene as a sequence of frames in one run.
+ * A sequence file is JSON:
+ *
+ *   {
+ *     "frames": 48,
+ *     "rebuild_threshold": 1.5,
+ *     "camera": [{"frame": 0, "position": [0, 1, 5], "viewdir": [0, 0, -1],
+ *                 "updir": [0, 1, 0], "fov": 45}, {"frame": 47, ...}],
+ *     "objects": [{"index": 2, "keys": [
+ *                   {"frame": 0, "translate": [0, 0, 0],
+ *                    "rotate": [0, 1, 0, 0], "scale": [1, 1, 1]},
+ *                   {"frame": 47, "translate": [1, 0, 0], ...}]},
+ *                 {"index": 5, "keys": [{"frame": 0, "vertices": [...]},
+ *                                       ...]}]
+ *   }
+ *
+ * Camera fields are those of a JSON scene's camera. An object is named
+ * by its place in the scene's object list, i.e. the order the scene file
+ * creates them in. Its translate, rotate (axis and angle, as in scene
+ * files) and scale are applied on top of the transform it was loaded
+ * with; a trimesh can also have its vertices keyed, as many as it has.
+ * Each field is interpolated linearly between the keys that give it and
+ * held before the first and after the last; fields no key gives keep
+ * the scene's values.
+ *
+ * Moving things refits the BVHs rather than building them again, until
+ * refitting has made one rebuild_threshold times as costly to trace as
+ * it was when last built (see SceneBVH::refit).
+ */
+class SceneAnimation {
+public:
+  // Read a sequence file. Returns null, with the reason in error, if it
+  // can't. The caller owns the result.
+  static SceneAnimation *load(const std::string &path, std::string &error);
+
+  int frames() const { return frameCount; }
+
+  // Check that the objects the keys name are in scene, and take their
+  // current transforms, and the camera, as the base the keys apply to.
+  // Returns false, with the reason in error, if they don't fit.
+  bool bind(Scene &scene, std::string &error);
+
+  // What posing a frame took.
+  struct FrameStats {
+    bool sceneRebuilt = false;
+    int meshesRefit = 0;
+    int meshesRebuilt = 0;
+  };
+
+  // Pose the bound scene as it is at frame, and update its accelerators.
+  // Not to be called while it is being rendered.
+  FrameStats apply(int frame);
+
+private:
+  template <typename T> struct Track {
+    std::vector<std::pair<double, T>> keys; // sorted by frame
+    bool empty() const { return keys.empty(); }
+    T at(double frame) const;
+  };
+
+  struct AnimatedObject {
+    int index;
+    Track<glm::dvec3> translate, scale;
+    Track<glm::dvec4> rotate; // axis, then angle
+    Track<std::vector<glm::dvec3>> vertices;
+
+    Geometry *geometry = nullptr;
+    Trimesh *mesh = nullptr;
+    MatrixTransform base;
+  };
+
+  int frameCount = 1;
+  double rebuildThreshold = 1.5;
+  Track<glm::dvec3> eye, viewDir, upDir;
+  Track<double> fov;
+  std::vector<AnimatedObject> objects;
+
+  Scene *scene = nullptr;
+  glm::dvec3 baseEye, baseViewDir, baseUpDir;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// Blocks double from 4KB up to this, unless reserve() asks for more.
+const size_t MAX_BLOCK = 1 << 20;
+
+const size_t ALIGN = alignof(std::max_align_t);
+
+size_t roundUp(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+} // namespace
+
+void *Arena::allocate(size_t size, size_t align) {
+  uintptr_t p = roundUp(uintptr_t(next), align);
+  if (!next || p + size > uintptr_t(end)) {
+    grow(size + align);
+    p = roundUp(uintptr_t(next), align);
+  }
+  next = reinterpret_cast<char *>(p + size);
+  return reinterpret_cast<void *>(p);
+}
+
+void Arena::grow(size_t bytes) {
+  size_t header = roundUp(sizeof(Block), ALIGN);
+  size_t size = std::max(nextBlockSize, roundUp(bytes, ALIGN));
+  nextBlockSize = std::min(nextBlockSize * 2, MAX_BLOCK);
+
+  Block *b = static_cast<Block *>(::operator new(header + size));
+  b->next = blocks;
+  blocks = b;
+  next = reinterpret_cast<char *>(b) + header;
+  end = next + size;
+}
+
+void Arena::reserve(size_t bytes) {
+  if (size_t(end - next) < bytes + ALIGN)
+    grow(bytes + ALIGN);
+}
+
+void Arena::clear() {
+  for (Cleanup *c = cleanups; c; c = c->next)
+    c->destroy(c->object);
+  cleanups = nullptr;
+  while (blocks) {
+    Block *b = blocks;
+    blocks = b->next;
+    ::operator delete(b);
+  }
+  next = end = nullptr;
+  nextBlockSize = 4096;
+}
@@ -0,0 +1,71 @@
+#ifndef RAY_ARENA_H
+#define RAY_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * A monotonic allocator: objects are made by bumping a pointer through
+ * large blocks, never freed one by one, and all go at once when the arena
+ * is cleared or destroyed. A scene keeps its objects in one, a mesh its
+ * faces and the light BVH its nodes, so dropping a big scene frees a few
+ * blocks rather than walking millions of allocations.
+ *
+ * Objects whose destructors do something (a Trimesh's vectors, say) are
+ * remembered, and destroyed newest first before the blocks are freed.
+ * Trivially destructible ones (TrimeshFace) cost nothing to drop.
+ */
+class Arena {
+public:
+  Arena() {}
+  ~Arena() { clear(); }
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "over-aligned types are not supported");
+    T *obj = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      Cleanup *c = new (allocate(sizeof(Cleanup), alignof(Cleanup)))
+          Cleanup{&destroy<T>, obj, cleanups};
+      cleanups = c;
+    }
+    return obj;
+  }
+
+  // Make sure the next bytes of allocations fit in one block, e.g. before
+  // making a known number of faces.
+  void reserve(size_t bytes);
+
+  // Destroy everything made so far and give the memory back.
+  void clear();
+
+private:
+  struct Block {
+    Block *next;
+  };
+  struct Cleanup {
+    void (*destroy)(void *);
+    void *object;
+    Cleanup *next;
+  };
+
+  template <typename T> static void destroy(void *p) {
+    static_cast<T *>(p)->~T();
+  }
+
+  void *allocate(size_t size, size_t align);
+  void grow(size_t bytes);
+
+  Block *blocks = nullptr;
+  char *next = nullptr;
+  char *end = nullptr;
+  size_t nextBlockSize = 4096;
+  Cleanup *cleanups = nullptr;
+};
+
+#endif // RAY_ARENA_H
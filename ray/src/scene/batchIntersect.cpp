@@ -0,0 +1,182 @@
+#include "batchIntersect.h"
+
+#include "scene.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// How far the tests lean towards a hit: relative to the magnitudes that go
+// into a sphere's discriminant, and to the size of a local box, which is
+// grown by this much on every side.
+const double SPHERE_SLACK = 1e-9;
+const double BOX_SLACK = 1e-6;
+
+// Stands in for a zero component of a local direction, so that the box
+// test can divide by it; the slab along that axis then either contains
+// the ray or lies wholly to one side of it, as it should.
+const double TINY = 1e-300;
+
+} // namespace
+
+bool ObjectPacket::kindOf(Geometry *obj, Kind &kind) {
+  switch (obj->getType()) {
+  case Geometry::SPHERE:
+    kind = SPHERES;
+    break;
+  case Geometry::BOX:
+  case Geometry::SQUARE:
+  case Geometry::CYLINDER:
+  case Geometry::CONE:
+    kind = BOXES;
+    break;
+  default:
+    return false;
+  }
+
+  // A transform that can't be inverted would give the lane NaNs, which the
+  // test has no business judging.
+  const glm::dmat4 &inv = obj->getTransform().inverseTransform();
+  for (int c = 0; c < 4; c++)
+    for (int r = 0; r < 4; r++)
+      if (!std::isfinite(inv[c][r]))
+        return false;
+  return true;
+}
+
+ObjectPacket::ObjectPacket(Kind kind) : kind(kind) {
+  std::fill(&m[0][0], &m[0][0] + 12 * WIDTH, 0.0);
+  std::fill(&lo[0][0], &lo[0][0] + 3 * WIDTH, 0.0);
+  std::fill(&hi[0][0], &hi[0][0] + 3 * WIDTH, 0.0);
+}
+
+void ObjectPacket::add(Geometry *obj, int slot) {
+  int l = count++;
+  slots[l] = slot;
+  const glm::dmat4 &inv = obj->getTransform().inverseTransform();
+  for (int a = 0; a < 3; a++)
+    for (int j = 0; j < 4; j++)
+      m[4 * a + j][l] = inv[j][a];
+
+  if (kind == BOXES) {
+    BoundingBox box = obj->ComputeLocalBoundingBox();
+    glm::dvec3 extent = box.getMax() - box.getMin();
+    double pad =
+        BOX_SLACK * (std::max(extent[0], std::max(extent[1], extent[2])) + 1.0);
+    for (int a = 0; a < 3; a++) {
+      lo[a][l] = box.getMin()[a] - pad;
+      hi[a][l] = box.getMax()[a] + pad;
+    }
+  }
+}
+
+uint64_t ObjectPacket::misses(const ray &r) const {
+  glm::dvec3 p = r.getPosition();
+  glm::dvec3 d = r.getDirection();
+  unsigned missed = 0; // by lane
+
+#ifdef __AVX__
+  __m256d o[3], v[3];
+  for (int a = 0; a < 3; a++) {
+    __m256d m0 = _mm256_loadu_pd(m[4 * a]);
+    __m256d m1 = _mm256_loadu_pd(m[4 * a + 1]);
+    __m256d m2 = _mm256_loadu_pd(m[4 * a + 2]);
+    __m256d m3 = _mm256_loadu_pd(m[4 * a + 3]);
+    o[a] = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(m0, _mm256_set1_pd(p[0])),
+                      _mm256_mul_pd(m1, _mm256_set1_pd(p[1]))),
+        _mm256_add_pd(_mm256_mul_pd(m2, _mm256_set1_pd(p[2])), m3));
+    v[a] = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(m0, _mm256_set1_pd(d[0])),
+                      _mm256_mul_pd(m1, _mm256_set1_pd(d[1]))),
+        _mm256_mul_pd(m2, _mm256_set1_pd(d[2])));
+  }
+  auto dot = [](const __m256d *x, const __m256d *y) {
+    return _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(x[0], y[0]),
+                                       _mm256_mul_pd(x[1], y[1])),
+                         _mm256_mul_pd(x[2], y[2]));
+  };
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+
+  __m256d miss;
+  if (kind == SPHERES) {
+    __m256d aa = dot(v, v);
+    __m256d b = dot(o, v);
+    __m256d oo = dot(o, o);
+    __m256d c = _mm256_sub_pd(oo, one);
+    __m256d bb = _mm256_mul_pd(b, b);
+    __m256d disc = _mm256_sub_pd(bb, _mm256_mul_pd(aa, c));
+    __m256d tol = _mm256_mul_pd(
+        _mm256_set1_pd(SPHERE_SLACK),
+        _mm256_add_pd(bb, _mm256_mul_pd(aa, _mm256_add_pd(oo, one))));
+    __m256d outside = _mm256_cmp_pd(
+        c, _mm256_mul_pd(_mm256_set1_pd(SPHERE_SLACK), _mm256_add_pd(oo, one)),
+        _CMP_GT_OQ);
+    miss = _mm256_or_pd(
+        _mm256_cmp_pd(disc, _mm256_sub_pd(zero, tol), _CMP_LT_OQ),
+        _mm256_and_pd(outside, _mm256_cmp_pd(b, zero, _CMP_GT_OQ)));
+  } else {
+    __m256d tnear = _mm256_set1_pd(-HUGE_VAL);
+    __m256d tfar = _mm256_set1_pd(HUGE_VAL);
+    for (int a = 0; a < 3; a++) {
+      __m256d da = _mm256_blendv_pd(v[a], _mm256_set1_pd(TINY),
+                                    _mm256_cmp_pd(v[a], zero, _CMP_EQ_OQ));
+      __m256d inv = _mm256_div_pd(one, da);
+      __m256d t1 =
+          _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(lo[a]), o[a]), inv);
+      __m256d t2 =
+          _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(hi[a]), o[a]), inv);
+      tnear = _mm256_max_pd(tnear, _mm256_min_pd(t1, t2));
+      tfar = _mm256_min_pd(tfar, _mm256_max_pd(t1, t2));
+    }
+    miss = _mm256_or_pd(_mm256_cmp_pd(tnear, tfar, _CMP_GT_OQ),
+                        _mm256_cmp_pd(tfar, zero, _CMP_LT_OQ));
+  }
+  missed = (unsigned)_mm256_movemask_pd(miss);
+#else
+  for (int l = 0; l < count; l++) {
+    double o[3], v[3];
+    for (int a = 0; a < 3; a++) {
+      o[a] = (m[4 * a][l] * p[0] + m[4 * a + 1][l] * p[1]) +
+             (m[4 * a + 2][l] * p[2] + m[4 * a + 3][l]);
+      v[a] = (m[4 * a][l] * d[0] + m[4 * a + 1][l] * d[1]) +
+             m[4 * a + 2][l] * d[2];
+    }
+    bool miss;
+    if (kind == SPHERES) {
+      double aa = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+      double b = o[0] * v[0] + o[1] * v[1] + o[2] * v[2];
+      double oo = o[0] * o[0] + o[1] * o[1] + o[2] * o[2];
+      double c = oo - 1.0;
+      double disc = b * b - aa * c;
+      double tol = SPHERE_SLACK * (b * b + aa * (oo + 1.0));
+      miss = disc < -tol || (c > SPHERE_SLACK * (oo + 1.0) && b > 0.0);
+    } else {
+      double tnear = -HUGE_VAL;
+      double tfar = HUGE_VAL;
+      for (int a = 0; a < 3; a++) {
+        double inv = 1.0 / (v[a] == 0.0 ? TINY : v[a]);
+        double t1 = (lo[a][l] - o[a]) * inv;
+        double t2 = (hi[a][l] - o[a]) * inv;
+        tnear = std::max(tnear, std::min(t1, t2));
+        tfar = std::min(tfar, std::max(t1, t2));
+      }
+      miss = tnear > tfar || tfar < 0.0;
+    }
+    if (miss)
+      missed |= 1u << l;
+  }
+#endif
+
+  uint64_t slotsMissed = 0;
+  for (int l = 0; l < count; l++)
+    if (missed >> l & 1)
+      slotsMissed |= uint64_t(1) << slots[l];
+  return slotsMissed;
+}
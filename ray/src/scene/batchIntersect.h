@@ -0,0 +1,53 @@
+#ifndef BATCH_INTERSECT_H
+#define BATCH_INTERSECT_H
+
+#include <cstdint>
+
+class Geometry;
+class ray;
+
+/*
+ * Up to WIDTH objects of one kind from a BVH leaf, which a ray is tested
+ * against all at once: spheres, or the shapes that fill most of a box in
+ * their local space (boxes, squares, cylinders and cones), which are
+ * tested against that box. Each lane holds its object's world-to-local
+ * transform and local box, stored lane by lane so that one AVX instruction
+ * does the same step for all four (see RAY_NATIVE in CMakeLists.txt;
+ * without AVX the same test runs a lane at a time).
+ *
+ * The test only rules objects out, and errs on the side of a hit: the
+ * objects it leaves are intersected one by one as before, so what a ray
+ * hits, and where, does not depend on it.
+ */
+class ObjectPacket {
+public:
+  static const int WIDTH = 4;
+  enum Kind { SPHERES, BOXES };
+
+  // The kind of packet obj can go in; false if it is intersected on its
+  // own (trimeshes, which have a BVH of their own, and anything unknown).
+  static bool kindOf(Geometry *obj, Kind &kind);
+
+  explicit ObjectPacket(Kind kind);
+
+  Kind getKind() const { return kind; }
+  int size() const { return count; }
+  bool full() const { return count == WIDTH; }
+
+  // Add obj, the slot'th object of its leaf (slot < 64).
+  void add(Geometry *obj, int slot);
+
+  // The leaf slots (as bits) of the objects r certainly misses.
+  uint64_t misses(const ray &r) const;
+
+private:
+  Kind kind;
+  int count = 0;
+  int slots[WIDTH];
+  // Rows of the world-to-local transform, then the local box (BOXES).
+  alignas(32) double m[12][WIDTH];
+  alignas(32) double lo[3][WIDTH];
+  alignas(32) double hi[3][WIDTH];
+};
+
+#endif // BATCH_INTERSECT_H
@@ -17,7 +17,7 @@ public:
 
   glm::dvec3 getMin() const { return bmin; }
   glm::dvec3 getMax() const { return bmax; }
-  bool isEmpty() { return bEmpty; }
+  bool isEmpty() const { return bEmpty; }
   void setEmpty() { bEmpty = true; }
 
   void setMin(glm::dvec3 bMin) {
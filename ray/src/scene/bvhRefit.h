@@ -0,0 +1,54 @@
+#ifndef BVH_REFIT_H__
+#define BVH_REFIT_H__
+
+#include <vector>
+
+#include "bbox.h"
+
+/*
+ * Helpers shared by the flattened BVHs (SceneBVH, TrimeshBVH) for when
+ * what they hold moves. Refitting keeps the tree and recomputes its
+ * boxes, which is much cheaper than building it again but gets worse the
+ * further things move from where they were; bvhCost says how much worse.
+ */
+
+// Recompute every node's box from its items' boxes, bottom up.
+// leafBounds(k) is the box of the k-th item in leaf order. Children come
+// after their parent in the array, so going backwards visits them first.
+template <typename Node, typename LeafBounds>
+void refitBVHNodes(std::vector<Node> &nodes, LeafBounds &&leafBounds) {
+  for (size_t n = nodes.size(); n-- > 0;) {
+    Node &node = nodes[n];
+    BoundingBox bounds;
+    if (node.isLeaf()) {
+      for (int k = node.first; k < node.first + node.count; k++)
+        bounds.merge(leafBounds(k));
+    } else {
+      if (node.left >= 0)
+        bounds.merge(nodes[node.left].bounds);
+      if (node.right >= 0)
+        bounds.merge(nodes[node.right].bounds);
+    }
+    node.bounds = bounds;
+  }
+}
+
+// The surface area heuristic's estimate of what tracing a ray through the
+// tree costs: each node is visited with probability its area over the
+// root's, and costs one box test, or one test per item for a leaf.
+template <typename Node> double bvhCost(const std::vector<Node> &nodes) {
+  if (nodes.empty())
+    return 0.0;
+  BoundingBox root = nodes[0].bounds;
+  double rootArea = root.area();
+  if (rootArea <= 0.0)
+    return 0.0;
+  double cost = 0.0;
+  for (const Node &node : nodes) {
+    BoundingBox box = node.bounds;
+    cost += box.area() / rootArea * (node.isLeaf() ? node.count : 1);
+  }
+  return cost;
+}
+
+#endif // BVH_REFIT_H__
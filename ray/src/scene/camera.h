@@ -6,6 +6,8 @@
 #include <glm/vec3.hpp>
 
 class Camera {
+  friend class SceneSnapshot;
+
 public:
   Camera();
   void rayThrough(double x, double y, ray &r);
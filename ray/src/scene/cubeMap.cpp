@@ -72,3 +72,7 @@ void CubeMap::setNthMap(int n, TextureMap *m) {
   if (m != tMap[n].get())
     tMap[n].reset(m);
 }
+
+void CubeMap::setNthMap(int n, std::shared_ptr<const TextureMap> m) {
+  tMap[n] = std::move(m);
+}
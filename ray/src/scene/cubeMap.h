@@ -7,7 +7,7 @@ class TextureMap;
 class ray;
 
 class CubeMap {
-  std::unique_ptr<TextureMap> tMap[6];
+  std::shared_ptr<const TextureMap> tMap[6];
 
 public:
   CubeMap();
@@ -21,6 +21,7 @@ public:
   void setZnegMap(TextureMap *m) { setNthMap(5, m); }
 
   void setNthMap(int n, TextureMap *m);
+  void setNthMap(int n, std::shared_ptr<const TextureMap> m);
 
   glm::dvec3 getColor(ray r) const;
 };
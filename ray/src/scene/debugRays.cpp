@@ -0,0 +1,59 @@
+#include "debugRays.h"
+
+DebugRayLog::~DebugRayLog() {
+  for (auto &r : rings)
+    delete r.load();
+}
+
+DebugRayLog::Ring &DebugRayLog::ring() {
+  std::atomic<Ring *> &slot = rings[ray_thread_id % RINGS];
+  Ring *r = slot.load(std::memory_order_acquire);
+  if (!r) {
+    Ring *fresh = new Ring();
+    if (slot.compare_exchange_strong(r, fresh, std::memory_order_acq_rel))
+      r = fresh;
+    else
+      delete fresh;
+  }
+  return *r;
+}
+
+void DebugRayLog::add(const ray &r, const isect &i) {
+  Ring &ring = this->ring();
+  uint64_t n = ring.head.fetch_add(1, std::memory_order_relaxed);
+  Slot &slot = ring.slots[n % CAPACITY];
+  slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.record = {r.getPosition(), r.getDirection(), i.getN(), i.getT(),
+                 r.type()};
+  slot.seq.store(2 * n + 2, std::memory_order_release);
+}
+
+void DebugRayLog::clearThread() {
+  Ring &ring = this->ring();
+  ring.start.store(ring.head.load(std::memory_order_relaxed),
+                   std::memory_order_release);
+}
+
+void DebugRayLog::forEach(
+    const std::function<void(const Record &)> &f) const {
+  for (const auto &r : rings) {
+    const Ring *ring = r.load(std::memory_order_acquire);
+    if (!ring)
+      continue;
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t start = ring->start.load(std::memory_order_acquire);
+    if (head > CAPACITY && start < head - CAPACITY)
+      start = head - CAPACITY;
+    for (uint64_t n = start; n < head; n++) {
+      const Slot &slot = ring->slots[n % CAPACITY];
+      if (slot.seq.load(std::memory_order_acquire) != 2 * n + 2)
+        continue;
+      Record copy = slot.record;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != 2 * n + 2)
+        continue;
+      f(copy);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef DEBUG_RAYS_H
+#define DEBUG_RAYS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <glm/vec3.hpp>
+
+#include "ray.h"
+
+/*
+ * The rays a scene was intersected with while TraceUI::m_debug is on,
+ * for the debugging view to draw. Each render thread (by ray_thread_id)
+ * writes into a ring of its own, allocated the first time it records, so
+ * there is no lock and no allocation per ray, and a full frame traced in
+ * debug mode keeps only the last CAPACITY rays of each thread.
+ *
+ * Readers may run while rays are recorded. Every slot carries a sequence
+ * number that is odd while it is being written; a reader skips slots that
+ * are mid-write or were overwritten while it copied them.
+ */
+class DebugRayLog {
+public:
+  static const int RINGS = 32;
+  static const int CAPACITY = 4096;
+
+  // What the view draws of one ray: where it went, and how far.
+  struct Record {
+    glm::dvec3 position;
+    glm::dvec3 direction;
+    glm::dvec3 normal;
+    double t;
+    ray::RayType type;
+  };
+
+  DebugRayLog() {}
+  ~DebugRayLog();
+  DebugRayLog(const DebugRayLog &) = delete;
+  DebugRayLog &operator=(const DebugRayLog &) = delete;
+
+  void add(const ray &r, const isect &i);
+
+  // Forget what the calling thread has recorded, e.g. before it traces
+  // the next camera ray.
+  void clearThread();
+
+  // Call f with a copy of every record that is still there.
+  void forEach(const std::function<void(const Record &)> &f) const;
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    Record record;
+  };
+  struct Ring {
+    // Records written so far, and where the last clearThread left off.
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> start{0};
+    Slot slots[CAPACITY];
+  };
+
+  Ring &ring();
+
+  std::atomic<Ring *> rings[RINGS] = {};
+};
+
+#endif // DEBUG_RAYS_H
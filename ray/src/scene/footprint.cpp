@@ -0,0 +1,127 @@
+#include "footprint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+thread_local FootprintRecorder ray_footprint;
+
+namespace {
+
+int cellIndex(int x, int y, int z) {
+  return (x * RayFootprint::CELLS + y) * RayFootprint::CELLS + z;
+}
+
+void mark(RayFootprint::Mask &mask, int x, int y, int z) {
+  int k = cellIndex(x, y, z);
+  mask[k >> 6] |= uint64_t(1) << (k & 63);
+}
+
+} // namespace
+
+// The grid is a little larger than bounds, so that rays along a face of
+// a flat scene still fall inside it.
+RayFootprint::RayFootprint(const BoundingBox &bounds) {
+  if (bounds.isEmpty())
+    return;
+  glm::dvec3 extent = bounds.getMax() - bounds.getMin();
+  double pad = 1e-6 * std::max(extent[0], std::max(extent[1], extent[2])) +
+               1e-9;
+  lo = bounds.getMin() - glm::dvec3(pad, pad, pad);
+  hi = bounds.getMax() + glm::dvec3(pad, pad, pad);
+  cell = (hi - lo) / double(CELLS);
+  grid = true;
+}
+
+bool RayFootprint::contains(const BoundingBox &box) const {
+  if (!grid || box.isEmpty())
+    return false;
+  for (int a = 0; a < 3; a++)
+    if (box.getMin()[a] < lo[a] || box.getMax()[a] > hi[a])
+      return false;
+  return true;
+}
+
+// Clip the segment to the grid, then walk the cells it crosses (Amanatides
+// and Woo). A cell is entered when the segment reaches its boundary, so a
+// hit exactly on a cell face marks the cells on both sides of it.
+void RayFootprint::addRay(const ray &r, double t1, Mask &mask) const {
+  if (!grid)
+    return;
+  glm::dvec3 p = r.getPosition();
+  glm::dvec3 d = r.getDirection();
+  double t0 = 0.0;
+  for (int a = 0; a < 3; a++) {
+    if (d[a] == 0.0) {
+      if (p[a] < lo[a] || p[a] > hi[a])
+        return;
+      continue;
+    }
+    double ta = (lo[a] - p[a]) / d[a];
+    double tb = (hi[a] - p[a]) / d[a];
+    if (ta > tb)
+      std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+  }
+  if (t0 > t1)
+    return;
+
+  const double inf = std::numeric_limits<double>::infinity();
+  int c[3], step[3];
+  double next[3], delta[3];
+  for (int a = 0; a < 3; a++) {
+    double q = (p[a] + d[a] * t0 - lo[a]) / cell[a];
+    c[a] = std::min(std::max(int(std::floor(q)), 0), CELLS - 1);
+    if (d[a] > 0.0) {
+      step[a] = 1;
+      next[a] = t0 + (c[a] + 1 - q) * cell[a] / d[a];
+      delta[a] = cell[a] / d[a];
+    } else if (d[a] < 0.0) {
+      step[a] = -1;
+      next[a] = t0 + (c[a] - q) * cell[a] / d[a];
+      delta[a] = -cell[a] / d[a];
+    } else {
+      step[a] = 0;
+      next[a] = inf;
+      delta[a] = inf;
+    }
+  }
+
+  for (;;) {
+    mark(mask, c[0], c[1], c[2]);
+    int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2)
+                              : (next[1] < next[2] ? 1 : 2);
+    if (next[a] > t1)
+      return;
+    c[a] += step[a];
+    if (c[a] < 0 || c[a] >= CELLS)
+      return;
+    next[a] += delta[a];
+  }
+}
+
+void RayFootprint::addBox(const BoundingBox &box, Mask &mask) const {
+  if (!grid || box.isEmpty())
+    return;
+  int from[3], to[3];
+  for (int a = 0; a < 3; a++) {
+    // Round outwards by a sliver of a cell, so a box that ends on a cell
+    // face includes the cells on both sides, as addRay does.
+    double q0 = (box.getMin()[a] - lo[a]) / cell[a] - 1e-4;
+    double q1 = (box.getMax()[a] - lo[a]) / cell[a] + 1e-4;
+    from[a] = std::min(std::max(int(std::floor(q0)), 0), CELLS - 1);
+    to[a] = std::min(std::max(int(std::floor(q1)), 0), CELLS - 1);
+  }
+  for (int x = from[0]; x <= to[0]; x++)
+    for (int y = from[1]; y <= to[1]; y++)
+      for (int z = from[2]; z <= to[2]; z++)
+        mark(mask, x, y, z);
+}
+
+bool RayFootprint::overlaps(const Mask &a, const Mask &b) {
+  for (int k = 0; k < WORDS; k++)
+    if (a[k] & b[k])
+      return true;
+  return false;
+}
@@ -0,0 +1,54 @@
+#ifndef RAY_FOOTPRINT_H
+#define RAY_FOOTPRINT_H
+
+#include <array>
+#include <cstdint>
+
+#include "bbox.h"
+#include "ray.h"
+
+/*
+ * Where in the scene a set of rays went, coarsely: a grid of CELLS^3
+ * cells over a box (the scene's bounds when a render starts), and a mask
+ * with one bit per cell that the segments of the rays passed through.
+ *
+ * The renderer keeps a mask per block of the image, covering every ray
+ * its pixels traced: camera rays, reflections, refractions and shadow
+ * rays, each up to where it stopped. An edit to an object can only change
+ * the pixels of blocks whose mask meets the cells the object's bounds
+ * cover before or after the edit; see RayTracer::editScene.
+ */
+class RayFootprint {
+public:
+  static const int CELLS = 16;
+  static const int WORDS = CELLS * CELLS * CELLS / 64;
+  typedef std::array<uint64_t, WORDS> Mask;
+
+  // No grid: nothing is recorded.
+  RayFootprint() {}
+  explicit RayFootprint(const BoundingBox &bounds);
+
+  bool empty() const { return !grid; }
+  bool contains(const BoundingBox &box) const;
+
+  // Mark the cells r passes through for t in [0, t1] (t1 may be infinite).
+  void addRay(const ray &r, double t1, Mask &mask) const;
+  // Mark the cells box overlaps, rounding outwards.
+  void addBox(const BoundingBox &box, Mask &mask) const;
+
+  static bool overlaps(const Mask &a, const Mask &b);
+
+private:
+  bool grid = false;
+  glm::dvec3 lo, hi, cell;
+};
+
+// The grid and mask the current thread's rays are recorded into, if any.
+// Set by the renderer around each block it traces.
+struct FootprintRecorder {
+  const RayFootprint *grid = nullptr;
+  RayFootprint::Mask *mask = nullptr;
+};
+extern thread_local FootprintRecorder ray_footprint;
+
+#endif // RAY_FOOTPRINT_H
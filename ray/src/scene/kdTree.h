@@ -1,38 +1,61 @@
 #pragma once
 
+#include "batchIntersect.h"
 #include "bbox.h"
+#include <cstdint>
 #include <vector>
 
 class Geometry;
 class ray;
 class isect;
 
+// Node of the scene BVH. Like the trimesh BVH, nodes live in one array and
+// refer to each other by index, so the tree can be saved in a scene
+// snapshot and read back as is.
 class SceneBVHNode {
 public:
     BoundingBox bounds;
-    SceneBVHNode* left;
-    SceneBVHNode* right;
-    std::vector<Geometry*> objects;
-
-    SceneBVHNode() : left(nullptr), right(nullptr) {}
-    ~SceneBVHNode() { 
-        delete left; 
-        delete right; 
-    }
-    
-    bool isLeaf() const { return left == nullptr && right == nullptr; }
+    int left;   // index of the children, -1 for a leaf
+    int right;
+    int first;  // a leaf's objects are leafObjects[first, first + count)
+    int count;
+
+    SceneBVHNode() : left(-1), right(-1), first(0), count(0) {}
+
+    bool isLeaf() const { return left < 0 && right < 0; }
 };
 
 class SceneBVH {
+    friend class SceneSnapshot;
+
 public:
-    SceneBVH() : root(nullptr) {}
-    ~SceneBVH() { delete root; }
+    SceneBVH() {}
 
     void build(const std::vector<Geometry*>& objects);
     bool intersect(ray& r, isect& i) const;
 
+    // The objects have moved: refit the boxes to their new bounds, or
+    // build the tree again if refitting has made it more than
+    // rebuildThreshold times as costly as it was when built. Returns
+    // true if it was rebuilt.
+    bool refit(const std::vector<Geometry*>& objects, double rebuildThreshold);
+
 private:
-    SceneBVHNode* root;
-    SceneBVHNode* buildRecursive(std::vector<Geometry*>& objects, int depth);
-    bool intersectNode(SceneBVHNode* node, ray& r, isect& i) const;
-};
\ No newline at end of file
+    std::vector<SceneBVHNode> nodes;     // nodes[0] is the root
+    std::vector<int> objectOrder;        // object indices in leaf order
+    std::vector<Geometry*> leafObjects;
+    std::vector<uint8_t> leafTypes;      // Geometry::Type of each
+    double builtCost = 0.0;              // bvhCost when built, 0 if unknown
+
+    // The objects of each leaf that can be tested together, by kind; node
+    // n's are packets[leafPackets[n], leafPackets[n + 1]).
+    std::vector<ObjectPacket> packets;
+    std::vector<int> leafPackets;
+
+    int buildRecursive(const std::vector<Geometry*>& objects,
+                       std::vector<int>& order, int begin, int end,
+                       int depth);
+    bool intersectNode(int node, ray& r, isect& i) const;
+    void resolveObjects(const std::vector<Geometry*>& objects);
+    void buildPackets();
+};
@@ -1,12 +1,91 @@
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <typeinfo>
+#include <vector>
 
+#include "footprint.h"
 #include "light.h"
 #include <glm/glm.hpp>
 #include <glm/gtx/io.hpp>
 
 using namespace std;
 
+// Shadow rays towards the same light from neighbouring hit points are
+// very likely to be stopped by the same object. Each thread remembers,
+// per light, the last opaque object that fully blocked a shadow ray, and
+// tries that object on its own before walking the whole scene. Pointers
+// are only trusted while they belong to the scene they were cached from.
+namespace {
+struct OccluderCache {
+  uint64_t sceneId = 0;
+  std::vector<const SceneObject *> occluder;
+};
+thread_local OccluderCache occluderCache;
+
+const SceneObject *&cachedOccluder(const Scene *scene, int light) {
+  OccluderCache &c = occluderCache;
+  if (c.sceneId != scene->id()) {
+    c.sceneId = scene->id();
+    c.occluder.assign(scene->getAllLights().size(), nullptr);
+  }
+  if (light >= (int)c.occluder.size())
+    c.occluder.resize(light + 1, nullptr);
+  return c.occluder[light];
+}
+} // namespace
+
+// Does the object that last blocked this light on this thread also stop
+// shadowRay somewhere before maxT? Any opaque hit on the segment means
+// the point is in full shadow, so a yes answers the whole query.
+bool Light::lastOccluderBlocks(ray &shadowRay, double maxT) const {
+  if (index < 0)
+    return false;
+  TraceUI::addStat(TraceUI::SHADOW_QUERIES, ray_thread_id);
+  const SceneObject *obj = cachedOccluder(scene, index);
+  if (!obj)
+    return false;
+
+  isect i;
+  if (obj->intersect(shadowRay, i) && i.getT() < maxT &&
+      glm::length(i.getMaterial().kt(i)) < 1e-6) {
+    TraceUI::addStat(TraceUI::SHADOW_CACHE_HITS, ray_thread_id);
+    if (ray_footprint.mask)
+      ray_footprint.grid->addRay(shadowRay, i.getT(), *ray_footprint.mask);
+    return true;
+  }
+  return false;
+}
+
+void Light::rememberOccluder(const SceneObject *obj) const {
+  if (index >= 0)
+    cachedOccluder(scene, index) = obj;
+}
+
+double Light::intensityBound(const glm::dvec3 &) const {
+  glm::dvec3 c = getColor();
+  return std::max(c[0], std::max(c[1], c[2]));
+}
+
+bool Light::sameAs(const Light &other) const {
+  return typeid(*this) == typeid(other) && color == other.color &&
+         cutoff == other.cutoff;
+}
+
+bool DirectionalLight::sameAs(const Light &other) const {
+  return Light::sameAs(other) &&
+         orientation ==
+             static_cast<const DirectionalLight &>(other).orientation;
+}
+
+bool PointLight::sameAs(const Light &other) const {
+  if (!Light::sameAs(other))
+    return false;
+  const PointLight &p = static_cast<const PointLight &>(other);
+  return position == p.position && constantTerm == p.constantTerm &&
+         linearTerm == p.linearTerm && quadraticTerm == p.quadraticTerm;
+}
+
 double DirectionalLight::distanceAttenuation(const glm::dvec3 &) const {
   // distance to light is infinite, so f(di) goes to 0.  Return 1.
   return 1.0;
@@ -21,10 +100,15 @@ glm::dvec3 DirectionalLight::shadowAttenuation(const ray &r,
   ray shadowRay(p + (L * 0.0001), L, glm::dvec3(1.0, 1.0, 1.0), ray::SHADOW);
   isect i;
 
+  if (lastOccluderBlocks(shadowRay, std::numeric_limits<double>::infinity())) {
+      return glm::dvec3(0.0, 0.0, 0.0);
+  }
+
   while (scene->intersect(shadowRay, i)) {
       const Material& m = i.getMaterial();
       
       if (glm::length(m.kt(i)) < 1e-6) {
+          rememberOccluder(i.getObject());
           return glm::dvec3(0.0, 0.0, 0.0);
       }
 
@@ -57,6 +141,10 @@ double PointLight::distanceAttenuation(const glm::dvec3 &P) const {
 
 glm::dvec3 PointLight::getColor() const { return color; }
 
+double PointLight::intensityBound(const glm::dvec3 &P) const {
+  return Light::intensityBound(P) * distanceAttenuation(P);
+}
+
 glm::dvec3 PointLight::getDirection(const glm::dvec3 &P) const {
   return glm::normalize(position - P);
 }
@@ -74,6 +162,10 @@ glm::dvec3 PointLight::shadowAttenuation(const ray &r,
   ray shadowRay(p + (L * 0.0001), L, glm::dvec3(1.0, 1.0, 1.0), ray::SHADOW);
   isect i;
 
+  if (lastOccluderBlocks(shadowRay, distToLight)) {
+      return glm::dvec3(0.0, 0.0, 0.0);
+  }
+
   while (scene->intersect(shadowRay, i)) {
       if (i.getT() >= distToLight) {
           break; 
@@ -82,6 +174,7 @@ glm::dvec3 PointLight::shadowAttenuation(const ray &r,
       const Material& m = i.getMaterial();
 
       if (glm::length(m.kt(i)) < 1e-6) {
+          rememberOccluder(i.getObject());
           return glm::dvec3(0.0, 0.0, 0.0);
       }
 
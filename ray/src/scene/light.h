@@ -12,6 +12,8 @@ using std::min;
 #include <FL/gl.h>
 
 class Light : public SceneElement {
+  friend class SceneSnapshot;
+
 public:
   virtual glm::dvec3 shadowAttenuation(const ray &r,
                                        const glm::dvec3 &pos) const = 0;
@@ -19,12 +21,31 @@ public:
   virtual glm::dvec3 getColor() const = 0;
   virtual glm::dvec3 getDirection(const glm::dvec3 &P) const = 0;
 
+  // Position of this light in its scene's light list.
+  int getIndex() const { return index; }
+  void setIndex(int i) { index = i; }
+
+  // Upper bound on the strongest color channel this light delivers at P,
+  // before shadowing and surface response.
+  virtual double intensityBound(const glm::dvec3 &P) const;
+
+  // Contributions weaker than this are not worth shading.
+  double getCutoff() const { return cutoff; }
+  void setCutoff(double c) { cutoff = c; }
+
+  // Whether other is the same light, e.g. in an edited copy of the scene.
+  virtual bool sameAs(const Light &other) const;
 
 protected:
   Light(Scene *scene, const glm::dvec3 &col)
       : SceneElement(scene), color(col) {}
 
+  bool lastOccluderBlocks(ray &shadowRay, double maxT) const;
+  void rememberOccluder(const SceneObject *obj) const;
+
   glm::dvec3 color;
+  int index = -1;
+  double cutoff = 0.0;
 
 public:
   virtual void glDrawLight([[maybe_unused]] GLenum lightID) const {}
@@ -32,6 +53,8 @@ public:
 };
 
 class DirectionalLight : public Light {
+  friend class SceneSnapshot;
+
 public:
   DirectionalLight(Scene *scene, const glm::dvec3 &orien,
                    const glm::dvec3 &color)
@@ -41,6 +64,7 @@ public:
   virtual double distanceAttenuation(const glm::dvec3 &P) const;
   virtual glm::dvec3 getColor() const;
   virtual glm::dvec3 getDirection(const glm::dvec3 &P) const;
+  bool sameAs(const Light &other) const;
 
 protected:
   glm::dvec3 orientation;
@@ -51,6 +75,8 @@ public:
 };
 
 class PointLight : public Light {
+  friend class SceneSnapshot;
+
 public:
   PointLight(Scene *scene, const glm::dvec3 &pos, const glm::dvec3 &color,
              float constantAttenuationTerm, float linearAttenuationTerm,
@@ -72,6 +98,13 @@ public:
     quadraticTerm = c;
   }
 
+  double intensityBound(const glm::dvec3 &P) const;
+  bool sameAs(const Light &other) const;
+  glm::dvec3 getPosition() const { return position; }
+  double getConstantTerm() const { return constantTerm; }
+  double getLinearTerm() const { return linearTerm; }
+  double getQuadraticTerm() const { return quadraticTerm; }
+
 protected:
   glm::dvec3 position;
 
@@ -0,0 +1,146 @@
+#include "lightBVH.h"
+#include "light.h"
+#include "sampler.h"
+
+#include <algorithm>
+#include <glm/glm.hpp>
+
+// Same falloff as PointLight::distanceAttenuation, for arbitrary terms.
+static double falloff(double a, double b, double c, double d) {
+    double denominator = a + b * d + c * d * d;
+    if (denominator < 1e-7) return 1.0;
+    return std::min(1.0, 1.0 / denominator);
+}
+
+static double distanceToBox(const BoundingBox& box, const glm::dvec3& P) {
+    glm::dvec3 nearest = glm::clamp(P, box.getMin(), box.getMax());
+    return glm::distance(P, nearest);
+}
+
+void LightBVH::build(const std::vector<Light*>& lights) {
+    nodes.clear();
+    root = nullptr;
+    unbounded.clear();
+
+    std::vector<const PointLight*> points;
+    for (auto light : lights) {
+        if (auto point = dynamic_cast<const PointLight*>(light))
+            points.push_back(point);
+        else
+            unbounded.push_back(light);
+    }
+
+    if (!points.empty())
+        root = buildRecursive(points, 0);
+}
+
+LightBVHNode* LightBVH::buildRecursive(std::vector<const PointLight*>& lights, int depth) {
+    LightBVHNode* node = nodes.make<LightBVHNode>();
+
+    node->constantTerm = node->linearTerm = node->quadraticTerm = 1.0e308;
+    node->maxIntensity = 0.0;
+    node->minCutoff = 1.0e308;
+    for (auto light : lights) {
+        glm::dvec3 P = light->getPosition();
+        glm::dvec3 color = light->getColor();
+        node->bounds.merge(BoundingBox(P, P));
+        node->constantTerm = std::min(node->constantTerm, light->getConstantTerm());
+        node->linearTerm = std::min(node->linearTerm, light->getLinearTerm());
+        node->quadraticTerm = std::min(node->quadraticTerm, light->getQuadraticTerm());
+        node->maxIntensity = std::max(node->maxIntensity,
+                                      std::max(color[0], std::max(color[1], color[2])));
+        node->minCutoff = std::min(node->minCutoff, light->getCutoff());
+    }
+
+    if (lights.size() <= 4 || depth > 20) {
+        node->lights = lights;
+        return node;
+    }
+
+    glm::dvec3 ext = node->bounds.getMax() - node->bounds.getMin();
+    int axis = 0;
+    if (ext.y > ext.x && ext.y > ext.z) axis = 1;
+    else if (ext.z > ext.x && ext.z > ext.y) axis = 2;
+
+    size_t mid = lights.size() / 2;
+    std::nth_element(lights.begin(), lights.begin() + mid, lights.end(),
+                     [axis](const PointLight* a, const PointLight* b) {
+        return a->getPosition()[axis] < b->getPosition()[axis];
+    });
+
+    std::vector<const PointLight*> leftLights(lights.begin(), lights.begin() + mid);
+    std::vector<const PointLight*> rightLights(lights.begin() + mid, lights.end());
+
+    node->left = buildRecursive(leftLights, depth + 1);
+    node->right = buildRecursive(rightLights, depth + 1);
+
+    return node;
+}
+
+void LightBVH::collect(const glm::dvec3& P, double cutoff, int maxLights,
+                       std::vector<LightSample>& out) const {
+    out.clear();
+
+    // bound[k] is the most out[k] can contribute at P, used as its
+    // importance if we have to sample.
+    thread_local std::vector<double> bound;
+    bound.clear();
+
+    for (auto light : unbounded) {
+        out.push_back({light, 1.0});
+        bound.push_back(light->intensityBound(P));
+    }
+    if (root)
+        collectNode(root, P, cutoff, out, bound);
+
+    if (maxLights <= 0 || (int)out.size() <= maxLights)
+        return;
+
+    // Too many lights left: draw maxLights of them with replacement,
+    // each with probability proportional to its bound, and weight them by
+    // 1 / (maxLights * probability) so the expected sum is unchanged.
+    std::vector<double> cdf(bound.size());
+    double total = 0.0;
+    for (size_t k = 0; k < bound.size(); k++) {
+        total += bound[k];
+        cdf[k] = total;
+    }
+
+    std::vector<LightSample> candidates;
+    candidates.swap(out);
+    if (total <= 0.0)
+        return;
+
+    for (int s = 0; s < maxLights; s++) {
+        double u = ray_sampler.next() * total;
+        size_t k = std::upper_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+        k = std::min(k, cdf.size() - 1);
+        double probability = bound[k] / total;
+        out.push_back({candidates[k].light, 1.0 / (maxLights * probability)});
+    }
+}
+
+void LightBVH::collectNode(const LightBVHNode* node, const glm::dvec3& P,
+                           double cutoff, std::vector<LightSample>& out,
+                           std::vector<double>& bound) const {
+    double threshold = std::max(cutoff, node->minCutoff);
+    if (threshold > 0.0) {
+        double d = distanceToBox(node->bounds, P);
+        double best = node->maxIntensity *
+            falloff(node->constantTerm, node->linearTerm, node->quadraticTerm, d);
+        if (best < threshold) return;
+    }
+
+    if (node->isLeaf()) {
+        for (auto light : node->lights) {
+            double contribution = light->intensityBound(P);
+            if (contribution < std::max(cutoff, light->getCutoff())) continue;
+            out.push_back({light, 1.0});
+            bound.push_back(contribution);
+        }
+        return;
+    }
+
+    collectNode(node->left, P, cutoff, out, bound);
+    collectNode(node->right, P, cutoff, out, bound);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "arena.h"
+#include "bbox.h"
+#include <glm/vec3.hpp>
+#include <vector>
+
+class Light;
+class PointLight;
+
+// A light picked to shade a point, and the factor its contribution is to be
+// scaled by (1 unless it was chosen by stochastic sampling).
+struct LightSample {
+    const Light* light;
+    double weight;
+};
+
+class LightBVHNode {
+public:
+    BoundingBox bounds; // of the light positions below this node
+    LightBVHNode* left;
+    LightBVHNode* right;
+    std::vector<const PointLight*> lights;
+
+    // The most optimistic light below this node: the smallest of each
+    // attenuation coefficient, the brightest color channel and the lowest
+    // cutoff. Together with the distance to bounds they give an upper bound
+    // on what any light in the subtree can contribute at a point.
+    double constantTerm, linearTerm, quadraticTerm;
+    double maxIntensity;
+    double minCutoff;
+
+    LightBVHNode() : left(nullptr), right(nullptr) {}
+
+    bool isLeaf() const { return left == nullptr && right == nullptr; }
+};
+
+// Spatial hierarchy over the point lights of a scene, used to skip lights
+// too far away to make a visible difference at the point being shaded.
+class LightBVH {
+public:
+    LightBVH() : root(nullptr) {}
+
+    void build(const std::vector<Light*>& lights);
+
+    // Fill out with the lights whose contribution at P can reach cutoff (or
+    // the light's own cutoff, if higher). Lights without a position are
+    // always included. If more than maxLights remain and maxLights > 0,
+    // maxLights of them are drawn at random, proportionally to their bound.
+    void collect(const glm::dvec3& P, double cutoff, int maxLights,
+                 std::vector<LightSample>& out) const;
+
+private:
+    Arena nodes; // all of the tree's nodes
+    LightBVHNode* root;
+    std::vector<const Light*> unbounded;
+
+    LightBVHNode* buildRecursive(std::vector<const PointLight*>& lights,
+                                 int depth);
+    void collectNode(const LightBVHNode* node, const glm::dvec3& P,
+                     double cutoff, std::vector<LightSample>& out,
+                     std::vector<double>& bound) const;
+};
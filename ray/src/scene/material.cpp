@@ -47,7 +47,12 @@ glm::dvec3 Material::shade(Scene *scene, const ray &r, const isect &i) const {
 
   glm::dvec3 totalColor = ke(i) + ka(i) * scene->ambient();
 
-  for ( const auto& pLight : scene->getAllLights() ) {
+  thread_local std::vector<LightSample> lights;
+  scene->lightsAt(P, traceUI->getLightCutoff(), traceUI->getMaxLights(), lights);
+  TraceUI::addStat(TraceUI::LIGHTS_SHADED, ray_thread_id, lights.size());
+
+  for ( const auto& sample : lights ) {
+      const Light* pLight = sample.light;
       glm::dvec3 L = pLight->getDirection(P);
       glm::dvec3 L_norm = glm::normalize(L);
 
@@ -67,14 +72,14 @@ glm::dvec3 Material::shade(Scene *scene, const ray &r, const isect &i) const {
       glm::dvec3 lightIntensity = pLight->getColor();
       double distAtten = pLight->distanceAttenuation(P);
       glm::dvec3 shadowAtten = pLight->shadowAttenuation(r, P);
-      totalColor += shadowAtten * distAtten * lightIntensity * (diffuseTerm + specularTerm);
+      totalColor += sample.weight * shadowAtten * distAtten * lightIntensity * (diffuseTerm + specularTerm);
   }
 
   return totalColor;
 }
 
 TextureMap::TextureMap(string filename) {
-  data = readImage(filename.c_str(), width, height);
+  std::vector<uint8_t> data = readImage(filename.c_str(), width, height);
   if (data.empty()) {
     width = 0;
     height = 0;
@@ -83,60 +88,144 @@ TextureMap::TextureMap(string filename) {
     error.append("'.");
     throw TextureMapException(error);
   }
+
+  levels.emplace_back(width, height);
+  MipLevel &base = levels.back();
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const uint8_t *src = &data[(y * width + x) * 3];
+      float *dst = base.at(x, y);
+      for (int c = 0; c < 3; c++)
+        dst[c] = src[c] / 255.0f;
+    }
+  }
+  buildMipChain();
 }
-glm::dvec3 TextureMap::getMappedValue(const glm::dvec2 &coord) const {
-    double x = coord[0] * (width - 1);
-    double y = coord[1] * (height - 1);
 
-    int x0 = (int)floor(x);
-    int y0 = (int)floor(y);
+TextureMap::MipLevel::MipLevel(int w, int h)
+    : width(w), height(h), tilesX((w + TILE - 1) / TILE) {
+  int tilesY = (h + TILE - 1) / TILE;
+  texels.assign((size_t)tilesX * tilesY * TILE * TILE * 3, 0.0f);
+}
 
-    int x1 = x0 + 1;
-    int y1 = y0 + 1;
+// Box filter each level down to half size until it is a single texel.
+// When a size is odd, the last texel along that axis averages the last
+// three rows or columns rather than two, so no edge texel is dropped.
+void TextureMap::buildMipChain() {
+  // The source texels [first, last] that output texel k of n covers.
+  auto footprint = [](int k, int n, int srcSize, int &first, int &last) {
+    first = std::min(2 * k, srcSize - 1);
+    last = k == n - 1 ? srcSize - 1 : 2 * k + 1;
+  };
+  while (levels.back().width > 1 || levels.back().height > 1) {
+    const MipLevel &src = levels.back();
+    MipLevel dst(std::max(1, src.width / 2), std::max(1, src.height / 2));
+    for (int y = 0; y < dst.height; y++) {
+      int y0, y1;
+      footprint(y, dst.height, src.height, y0, y1);
+      for (int x = 0; x < dst.width; x++) {
+        int x0, x1;
+        footprint(x, dst.width, src.width, x0, x1);
+        float sum[3] = {0.0f, 0.0f, 0.0f};
+        for (int sy = y0; sy <= y1; sy++)
+          for (int sx = x0; sx <= x1; sx++) {
+            const float *t = src.at(sx, sy);
+            for (int k = 0; k < 3; k++)
+              sum[k] += t[k];
+          }
+        float weight = 1.0f / ((x1 - x0 + 1) * (y1 - y0 + 1));
+        float *out = dst.at(x, y);
+        for (int k = 0; k < 3; k++)
+          out[k] = sum[k] * weight;
+      }
+    }
+    levels.push_back(std::move(dst));
+  }
+}
 
-    double dx = x - x0;
-    double dy = y - y0;
+glm::dvec3 TextureMap::bilinear(const MipLevel &level,
+                                const glm::dvec2 &coord) const {
+    double x = coord[0] * (level.width - 1);
+    double y = coord[1] * (level.height - 1);
+
+    double fx = floor(x);
+    double fy = floor(y);
+    double dx = x - fx;
+    double dy = y - fy;
+
+    int x0 = std::min(std::max((int)fx, 0), level.width - 1);
+    int y0 = std::min(std::max((int)fy, 0), level.height - 1);
+    int x1 = std::min(std::max((int)fx + 1, 0), level.width - 1);
+    int y1 = std::min(std::max((int)fy + 1, 0), level.height - 1);
+
+    const float *c00 = level.at(x0, y0); // Top-Left
+    const float *c10 = level.at(x1, y0); // Top-Right
+    const float *c01 = level.at(x0, y1); // Bottom-Left
+    const float *c11 = level.at(x1, y1); // Bottom-Right
+
+    glm::dvec3 result;
+    for (int k = 0; k < 3; k++) {
+        double top = c00[k] * (1.0 - dx) + c10[k] * dx;
+        double bottom = c01[k] * (1.0 - dx) + c11[k] * dx;
+        result[k] = top * (1.0 - dy) + bottom * dy;
+    }
+    return result;
+}
 
-    glm::dvec3 c00 = getPixelAt(x0, y0); // Top-Left
-    glm::dvec3 c10 = getPixelAt(x1, y0); // Top-Right
-    glm::dvec3 c01 = getPixelAt(x0, y1); // Bottom-Left
-    glm::dvec3 c11 = getPixelAt(x1, y1); // Bottom-Right
+glm::dvec3 TextureMap::getMappedValue(const glm::dvec2 &coord) const {
+    if (levels.empty()) return glm::dvec3(0, 0, 0);
+    return bilinear(levels[0], coord);
+}
+
+glm::dvec3 TextureMap::getMappedValue(const glm::dvec2 &coord,
+                                      double footprint) const {
+    if (levels.empty()) return glm::dvec3(0, 0, 0);
 
-    glm::dvec3 top = c00 * (1.0 - dx) + c10 * dx;
-    glm::dvec3 bottom = c01 * (1.0 - dx) + c11 * dx;
+    // Pick the level where one texel is about as wide as the footprint.
+    double texels = footprint * std::max(width, height);
+    if (texels <= 1.0) return bilinear(levels[0], coord);
+
+    double lod = std::min(std::log2(texels), double(levels.size() - 1));
+    int fine = (int)lod;
+    int coarse = std::min(fine + 1, (int)levels.size() - 1);
+    double blend = lod - fine;
+
+    glm::dvec3 a = bilinear(levels[fine], coord);
+    if (blend <= 0.0 || coarse == fine) return a;
+    return a * (1.0 - blend) + bilinear(levels[coarse], coord) * blend;
+}
 
-    return top * (1.0 - dy) + bottom * dy;
+size_t TextureMap::memoryUsage() const {
+  size_t bytes = 0;
+  for (const MipLevel &level : levels)
+    bytes += level.texels.size() * sizeof(float);
+  return bytes;
 }
 
 glm::dvec3 TextureMap::getPixelAt(int x, int y) const {
+    if (levels.empty()) return glm::dvec3(0, 0, 0);
+
     if (x >= width) x = width - 1;
     if (y >= height) y = height - 1;
     if (x < 0) x = 0;
     if (y < 0) y = 0;
 
-    int index = (y * width + x) * 3;
-
-    if (index < 0 || index + 2 >= data.size()) {
-        return glm::dvec3(0, 0, 0);
-    }
-
-    double r = data[index] / 255.0;
-    double g = data[index + 1] / 255.0;
-    double b = data[index + 2] / 255.0;
-
-    return glm::dvec3(r, g, b);
+    const float *texel = levels[0].at(x, y);
+    return glm::dvec3(texel[0], texel[1], texel[2]);
 }
 
 glm::dvec3 MaterialParameter::value(const isect &is) const {
   if (0 != _textureMap)
-    return _textureMap->getMappedValue(is.getUVCoordinates());
+    return _textureMap->getMappedValue(is.getUVCoordinates(),
+                                       is.getUVFootprint());
   else
     return _value;
 }
 
 double MaterialParameter::intensityValue(const isect &is) const {
   if (0 != _textureMap) {
-    glm::dvec3 value(_textureMap->getMappedValue(is.getUVCoordinates()));
+    glm::dvec3 value(_textureMap->getMappedValue(is.getUVCoordinates(),
+                                                 is.getUVFootprint()));
     return (0.299 * value[0]) + (0.587 * value[1]) + (0.114 * value[2]);
   } else
     return (0.299 * _value[0]) + (0.587 * _value[1]) + (0.114 * _value[2]);
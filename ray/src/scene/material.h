@@ -25,6 +25,8 @@ which consists of a bitmap and various accessors to it. To implement basic
 texture mapping, you'll want to fill in the getMappedValue function to
 implement basic texture mapping. */
 class TextureMap {
+  friend class SceneSnapshot;
+
 public:
   TextureMap(string filename);
 
@@ -34,6 +36,10 @@ public:
   // (i.e., {(u, v): 0 <= u <= 1 and 0 <= v <= 1}
   glm::dvec3 getMappedValue(const glm::dvec2 &coord) const;
 
+  // Same, prefiltered over a footprint `footprint' wide in texture
+  // coordinates by blending the two nearest mip levels (trilinear).
+  glm::dvec3 getMappedValue(const glm::dvec2 &coord, double footprint) const;
+
   // Retrieve the value stored in a physical location (with integer coordinates)
   // in the bitmap. Should be called from getMappedValue in order to do
   // bilinear interpolation.
@@ -41,13 +47,46 @@ public:
 
   int getWidth() const { return width; }
   int getHeight() const { return height; }
+  int getLevels() const { return (int)levels.size(); }
+
+  // Bytes of texel storage, over all mip levels.
+  size_t memoryUsage() const;
 
   ~TextureMap() {}
 
 protected:
+  TextureMap() : width(0), height(0) {}
+
+  // One level of the mip chain. Texels are float RGB, stored in 8x8 tiles
+  // so that the four taps of a bilinear lookup (and neighbouring lookups)
+  // usually fall in the same few cache lines.
+  struct MipLevel {
+    static constexpr int TILE = 8;
+
+    int width;
+    int height;
+    int tilesX;
+    std::vector<float> texels;
+
+    MipLevel(int w, int h);
+    float *at(int x, int y) {
+      return &texels[offset(x, y)];
+    }
+    const float *at(int x, int y) const {
+      return &texels[offset(x, y)];
+    }
+    size_t offset(int x, int y) const {
+      size_t tile = (size_t)(y / TILE) * tilesX + (x / TILE);
+      return (tile * TILE * TILE + (y % TILE) * TILE + (x % TILE)) * 3;
+    }
+  };
+
+  glm::dvec3 bilinear(const MipLevel &level, const glm::dvec2 &coord) const;
+  void buildMipChain();
+
   int width;
   int height;
-  std::vector<uint8_t> data;
+  std::vector<MipLevel> levels;
 };
 
 class TextureMapException {
@@ -72,6 +111,8 @@ to do this.
 */
 
 class MaterialParameter {
+  friend class SceneSnapshot;
+
 public:
   explicit MaterialParameter(const glm::dvec3 &par)
       : _value(par), _textureMap(0) {}
@@ -79,7 +120,7 @@ public:
   explicit MaterialParameter(const double par)
       : _value(par, par, par), _textureMap(0) {}
 
-  explicit MaterialParameter(TextureMap *tex) : _textureMap(tex) {}
+  explicit MaterialParameter(const TextureMap *tex) : _textureMap(tex) {}
 
   MaterialParameter() : _value(0.0, 0.0, 0.0), _textureMap(0) {}
 
@@ -121,6 +162,10 @@ public:
 
   bool isZero() { return glm::length(_value) == 0.0; }
 
+  bool operator==(const MaterialParameter &rhs) const {
+    return _value == rhs._value && _textureMap == rhs._textureMap;
+  }
+
   glm::dvec3 &operator+=(const glm::dvec3 &rhs) {
     _value += rhs;
     return _value;
@@ -135,10 +180,12 @@ public:
 
 private:
   glm::dvec3 _value;
-  TextureMap *_textureMap;
+  const TextureMap *_textureMap;
 };
 
 class Material {
+  friend class SceneSnapshot;
+
 public:
   Material()
       : _ke(glm::dvec3(0.0, 0.0, 0.0)), _ka(glm::dvec3(0.0, 0.0, 0.0)),
@@ -173,6 +220,12 @@ public:
 
   friend Material operator*(double d, Material m);
 
+  bool operator==(const Material &m) const {
+    return _ke == m._ke && _ka == m._ka && _ks == m._ks && _kd == m._kd &&
+           _kr == m._kr && _kt == m._kt && _shininess == m._shininess &&
+           _index == m._index;
+  }
+
   // Accessor functions; we pass in an isect& for cases where the parameter is
   // dependent on, for example, world-space coordinates (i.e., solid textures)
   // or parametrized coordinates (i.e., mapped textures)
@@ -1,6 +1,7 @@
 #include "ray.h"
 #include "../ui/TraceUI.h"
 #include "material.h"
+#include "sampler.h"
 #include "scene.h"
 
 
@@ -14,7 +15,9 @@ ray::ray(const glm::dvec3 &pp, const glm::dvec3 &dd, const glm::dvec3 &w,
   TraceUI::addRay(ray_thread_id);
 }
 
-ray::ray(const ray &other) : p(other.p), d(other.d), atten(other.atten) {
+ray::ray(const ray &other)
+    : p(other.p), d(other.d), atten(other.atten), coneWidth(other.coneWidth),
+      coneSpread(other.coneSpread) {
   TraceUI::addRay(ray_thread_id);
 }
 
@@ -25,9 +28,12 @@ ray &ray::operator=(const ray &other) {
   d = other.d;
   atten = other.atten;
   t = other.t;
+  coneWidth = other.coneWidth;
+  coneSpread = other.coneSpread;
   return *this;
 }
 
 glm::dvec3 ray::at(const isect &i) const { return at(i.getT()); }
 
 thread_local unsigned int ray_thread_id = 0;
+thread_local Sampler ray_sampler;
@@ -48,11 +48,23 @@ public:
   void setPosition(const glm::dvec3 &pp) { p = pp; }
   void setDirection(const glm::dvec3 &dd) { d = dd; }
 
+  // Ray cone used to estimate texture footprints: the cone is coneWidth
+  // wide at the origin and widens by coneSpread per unit of distance.
+  // A spread of zero means no footprint is tracked.
+  void setCone(double width, double spread) {
+    coneWidth = width;
+    coneSpread = spread;
+  }
+  double getConeWidth(double t) const { return coneWidth + coneSpread * t; }
+  double getConeSpread() const { return coneSpread; }
+
 private:
   glm::dvec3 p;
   glm::dvec3 d;
   glm::dvec3 atten;
   RayType t;
+  double coneWidth = 0.0;
+  double coneSpread = 0.0;
 };
 
 
@@ -61,7 +73,8 @@ private:
 class isect {
 public:
   isect()
-      : obj(NULL), t(0.0), N(), uvCoordinates(), bary(), material(nullptr) {}
+      : obj(NULL), t(0.0), N(), uvCoordinates(), bary(), uvScale(1.0),
+        uvFootprint(0.0), material(nullptr) {}
   isect(const isect &other) { copyFromOther(other); }
 
   ~isect() {}
@@ -72,6 +85,7 @@ public:
   }
 
   void setObject(const SceneObject *o) { obj = o; }
+  const SceneObject *getObject() const { return obj; }
 
   // Get/Set Time of flight
   void setT(double tt) { t = tt; }
@@ -88,6 +102,13 @@ public:
   }
   void setUVCoordinates(const glm::dvec2 &coords) { uvCoordinates = coords; }
   glm::dvec2 getUVCoordinates() const { return uvCoordinates; }
+  // Change in texture coordinates per unit of object-space distance around
+  // the hit point, set by shapes whose parametrization is not unit scale.
+  void setUVScale(double s) { uvScale = s; }
+  double getUVScale() const { return uvScale; }
+  // Width of the ray's footprint in texture coordinates, 0 if unknown.
+  void setUVFootprint(double f) { uvFootprint = f; }
+  double getUVFootprint() const { return uvFootprint; }
   void setBary(const glm::dvec3 &weights) { bary = weights; }
   void setBary(const double alpha, const double beta, const double gamma) {
     setBary(glm::dvec3(alpha, beta, gamma));
@@ -103,6 +124,8 @@ private:
     N = other.N;
     bary = other.bary;
     uvCoordinates = other.uvCoordinates;
+    uvScale = other.uvScale;
+    uvFootprint = other.uvFootprint;
     if (other.material) {
       setMaterial(*other.material);
     } else {
@@ -115,6 +138,8 @@ private:
   glm::dvec3 N;
   glm::dvec2 uvCoordinates;
   glm::dvec3 bary;
+  double uvScale;
+  double uvFootprint;
 
   // if this intersection has its own material (as opposed to one in its
   // associated object) as in the case where the material was interpolated
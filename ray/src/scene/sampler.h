@@ -0,0 +1,47 @@
+//
+// sampler.h
+//
+// A small, fast random number generator for the stochastic parts of the
+// tracer. Unlike rand() it keeps no shared state, so every thread can own
+// one, and it can be reseeded to make a sequence of draws reproducible.
+//
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+#include <cstdint>
+
+class Sampler {
+public:
+  explicit Sampler(uint64_t seed = 1) { reseed(seed); }
+
+  // Scramble the seed with splitmix64 so that nearby seeds (e.g. consecutive
+  // pixel indices) still give unrelated sequences.
+  void reseed(uint64_t seed) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    state = (z ^ (z >> 31)) | 1; // xorshift state must never be zero
+  }
+
+  // xorshift64*
+  uint64_t nextBits() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dull;
+  }
+
+  // Uniform double in [0, 1).
+  double next() { return (nextBits() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+  uint64_t state;
+};
+
+/*
+ * ray_sampler: the random number generator of the current thread.
+ */
+extern thread_local Sampler ray_sampler;
+
+#endif // __SAMPLER_H__
@@ -1,19 +1,39 @@
 #include <cmath>
 
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
 #include "../ui/TraceUI.h"
+#include "bvhRefit.h"
+#include "footprint.h"
 #include "kdTree.h"
 #include "light.h"
 #include "scene.h"
+#include "textureCache.h"
 #include <glm/gtx/extended_min_max.hpp>
 #include <glm/gtx/io.hpp>
 #include <iostream>
 #include <algorithm>
+#include <limits>
+#include <type_traits>
+#include <typeinfo>
 
 using namespace std;
 
 bool Geometry::intersect(ray &r, isect &i) const {
+  return intersect(type, r, i);
+}
+
+// T is the object's own class, whose functions are called directly, or
+// Geometry for the virtual ones.
+template <typename T> bool Geometry::intersectAs(ray &r, isect &i) const {
+  const T *self = static_cast<const T *>(this);
   double tmin, tmax;
-  if (hasBoundingBoxCapability() && !(bounds.intersect(r, tmin, tmax)))
+  if (self->T::hasBoundingBoxCapability() &&
+      !(bounds.intersect(r, tmin, tmax)))
     return false;
   // Transform the ray into the object's local coordinate space
   glm::dvec3 pos = transform.globalToLocalCoords(r.getPosition());
@@ -27,11 +47,39 @@ bool Geometry::intersect(ray &r, isect &i) const {
   r.setPosition(pos);
   r.setDirection(dir);
   bool rtrn = false;
-  if (intersectLocal(r, i)) {
+  bool hit;
+  if constexpr (std::is_same<T, Geometry>::value)
+    hit = intersectLocal(r, i);
+  else
+    hit = self->T::intersectLocal(r, i);
+  if (hit) {
     // Transform the intersection point & normal returned back into
     // global space.
     i.setN(transform.localToGlobalCoordsNormal(i.getN()));
     i.setT(i.getT() / length);
+    if (r.getConeSpread() > 0.0) {
+      // The ray cone leaves an ellipse on the surface: as wide as the cone
+      // across the ray, stretched by 1 / cos along it. Take both axes into
+      // object space (the transform may scale them differently) and use
+      // the longer one as the footprint.
+      glm::dvec3 N = glm::normalize(i.getN());
+      glm::dvec3 across = glm::cross(N, Wdir);
+      if (glm::length(across) < 1e-9)
+        across = glm::cross(N, std::abs(N[0]) < 0.9 ? glm::dvec3(1, 0, 0)
+                                                    : glm::dvec3(0, 1, 0));
+      across = glm::normalize(across);
+      glm::dvec3 along = glm::cross(across, N);
+
+      double width = r.getConeWidth(i.getT());
+      double cosine = std::max(std::abs(glm::dot(N, Wdir)), 0.1);
+      glm::dvec3 localAcross =
+          transform.globalToLocalCoords(Wpos + across * width) - pos;
+      glm::dvec3 localAlong =
+          transform.globalToLocalCoords(Wpos + along * (width / cosine)) - pos;
+      i.setUVFootprint(
+          std::max(glm::length(localAcross), glm::length(localAlong)) *
+          i.getUVScale());
+    }
     rtrn = true;
   }
   // Restore World pos/dir
@@ -40,6 +88,25 @@ bool Geometry::intersect(ray &r, isect &i) const {
   return rtrn;
 }
 
+bool Geometry::intersect(Type type, ray &r, isect &i) const {
+  switch (type) {
+  case SPHERE:
+    return intersectAs<Sphere>(r, i);
+  case BOX:
+    return intersectAs<Box>(r, i);
+  case SQUARE:
+    return intersectAs<Square>(r, i);
+  case CYLINDER:
+    return intersectAs<Cylinder>(r, i);
+  case CONE:
+    return intersectAs<Cone>(r, i);
+  case TRIMESH:
+    return intersectAs<Trimesh>(r, i);
+  default:
+    return intersectAs<Geometry>(r, i);
+  }
+}
+
 bool Geometry::hasBoundingBoxCapability() const {
   // by default, primitives do not have to specify a bounding box. If this
   // method returns true for a primitive, then either the ComputeBoundingBox()
@@ -92,11 +159,13 @@ void Geometry::ComputeBoundingBox() {
   bounds.setMin(glm::dvec3(newMin));
 }
 
-Scene::Scene() { ambientIntensity = glm::dvec3(0, 0, 0); }
+Scene::Scene() {
+  static std::atomic<uint64_t> nextId{1};
+  sceneId = nextId++;
+  ambientIntensity = glm::dvec3(0, 0, 0);
+}
 
 Scene::~Scene() {
-  for (auto &obj : objects)
-    delete obj;
   for (auto &light : lights)
     delete light;
 }
@@ -107,64 +176,275 @@ void Scene::add(Geometry *obj) {
   objects.emplace_back(obj);
 }
 
-void Scene::add(Light *light) { lights.emplace_back(light); }
+void Scene::add(Light *light) {
+  light->setIndex(lights.size());
+  lights.emplace_back(light);
+  lightBvhBuilt = false;
+}
+
+void Scene::buildAccelerators() const {
+  if (!bvhBuilt) {
+    bvh.build(objects);
+    bvhBuilt = true;
+  }
+  if (!lightBvhBuilt) {
+    lightBvh.build(lights);
+    lightBvhBuilt = true;
+  }
+}
+
+bool Scene::refitAccelerators(double rebuildThreshold) {
+  sceneBounds = BoundingBox();
+  for (Geometry *obj : objects)
+    if (obj->hasBoundingBoxCapability())
+      sceneBounds.merge(obj->getBoundingBox());
+  if (!bvhBuilt) {
+    buildAccelerators();
+    return true;
+  }
+  return bvh.refit(objects, rebuildThreshold);
+}
+
+// For comparing a scene with an edited copy of it.
+static bool samePlaceAndShape(const Geometry &a, const Geometry &b) {
+  return a.getTransform().transform() == b.getTransform().transform() &&
+         a.getBoundingBox().getMin() == b.getBoundingBox().getMin() &&
+         a.getBoundingBox().getMax() == b.getBoundingBox().getMax() &&
+         a.sameShape(b);
+}
+
+static bool sameView(const Camera &a, const Camera &b) {
+  return a.getEye() == b.getEye() && a.getLook() == b.getLook() &&
+         a.getU() == b.getU() && a.getV() == b.getV();
+}
+
+bool Scene::takeShading(Scene &other, std::string &error) {
+  if (other.objects.size() != objects.size()) {
+    error = "it has " + std::to_string(other.objects.size()) +
+            " objects instead of " + std::to_string(objects.size());
+    return false;
+  }
+  for (size_t k = 0; k < objects.size(); k++) {
+    const Geometry &a = *objects[k], &b = *other.objects[k];
+    if (typeid(a) != typeid(b) || !samePlaceAndShape(a, b)) {
+      error = "object " + std::to_string(k) + " has moved or changed shape";
+      return false;
+    }
+  }
+  if (!sameView(camera, other.camera)) {
+    error = "the camera has moved";
+    return false;
+  }
+
+  for (size_t k = 0; k < objects.size(); k++) {
+    auto *a = dynamic_cast<SceneObject *>(objects[k]);
+    auto *b = dynamic_cast<SceneObject *>(other.objects[k]);
+    if (!a || !b)
+      continue;
+    Material m = b->getMaterial();
+    a->setMaterial(&m);
+    // Vertex colors stand in for the diffuse color.
+    auto *mesh = dynamic_cast<Trimesh *>(a);
+    auto *edited = dynamic_cast<Trimesh *>(b);
+    if (mesh && edited)
+      mesh->setColors(*edited);
+  }
+  // The new materials point at other's textures.
+  textureCache.swap(other.textureCache);
+
+  lights.swap(other.lights);
+  for (Light *light : other.lights)
+    delete light;
+  other.lights.clear();
+  for (Light *light : lights)
+    light->scene = this;
+  lightBvhBuilt = false;
+  other.lightBvhBuilt = false;
+  ambientIntensity = other.ambientIntensity;
+  return true;
+}
+
+bool Scene::changedObjects(const Scene &other,
+                           std::vector<int> &changed) const {
+  if (other.objects.size() != objects.size() ||
+      other.lights.size() != lights.size() ||
+      other.ambientIntensity != ambientIntensity ||
+      !sameView(camera, other.camera))
+    return false;
+  for (size_t k = 0; k < lights.size(); k++)
+    if (!lights[k]->sameAs(*other.lights[k]))
+      return false;
+
+  changed.clear();
+  for (size_t k = 0; k < objects.size(); k++) {
+    const Geometry &a = *objects[k], &b = *other.objects[k];
+    if (typeid(a) != typeid(b))
+      return false;
+    bool same = samePlaceAndShape(a, b);
+    auto *ma = dynamic_cast<const SceneObject *>(&a);
+    auto *mb = dynamic_cast<const SceneObject *>(&b);
+    if (same && ma && mb)
+      same = ma->getMaterial() == mb->getMaterial();
+    auto *ta = dynamic_cast<const Trimesh *>(&a);
+    if (same && ta)
+      same = ta->sameColors(static_cast<const Trimesh &>(b));
+    if (!same)
+      changed.push_back((int)k);
+  }
+  return true;
+}
+
+void Scene::lightsAt(const glm::dvec3 &P, double cutoff, int maxLights,
+                     std::vector<LightSample> &out) const {
+  if (!lightBvhBuilt) {
+    lightBvh.build(lights);
+    lightBvhBuilt = true;
+  }
+  lightBvh.collect(P, cutoff, maxLights, out);
+}
 
 void SceneBVH::build(const std::vector<Geometry*>& objects) {
-    delete root;
-    std::vector<Geometry*> copy = objects;
-    root = buildRecursive(copy, 0);
+    nodes.clear();
+    objectOrder.resize(objects.size());
+    for (size_t k = 0; k < objects.size(); k++)
+        objectOrder[k] = (int)k;
+    buildRecursive(objects, objectOrder, 0, (int)objects.size(), 0);
+    resolveObjects(objects);
+    builtCost = bvhCost(nodes);
 }
 
-SceneBVHNode* SceneBVH::buildRecursive(std::vector<Geometry*>& objects, int depth) {
-    SceneBVHNode* node = new SceneBVHNode();
-    
-    for (auto obj : objects) {
+bool SceneBVH::refit(const std::vector<Geometry*>& objects,
+                     double rebuildThreshold) {
+    // A tree that came from a snapshot is measured against itself as it
+    // was before this first move.
+    if (builtCost <= 0.0)
+        builtCost = bvhCost(nodes);
+    refitBVHNodes(nodes, [this](int k) {
+        const Geometry* obj = leafObjects[k];
+        return obj->hasBoundingBoxCapability() ? obj->getBoundingBox()
+                                               : BoundingBox();
+    });
+    if (bvhCost(nodes) <= rebuildThreshold * builtCost) {
+        buildPackets();
+        return false;
+    }
+    build(objects);
+    return true;
+}
+
+// Point the leaves back at the objects, once objectOrder is final.
+void SceneBVH::resolveObjects(const std::vector<Geometry*>& objects) {
+    leafObjects.resize(objectOrder.size());
+    leafTypes.resize(objectOrder.size());
+    for (size_t k = 0; k < objectOrder.size(); k++) {
+        leafObjects[k] = objects[objectOrder[k]];
+        leafTypes[k] = leafObjects[k]->getType();
+    }
+    buildPackets();
+}
+
+// Pack each leaf's objects by kind, in leaf order. Packets of one are
+// left out, as testing the object on its own costs about the same.
+void SceneBVH::buildPackets() {
+    packets.clear();
+    leafPackets.assign(nodes.size() + 1, 0);
+    for (size_t n = 0; n < nodes.size(); n++) {
+        leafPackets[n] = (int)packets.size();
+        if (!nodes[n].isLeaf())
+            continue;
+        for (ObjectPacket::Kind kind :
+             {ObjectPacket::SPHERES, ObjectPacket::BOXES}) {
+            ObjectPacket packet(kind);
+            auto flush = [&]() {
+                if (packet.size() > 1)
+                    packets.push_back(packet);
+                packet = ObjectPacket(kind);
+            };
+            int count = std::min(nodes[n].count, 64);
+            for (int slot = 0; slot < count; slot++) {
+                Geometry* obj = leafObjects[nodes[n].first + slot];
+                ObjectPacket::Kind k;
+                if (!ObjectPacket::kindOf(obj, k) || k != kind)
+                    continue;
+                packet.add(obj, slot);
+                if (packet.full())
+                    flush();
+            }
+            flush();
+        }
+    }
+    leafPackets[nodes.size()] = (int)packets.size();
+}
+
+int SceneBVH::buildRecursive(const std::vector<Geometry*>& objects,
+                             std::vector<int>& order, int begin, int end,
+                             int depth) {
+    int index = (int)nodes.size();
+    nodes.emplace_back();
+
+    BoundingBox bounds;
+    for (int k = begin; k < end; k++) {
+        Geometry* obj = objects[order[k]];
         if (obj->hasBoundingBoxCapability()) {
-            node->bounds.merge(obj->getBoundingBox());
+            bounds.merge(obj->getBoundingBox());
         }
     }
+    nodes[index].bounds = bounds;
 
-    if (objects.size() <= 4 || depth > 20) {
-        node->objects = objects;
-        return node;
+    if (end - begin <= 4 || depth > 20) {
+        nodes[index].first = begin;
+        nodes[index].count = end - begin;
+        return index;
     }
 
-    glm::dvec3 ext = node->bounds.getMax() - node->bounds.getMin();
+    glm::dvec3 ext = bounds.getMax() - bounds.getMin();
     int axis = 0;
     if (ext.y > ext.x && ext.y > ext.z) axis = 1;
     else if (ext.z > ext.x && ext.z > ext.y) axis = 2;
 
-    std::sort(objects.begin(), objects.end(), [axis](Geometry* a, Geometry* b) {
+    std::sort(order.begin() + begin, order.begin() + end, [&objects, axis](int ia, int ib) {
+        Geometry* a = objects[ia];
+        Geometry* b = objects[ib];
         double aMin = a->hasBoundingBoxCapability() ? a->getBoundingBox().getMin()[axis] : 0.0;
         double bMin = b->hasBoundingBoxCapability() ? b->getBoundingBox().getMin()[axis] : 0.0;
         return aMin < bMin;
     });
 
-    size_t mid = objects.size() / 2;
-    std::vector<Geometry*> leftObjs(objects.begin(), objects.begin() + mid);
-    std::vector<Geometry*> rightObjs(objects.begin() + mid, objects.end());
+    int mid = begin + (end - begin) / 2;
 
-    node->left = buildRecursive(leftObjs, depth + 1);
-    node->right = buildRecursive(rightObjs, depth + 1);
+    // nodes may reallocate while children are added; don't hold references
+    int left = buildRecursive(objects, order, begin, mid, depth + 1);
+    int right = buildRecursive(objects, order, mid, end, depth + 1);
+    nodes[index].left = left;
+    nodes[index].right = right;
 
-    return node;
+    return index;
 }
 
 bool SceneBVH::intersect(ray& r, isect& i) const {
-    if (!root) return false;
-    return intersectNode(root, r, i);
+    if (nodes.empty()) return false;
+    return intersectNode(0, r, i);
 }
 
-bool SceneBVH::intersectNode(SceneBVHNode* node, ray& r, isect& i) const {
+bool SceneBVH::intersectNode(int index, ray& r, isect& i) const {
+    const SceneBVHNode* node = &nodes[index];
+    TraceUI::touchNode(node, ray_thread_id);
     double tmin, tmax;
     if (!node->bounds.intersect(r, tmin, tmax)) return false;
 
     bool hit = false;
 
     if (node->isLeaf()) {
-        for (auto obj : node->objects) {
+        uint64_t missed = 0; // leaf slots the packets rule out
+        for (int p = leafPackets[index]; p < leafPackets[index + 1]; p++)
+            missed |= packets[p].misses(r);
+        for (int k = node->first; k < node->first + node->count; k++) {
+            int slot = k - node->first;
+            if (slot < 64 && (missed >> slot & 1))
+                continue;
             isect cur;
-            if (obj->intersect(r, cur)) {
+            if (leafObjects[k]->intersect(Geometry::Type(leafTypes[k]), r,
+                                          cur)) {
                 if (!hit || cur.getT() < i.getT()) {
                     i = cur;
                     hit = true;
@@ -175,8 +455,8 @@ bool SceneBVH::intersectNode(SceneBVHNode* node, ray& r, isect& i) const {
     }
 
     isect leftI, rightI;
-    bool hitLeft = node->left && intersectNode(node->left, r, leftI);
-    bool hitRight = node->right && intersectNode(node->right, r, rightI);
+    bool hitLeft = node->left >= 0 && intersectNode(node->left, r, leftI);
+    bool hitRight = node->right >= 0 && intersectNode(node->right, r, rightI);
 
     if (hitLeft && hitRight) {
         i = (leftI.getT() < rightI.getT()) ? leftI : rightI;
@@ -201,22 +481,29 @@ bool Scene::intersect(ray &r, isect &i) const {
   }
 
   bool have_one = bvh.intersect(r, i);
+
+  if (ray_footprint.mask)
+    ray_footprint.grid->addRay(
+        r, have_one ? i.getT() : std::numeric_limits<double>::infinity(),
+        *ray_footprint.mask);
   
   if (!have_one) {
     i.setT(1000.0);
   }
   
   if (TraceUI::m_debug) {
-    addToIntersectCache(std::make_pair(new ray(r), new isect(i)));
+    debugRays.add(r, i);
   }
   
   return have_one;
 }
 
-TextureMap *Scene::getTexture(string name) {
+// Images come from the process-wide TextureCache; the scene keeps its own
+// reference so they stay alive for as long as its materials point at them.
+const TextureMap *Scene::getTexture(string name) {
   auto itr = textureCache.find(name);
   if (itr == textureCache.end()) {
-    textureCache[name].reset(new TextureMap(name));
+    textureCache[name] = TextureCache::instance().get(name);
     return textureCache[name].get();
   }
   return itr->second.get();
@@ -10,17 +10,22 @@
 #define __SCENE_H__
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
+#include "arena.h"
 #include "bbox.h"
 #include "camera.h"
+#include "debugRays.h"
 #include "material.h"
 #include "ray.h"
 #include "kdTree.h"
+#include "lightBVH.h"
 
 #include <glm/geometric.hpp>
 #include <glm/mat3x3.hpp>
@@ -51,6 +56,7 @@ public:
                       [[maybe_unused]] bool actualTextures) const {}
 
 protected:
+  friend class Scene;
   SceneElement(Scene *s) : scene(s) {}
 
   Scene *scene;
@@ -94,12 +100,24 @@ public:
   }
 
   const glm::dmat4x4 &transform() const { return xform; }
+  const glm::dmat4x4 &inverseTransform() const { return inverse; }
 };
 
 // A Geometry object is anything that has extent in three dimensions.
 // It may not be an actual visible scene object. For example, hierarchical
 // spatial subdivision could be expressed in terms of Geometry instances.
 class Geometry : public SceneElement {
+  friend class SceneSnapshot;
+  friend class SceneBVH;
+
+public:
+  // The built-in shapes, each of which passes its own to the constructor
+  // (and is final, so nothing else can claim it). Intersecting one of them
+  // calls its class's functions directly rather than through the vtable;
+  // anything else is OTHER and takes the virtual path.
+  enum Type { OTHER, SPHERE, BOX, SQUARE, CYLINDER, CONE, TRIMESH };
+  Type getType() const { return type; }
+
 protected:
   // intersections performed in the object's local coordinate space
   // do not call directly - this should only be called by intersect()
@@ -122,8 +140,17 @@ public:
   void setTransform(const MatrixTransform &transform) {
     this->transform = transform;
   };
+  const MatrixTransform &getTransform() const { return transform; }
+
+  // Whether other, an object of the same kind, has the same shape in its
+  // local space as far as anything but its bounds shows, e.g. a mesh's
+  // vertices or a cylinder's caps.
+  virtual bool sameShape([[maybe_unused]] const Geometry &other) const {
+    return true;
+  }
 
-  Geometry(Scene *scene) : SceneElement(scene) {}
+  Geometry(Scene *scene, Type type = OTHER)
+      : SceneElement(scene), type(type) {}
 
   // For debugging purposes, draws using OpenGL
   void glDraw(int quality, bool actualMaterials, bool actualTextures) const;
@@ -138,12 +165,21 @@ public:
 protected:
   BoundingBox bounds;
   MatrixTransform transform;
+
+private:
+  // intersect() for an object of the given type, which must be its own.
+  bool intersect(Type type, ray &r, isect &i) const;
+  template <typename T> bool intersectAs(ray &r, isect &i) const;
+
+  Type type;
 };
 
 // A SceneObject is a real actual thing that we want to model in the
 // world. It has extent (its Geometry heritage) and surface properties
 // (its material binding).
 class SceneObject : public Geometry {
+  friend class SceneSnapshot;
+
 public:
   const Material &getMaterial() const { return this->material; };
   void setMaterial(Material *m) { this->material = *m; };
@@ -151,11 +187,14 @@ public:
   void glDraw(int quality, bool actualMaterials, bool actualTextures) const;
 
 protected:
-  SceneObject(Scene *scene, Material *mat) : Geometry(scene), material{*mat} {}
+  SceneObject(Scene *scene, Material *mat, Type type = OTHER)
+      : Geometry(scene, type), material{*mat} {}
   Material material;
 };
 
 class Scene {
+  friend class SceneSnapshot;
+
 public:
   Scene();
   virtual ~Scene();
@@ -165,19 +204,49 @@ public:
   Scene(Scene &&other) = delete;
   Scene &operator=(Scene &&other) = delete;
 
-  // There is a special assumption for add(): we assume that the object
-  // referred to by the pointer was created with new and will be managed
-  // by this Scene (i.e. nothing else will call delete on the pointer).
-  // Violation of this assumption may lead to double free or corruption
+  // Geometry lives in the scene's arena and goes with it: create objects
+  // with make(), then add() them. Don't delete them, and don't add an
+  // object made by another scene. Lights are still created with new, and
+  // deleted by the Scene.
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    return arena.make<T>(std::forward<Args>(args)...);
+  }
   void add(Geometry *obj);
   void add(Light *light);
 
   bool intersect(ray &r, isect &i) const;
 
+  // Build the object and light BVHs now instead of on first use.
+  void buildAccelerators() const;
+
+  // Objects have been moved (Geometry::setTransform, Trimesh::setVertices)
+  // and their bounding boxes recomputed: bring the scene's bounds and BVH
+  // up to date; see SceneBVH::refit. Returns true if the BVH was rebuilt.
+  // Not to be called while a render is running.
+  bool refitAccelerators(double rebuildThreshold);
+
+  // Take the lights, ambient light and materials of other, which is this
+  // scene's file read again after its lights or materials were edited, so
+  // that a render of it can be relit (see RayTracer::relight). The objects
+  // and camera must be the same; returns false, with the reason in error
+  // and nothing changed, if they are not. Not to be called while a render
+  // is running.
+  bool takeShading(Scene &other, std::string &error);
+
+  // Compare with other, an edited copy of this scene, and list in changed
+  // the objects that were moved, reshaped or given another material.
+  // Returns false if anything else differs: the camera, lights or ambient
+  // light, or the number or kinds of objects.
+  bool changedObjects(const Scene &other, std::vector<int> &changed) const;
+
   auto beginLights() const { return lights.begin(); }
   auto endLights() const { return lights.end(); }
   const auto &getAllLights() const { return lights; }
 
+  // The lights worth shading at P; see LightBVH::collect.
+  void lightsAt(const glm::dvec3 &P, double cutoff, int maxLights,
+                std::vector<LightSample> &out) const;
+
   auto beginObjects() const { return objects.cbegin(); }
   auto endObjects() const { return objects.cend(); }
   const auto &getAllObjects() const { return objects; }
@@ -188,7 +257,7 @@ public:
   // For efficiency reasons, we'll store texture maps in a cache
   // in the Scene. This makes sure they get deleted when the scene
   // is destroyed.
-  TextureMap *getTexture(string name);
+  const TextureMap *getTexture(string name);
 
   // These two functions are for handling ambient light; in the Phong model, the
   // "ambient" light is considered a property of the _scene_ as a whole and
@@ -200,6 +269,10 @@ public:
 
   const BoundingBox &bounds() const { return sceneBounds; }
 
+  // Unique for every Scene created during the run, so per-thread caches
+  // holding pointers into a scene can tell when it has been replaced.
+  uint64_t id() const { return sceneId; }
+
 
 private:
   /* Do not try to access these members directly. If you need to iterate
@@ -212,6 +285,7 @@ private:
       If you need to search for something within objects or lights, use
       functions in <algorithms> like find() or count()
   */
+  Arena arena;
   std::vector<Geometry *> objects;
   std::vector<Light *> lights;
   Camera camera;
@@ -219,11 +293,14 @@ private:
   mutable SceneBVH bvh;
   mutable bool bvhBuilt = false;
 
+  mutable LightBVH lightBvh;
+  mutable bool lightBvhBuilt = false;
+
   // This is the total amount of ambient light in the scene
   // (used as the I_a in the Phong shading model)
   glm::dvec3 ambientIntensity;
 
-  typedef std::map<std::string, std::unique_ptr<TextureMap>> tmap;
+  typedef std::map<std::string, std::shared_ptr<const TextureMap>> tmap;
   tmap textureCache;
 
   // Each object in the scene that has a hasBoundingBoxCapability(),
@@ -231,25 +308,17 @@ private:
   // hasBoundingBoxCapability() are exempt from this requirement.
   BoundingBox sceneBounds;
 
+  uint64_t sceneId;
+
   KdTree<Geometry> *kdtree;
 
-  mutable std::mutex intersectionCacheMutex;
+  mutable DebugRayLog debugRays;
 
 public:
-  // This is used for debugging purposes only.
-  void addToIntersectCache(std::pair<ray *, isect *> isect) const {
-    intersectionCacheMutex.lock();
-    intersectCache.push_back(isect);
-    intersectionCacheMutex.unlock();
-  }
-
-  void clearIntersectCache() const {
-    intersectionCacheMutex.lock();
-    intersectCache.clear();
-    intersectionCacheMutex.unlock();
-  }
-
-  mutable std::vector<std::pair<ray *, isect *>> intersectCache;
+  // This is used for debugging purposes only: the rays intersect was
+  // called with while TraceUI::m_debug is on.
+  const DebugRayLog &getDebugRays() const { return debugRays; }
+  void clearDebugRays() const { debugRays.clearThread(); }
 };
 
 #endif // __SCENE_H__
@@ -0,0 +1,478 @@
+#include "snapshot.h"
+
+#include "../SceneObjects/Box.h"
+#include "../SceneObjects/Cone.h"
+#include "../SceneObjects/Cylinder.h"
+#include "../SceneObjects/Sphere.h"
+#include "../SceneObjects/Square.h"
+#include "../SceneObjects/trimesh.h"
+#include "../fileio/binaryio.h"
+#include "../fileio/mappedfile.h"
+#include "light.h"
+#include "scene.h"
+
+#include <cstring>
+#include <map>
+#include <memory>
+
+namespace {
+
+const char MAGIC[8] = {'R', 'A', 'Y', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t VERSION = 2;
+const uint32_t ENDIAN_MARK = 0x01020304;
+
+static_assert(sizeof(glm::dvec3) == 3 * sizeof(double),
+              "snapshots copy dvec3 arrays as raw doubles");
+static_assert(sizeof(glm::dvec2) == 2 * sizeof(double),
+              "snapshots copy dvec2 arrays as raw doubles");
+
+enum ObjectKind : uint8_t {
+  KIND_BOX = 1,
+  KIND_SPHERE,
+  KIND_SQUARE,
+  KIND_CYLINDER,
+  KIND_CONE,
+  KIND_TRIMESH
+};
+
+enum LightKind : uint8_t { KIND_DIRECTIONAL = 1, KIND_POINT };
+
+ObjectKind kindOf(const Geometry *obj) {
+  switch (obj->getType()) {
+  case Geometry::TRIMESH:
+    return KIND_TRIMESH;
+  case Geometry::BOX:
+    return KIND_BOX;
+  case Geometry::SPHERE:
+    return KIND_SPHERE;
+  case Geometry::SQUARE:
+    return KIND_SQUARE;
+  case Geometry::CYLINDER:
+    return KIND_CYLINDER;
+  case Geometry::CONE:
+    return KIND_CONE;
+  default:
+    return ObjectKind(0);
+  }
+}
+
+} // anonymous namespace
+
+// Everything that needs friend access lives in here.
+class SceneSnapshot::Codec {
+public:
+  typedef std::map<const TextureMap *, int32_t> TextureIndex;
+
+  static void putTexture(BinaryWriter &w, const std::string &name,
+                         const TextureMap &tex) {
+    w.putString(name);
+    w.put((int32_t)tex.width);
+    w.put((int32_t)tex.height);
+    w.put((uint64_t)tex.levels.size());
+    for (const TextureMap::MipLevel &level : tex.levels) {
+      w.put((int32_t)level.width);
+      w.put((int32_t)level.height);
+      w.putArray(level.texels);
+    }
+  }
+
+  static TextureMap *getTexture(BinaryReader &r, std::string &name) {
+    name = r.getString();
+    std::unique_ptr<TextureMap> tex(new TextureMap());
+    tex->width = r.get<int32_t>();
+    tex->height = r.get<int32_t>();
+    uint64_t count = r.get<uint64_t>();
+    if (!r.ok() || tex->width <= 0 || tex->height <= 0 || count == 0 ||
+        count > 64)
+      return nullptr;
+    std::vector<float> texels;
+    for (uint64_t k = 0; k < count; k++) {
+      int32_t w = r.get<int32_t>();
+      int32_t h = r.get<int32_t>();
+      r.getArray(texels);
+      if (!r.ok() || w <= 0 || h <= 0)
+        return nullptr;
+      int T = TextureMap::MipLevel::TILE;
+      uint64_t expected = (uint64_t)((w + T - 1) / T) * ((h + T - 1) / T) *
+                          T * T * 3;
+      if (texels.size() != expected)
+        return nullptr;
+      // The level's own constructor would allocate before we know the
+      // size is sane, so only build it once the texels are in hand.
+      tex->levels.emplace_back(1, 1);
+      TextureMap::MipLevel &level = tex->levels.back();
+      level.width = w;
+      level.height = h;
+      level.tilesX = (w + T - 1) / T;
+      level.texels.swap(texels);
+    }
+    if (tex->levels[0].width != tex->width ||
+        tex->levels[0].height != tex->height)
+      return nullptr;
+    return tex.release();
+  }
+
+  static bool putParameter(BinaryWriter &w, const MaterialParameter &p,
+                           const TextureIndex &textures) {
+    int32_t index = -1;
+    if (p._textureMap) {
+      auto found = textures.find(p._textureMap);
+      if (found == textures.end())
+        return false;
+      index = found->second;
+    }
+    w.put(p._value);
+    w.put(index);
+    return true;
+  }
+
+  static bool getParameter(BinaryReader &r, MaterialParameter &p,
+                           const std::vector<const TextureMap *> &textures) {
+    p._value = r.get<glm::dvec3>();
+    int32_t index = r.get<int32_t>();
+    if (index < -1 || index >= (int32_t)textures.size())
+      return false;
+    p._textureMap = index < 0 ? nullptr : textures[index];
+    return true;
+  }
+
+  static bool putMaterial(BinaryWriter &w, const Material &m,
+                          const TextureIndex &textures) {
+    for (const MaterialParameter *p : {&m._ke, &m._ka, &m._ks, &m._kd, &m._kr,
+                                       &m._kt, &m._shininess, &m._index})
+      if (!putParameter(w, *p, textures))
+        return false;
+    for (bool b : {m._refl, m._trans, m._recur, m._spec, m._both})
+      w.put((uint8_t)b);
+    return true;
+  }
+
+  static bool getMaterial(BinaryReader &r, Material &m,
+                          const std::vector<const TextureMap *> &textures) {
+    for (MaterialParameter *p : {&m._ke, &m._ka, &m._ks, &m._kd, &m._kr,
+                                 &m._kt, &m._shininess, &m._index})
+      if (!getParameter(r, *p, textures))
+        return false;
+    for (bool *b : {&m._refl, &m._trans, &m._recur, &m._spec, &m._both})
+      *b = r.get<uint8_t>() != 0;
+    return true;
+  }
+
+  static void putTrimesh(BinaryWriter &w, const Trimesh &t) {
+    std::vector<int32_t> ids;
+    ids.reserve(t.faces.size() * 3);
+    for (const TrimeshFace *f : t.faces)
+      for (int k = 0; k < 3; k++)
+        ids.push_back((*f)[k]);
+    std::vector<PackedBVHNode> packed;
+    packBVHNodes(t.bvh.nodes, packed);
+
+    w.put((uint8_t)t.vertNorms);
+    w.put((uint8_t)t.generatedNormals);
+    w.putArray(t.vertices);
+    w.putArray(t.normals);
+    w.putArray(t.uvCoords);
+    w.putArray(t.vertColors);
+    w.putArray(ids);
+    w.putBox(t.localBounds);
+    w.put((uint8_t)t.bvh.built);
+    w.putArray(packed);
+    w.putArray(t.bvh.faceOrder);
+  }
+
+  static bool getTrimesh(BinaryReader &r, Trimesh &t) {
+    std::vector<int32_t> ids;
+    std::vector<PackedBVHNode> packed;
+    t.vertNorms = r.get<uint8_t>() != 0;
+    t.generatedNormals = r.get<uint8_t>() != 0;
+    r.getArray(t.vertices);
+    r.getArray(t.normals);
+    r.getArray(t.uvCoords);
+    r.getArray(t.vertColors);
+    r.getArray(ids);
+    t.localBounds = r.getBox();
+    bool built = r.get<uint8_t>() != 0;
+    r.getArray(packed);
+    r.getArray(t.bvh.faceOrder);
+    if (!r.ok() || ids.size() % 3 != 0)
+      return false;
+
+    size_t nverts = t.vertices.size();
+    size_t nfaces = ids.size() / 3;
+    for (int32_t id : ids)
+      if (id < 0 || (size_t)id >= nverts)
+        return false;
+    if (built) {
+      if (t.bvh.faceOrder.size() != nfaces || !validBVHNodes(packed, nfaces))
+        return false;
+      for (int32_t f : t.bvh.faceOrder)
+        if (f < 0 || (size_t)f >= nfaces)
+          return false;
+    }
+
+    t.faces.reserve(nfaces);
+    t.faceArena.reserve(nfaces * sizeof(TrimeshFace));
+    for (size_t f = 0; f < nfaces; f++)
+      t.faces.push_back(
+          t.makeFace(ids[3 * f], ids[3 * f + 1], ids[3 * f + 2]));
+    if (built) {
+      unpackBVHNodes(packed, t.bvh.nodes);
+      t.bvh.resolveFaces(t.faces);
+      t.bvh.built = true;
+    }
+    return true;
+  }
+
+  static bool save(const Scene &scene, BinaryWriter &w, std::string &error) {
+    w.putBytes(MAGIC, sizeof(MAGIC));
+    w.put(VERSION);
+    w.put(ENDIAN_MARK);
+
+    TextureIndex textures;
+    w.put((uint64_t)scene.textureCache.size());
+    for (const auto &entry : scene.textureCache) {
+      int32_t index = (int32_t)textures.size();
+      textures[entry.second.get()] = index;
+      putTexture(w, entry.first, *entry.second);
+    }
+
+    const Camera &c = scene.camera;
+    w.put(c.m);
+    w.put(c.normalizedHeight);
+    w.put(c.aspectRatio);
+    w.put(c.eye);
+    w.put(c.look);
+    w.put(c.u);
+    w.put(c.v);
+
+    w.put(scene.ambientIntensity);
+    w.putBox(scene.sceneBounds);
+
+    w.put((uint64_t)scene.lights.size());
+    for (const Light *light : scene.lights) {
+      if (auto *d = dynamic_cast<const DirectionalLight *>(light)) {
+        w.put(KIND_DIRECTIONAL);
+        w.put(d->orientation);
+      } else if (auto *p = dynamic_cast<const PointLight *>(light)) {
+        w.put(KIND_POINT);
+        w.put(p->position);
+        w.put(p->constantTerm);
+        w.put(p->linearTerm);
+        w.put(p->quadraticTerm);
+      } else {
+        error = "the scene has a kind of light snapshots can't store";
+        return false;
+      }
+      w.put(light->color);
+      w.put(light->cutoff);
+    }
+
+    w.put((uint64_t)scene.objects.size());
+    for (const Geometry *obj : scene.objects) {
+      ObjectKind kind = kindOf(obj);
+      if (!kind) {
+        error = "the scene has a kind of object snapshots can't store";
+        return false;
+      }
+      w.put(kind);
+      w.put(obj->transform.transform());
+      w.putBox(obj->bounds);
+      // Every kind above is a SceneObject.
+      const SceneObject *so = static_cast<const SceneObject *>(obj);
+      if (!putMaterial(w, so->material, textures)) {
+        error = "a material uses a texture the scene does not own";
+        return false;
+      }
+
+      switch (kind) {
+      case KIND_CYLINDER:
+        w.put((uint8_t) static_cast<const Cylinder *>(obj)->capped);
+        break;
+      case KIND_CONE: {
+        const Cone *cone = static_cast<const Cone *>(obj);
+        w.put((uint8_t)cone->capped);
+        for (double v : {cone->height, cone->b_radius, cone->t_radius,
+                         cone->beta, cone->beta_squared, cone->gamma,
+                         cone->gamma_squared})
+          w.put(v);
+        break;
+      }
+      case KIND_TRIMESH:
+        putTrimesh(w, *static_cast<const Trimesh *>(obj));
+        break;
+      default:
+        break;
+      }
+    }
+
+    std::vector<PackedBVHNode> packed;
+    packBVHNodes(scene.bvh.nodes, packed);
+    w.putArray(packed);
+    w.putArray(scene.bvh.objectOrder);
+    return true;
+  }
+
+  static Scene *load(BinaryReader &r, std::string &error) {
+    char magic[sizeof(MAGIC)];
+    r.getBytes(magic, sizeof(magic));
+    if (!r.ok() || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+      error = "not a scene snapshot";
+      return nullptr;
+    }
+    uint32_t version = r.get<uint32_t>();
+    if (version != VERSION) {
+      error = "snapshot format version " + std::to_string(version) +
+              " is not supported (expected " + std::to_string(VERSION) + ")";
+      return nullptr;
+    }
+    if (r.get<uint32_t>() != ENDIAN_MARK) {
+      error = "snapshot was written on a machine with another byte order";
+      return nullptr;
+    }
+    error = "snapshot is truncated or damaged";
+
+    std::unique_ptr<Scene> scene(new Scene());
+
+    uint64_t ntextures = r.get<uint64_t>();
+    std::vector<const TextureMap *> textures;
+    for (uint64_t k = 0; k < ntextures && r.ok(); k++) {
+      std::string name;
+      TextureMap *tex = getTexture(r, name);
+      if (!tex)
+        return nullptr;
+      scene->textureCache[name] = std::shared_ptr<const TextureMap>(tex);
+      textures.push_back(tex);
+    }
+
+    Camera &c = scene->camera;
+    c.m = r.get<glm::dmat3>();
+    c.normalizedHeight = r.get<double>();
+    c.aspectRatio = r.get<double>();
+    c.eye = r.get<glm::dvec3>();
+    c.look = r.get<glm::dvec3>();
+    c.u = r.get<glm::dvec3>();
+    c.v = r.get<glm::dvec3>();
+
+    scene->ambientIntensity = r.get<glm::dvec3>();
+    scene->sceneBounds = r.getBox();
+
+    uint64_t nlights = r.get<uint64_t>();
+    for (uint64_t k = 0; k < nlights && r.ok(); k++) {
+      Light *light;
+      switch (r.get<uint8_t>()) {
+      case KIND_DIRECTIONAL: {
+        glm::dvec3 orientation = r.get<glm::dvec3>();
+        DirectionalLight *d =
+            new DirectionalLight(scene.get(), glm::dvec3(0, 0, 1), glm::dvec3());
+        d->orientation = orientation;
+        light = d;
+        break;
+      }
+      case KIND_POINT: {
+        glm::dvec3 position = r.get<glm::dvec3>();
+        float a = r.get<float>();
+        float b = r.get<float>();
+        float q = r.get<float>();
+        light = new PointLight(scene.get(), position, glm::dvec3(), a, b, q);
+        break;
+      }
+      default:
+        return nullptr;
+      }
+      scene->add(light);
+      light->color = r.get<glm::dvec3>();
+      light->cutoff = r.get<double>();
+    }
+
+    uint64_t nobjects = r.get<uint64_t>();
+    for (uint64_t k = 0; k < nobjects && r.ok(); k++) {
+      uint8_t kind = r.get<uint8_t>();
+      MatrixTransform transform(r.get<glm::dmat4>());
+      BoundingBox bounds = r.getBox();
+      Material mat;
+      if (!getMaterial(r, mat, textures))
+        return nullptr;
+
+      SceneObject *obj;
+      switch (kind) {
+      case KIND_BOX:
+        obj = scene->make<Box>(scene.get(), &mat);
+        break;
+      case KIND_SPHERE:
+        obj = scene->make<Sphere>(scene.get(), &mat);
+        break;
+      case KIND_SQUARE:
+        obj = scene->make<Square>(scene.get(), &mat);
+        break;
+      case KIND_CYLINDER: {
+        Cylinder *cyl = scene->make<Cylinder>(scene.get(), &mat);
+        cyl->capped = r.get<uint8_t>() != 0;
+        obj = cyl;
+        break;
+      }
+      case KIND_CONE: {
+        Cone *cone = scene->make<Cone>(scene.get(), &mat);
+        cone->capped = r.get<uint8_t>() != 0;
+        for (double *v : {&cone->height, &cone->b_radius, &cone->t_radius,
+                          &cone->beta, &cone->beta_squared, &cone->gamma,
+                          &cone->gamma_squared})
+          *v = r.get<double>();
+        obj = cone;
+        break;
+      }
+      case KIND_TRIMESH:
+        obj = scene->make<Trimesh>(scene.get(), &mat, transform);
+        break;
+      default:
+        return nullptr;
+      }
+      // Owned by the scene from here on, so failures below don't leak it.
+      scene->objects.push_back(obj);
+      obj->transform = transform;
+      obj->bounds = bounds;
+      if (kind == KIND_TRIMESH && !getTrimesh(r, *static_cast<Trimesh *>(obj)))
+        return nullptr;
+    }
+
+    std::vector<PackedBVHNode> packed;
+    SceneBVH &bvh = scene->bvh;
+    r.getArray(packed);
+    r.getArray(bvh.objectOrder);
+    if (!r.ok() || bvh.objectOrder.size() != scene->objects.size() ||
+        !validBVHNodes(packed, bvh.objectOrder.size()))
+      return nullptr;
+    for (int32_t o : bvh.objectOrder)
+      if (o < 0 || (size_t)o >= scene->objects.size())
+        return nullptr;
+    unpackBVHNodes(packed, bvh.nodes);
+    bvh.resolveObjects(scene->objects);
+    scene->bvhBuilt = !bvh.nodes.empty();
+
+    error.clear();
+    return scene.release();
+  }
+};
+
+bool SceneSnapshot::save(const Scene &scene, const std::string &path,
+                         std::string &error) {
+  scene.buildAccelerators();
+
+  BinaryWriter w;
+  if (!Codec::save(scene, w, error))
+    return false;
+  if (!writeFileAtomically(path, w.bytes.data(), w.bytes.size())) {
+    error = "could not write " + path;
+    return false;
+  }
+  return true;
+}
+
+Scene *SceneSnapshot::load(const std::string &path, std::string &error) {
+  MappedFile file(path);
+  if (!file.isOpen()) {
+    error = "could not read " + path;
+    return nullptr;
+  }
+  BinaryReader r(file.data(), file.size());
+  return Codec::load(r, error);
+}
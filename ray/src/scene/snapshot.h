@@ -0,0 +1,38 @@
+#ifndef SCENE_SNAPSHOT_H
+#define SCENE_SNAPSHOT_H
+
+#include <string>
+
+class Scene;
+
+/*
+ * Binary snapshot of a fully built Scene: camera, lights, materials,
+ * transforms, primitive data, the flattened scene and trimesh BVHs, and
+ * the decoded pixels (with mip chains) of every texture. Loading one skips
+ * parsing, image decoding and BVH construction; the file is mapped and the
+ * big arrays are copied straight out of it.
+ *
+ * The format is versioned and carries an endianness mark. Snapshots are a
+ * cache, not an interchange format: a file from another version, another
+ * kind of machine, or one that is damaged, is refused rather than read.
+ *
+ * The light BVH is not stored; it is cheap to rebuild and is built on
+ * first use as usual. Neither is the cubemap, which is a render setting
+ * rather than part of the scene.
+ */
+class SceneSnapshot {
+public:
+  // Build the scene's acceleration structures if need be and write it to
+  // path. Returns false, with the reason in error, if it can't.
+  static bool save(const Scene &scene, const std::string &path,
+                   std::string &error);
+
+  // Read a scene back. Returns null, with the reason in error, on failure.
+  // The caller owns the result.
+  static Scene *load(const std::string &path, std::string &error);
+
+private:
+  class Codec;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "textureCache.h"
+#include "material.h"
+
+#include <iterator>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+TextureCache &TextureCache::instance() {
+  static TextureCache cache;
+  return cache;
+}
+
+// Identify a file by its path and when it was last written.
+static std::string cacheKey(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return path;
+  return path + "@" + std::to_string((long long)st.st_mtime);
+}
+
+std::shared_ptr<const TextureMap> TextureCache::get(const std::string &path) {
+  std::string key = cacheKey(path);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto found = index.find(key);
+    if (found != index.end()) {
+      lru.splice(lru.begin(), lru, found->second);
+      return found->second->image;
+    }
+  }
+
+  // Decode outside the lock so other threads can use the cache meanwhile.
+  // Two threads missing on the same file both decode it; the second one
+  // to finish simply adopts the first one's copy.
+  std::shared_ptr<const TextureMap> image = std::make_shared<TextureMap>(path);
+
+  std::lock_guard<std::mutex> guard(lock);
+  auto found = index.find(key);
+  if (found != index.end()) {
+    lru.splice(lru.begin(), lru, found->second);
+    return found->second->image;
+  }
+
+  // An older version of the file is of no more use.
+  auto stale = keyOf.find(path);
+  if (stale != keyOf.end())
+    erase(index.at(stale->second));
+
+  size_t bytes = image->memoryUsage();
+  lru.push_front({path, key, image, bytes});
+  index[key] = lru.begin();
+  keyOf[path] = key;
+  usage += bytes;
+  evict();
+  return image;
+}
+
+size_t TextureCache::getBudget() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return budget;
+}
+
+size_t TextureCache::getUsage() const {
+  std::lock_guard<std::mutex> guard(lock);
+  return usage;
+}
+
+void TextureCache::setBudget(size_t bytes) {
+  std::lock_guard<std::mutex> guard(lock);
+  budget = bytes;
+  evict();
+}
+
+void TextureCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+  lru.clear();
+  index.clear();
+  keyOf.clear();
+  usage = 0;
+}
+
+// Drop least recently used images until we are within budget. The image
+// just added is never dropped, even if it alone is over budget.
+void TextureCache::evict() {
+  while (usage > budget && lru.size() > 1)
+    erase(std::prev(lru.end()));
+}
+
+void TextureCache::erase(std::list<Entry>::iterator entry) {
+  usage -= entry->bytes;
+  index.erase(entry->key);
+  keyOf.erase(entry->path);
+  lru.erase(entry);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class TextureMap;
+
+// Process-wide cache of decoded texture images, shared by every scene and
+// by the cubemap loaders. Entries are keyed by path and modification time,
+// so editing an image on disk makes the next load decode it afresh (and
+// drop the stale copy).
+//
+// Images are immutable once decoded and handed out by shared_ptr. When the
+// decoded size of the cached images exceeds the budget, the least recently
+// used ones are dropped from the cache; anyone still holding one keeps it
+// alive until they let go.
+class TextureCache {
+public:
+  static TextureCache &instance();
+
+  // Decoded image for path. Throws TextureMapException if it cannot be
+  // loaded.
+  std::shared_ptr<const TextureMap> get(const std::string &path);
+
+  void setBudget(size_t bytes);
+  size_t getBudget() const;
+  size_t getUsage() const;
+
+  void clear();
+
+private:
+  TextureCache() = default;
+
+  struct Entry {
+    std::string path;
+    std::string key;
+    std::shared_ptr<const TextureMap> image;
+    size_t bytes;
+  };
+
+  void evict();
+  void erase(std::list<Entry>::iterator entry);
+
+  mutable std::mutex lock;
+  std::list<Entry> lru; // most recently used first
+  std::map<std::string, std::list<Entry>::iterator> index;
+  std::map<std::string, std::string> keyOf; // path -> key of its entry
+  size_t budget = size_t(256) << 20;
+  size_t usage = 0;
+};
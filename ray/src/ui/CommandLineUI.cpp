@@ -1,6 +1,14 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <signal.h>
 #include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
+#include <vector>
 #ifndef _MSC_VER
 #include <unistd.h>
 #else
@@ -12,12 +20,25 @@ extern int getopt(int argc, char **argv, const char *optstring);
 #include <assert.h>
 
 #include "../fileio/images.h"
+#include "../fileio/mappedfile.h"
+#include "../fileio/pngstream.h"
+#include "../scene/animation.h"
 #include "CommandLineUI.h"
+#include "RenderCoordinator.h"
+#include "RenderServer.h"
 
 #include "../RayTracer.h"
 
 using namespace std;
 
+// Where ^C and the like stop the render, so a checkpoint can be saved.
+static std::atomic<bool> *stopFlag = nullptr;
+
+static void stopRender(int) {
+  if (stopFlag)
+    *stopFlag = true;
+}
+
 // The command line UI simply parses out all the arguments off
 // the command line and stores them locally.
 CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
@@ -25,7 +46,129 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
   progName = argv[0];
   const char *jsonfile = nullptr;
   string cubemap_file;
-  while ((i = getopt(argc, argv, "tr:w:hj:c:")) != EOF) {
+  bool passLimit = false, otherLimit = false;
+  string regionArg, tileArg;
+  string workersArg, workerCmd, timeoutArg, intervalArg;
+
+  // getopt doesn't do long options portably, so take ours out first and
+  // hand it the rest.
+  std::vector<char *> args(argv, argv + argc);
+  for (auto arg = args.begin() + 1; arg != args.end();) {
+    string *target = nullptr;
+    if (!strcmp(*arg, "--save-snapshot"))
+      target = &snapshotOut;
+    else if (!strcmp(*arg, "--load-snapshot"))
+      target = &snapshotIn;
+    else if (!strcmp(*arg, "--region"))
+      target = &regionArg;
+    else if (!strcmp(*arg, "--tile"))
+      target = &tileArg;
+    else if (!strcmp(*arg, "--workers"))
+      target = &workersArg;
+    else if (!strcmp(*arg, "--worker-cmd"))
+      target = &workerCmd;
+    else if (!strcmp(*arg, "--tile-timeout"))
+      target = &timeoutArg;
+    else if (!strcmp(*arg, "--server"))
+      target = &serverSocket;
+    else if (!strcmp(*arg, "--checkpoint"))
+      target = &checkpointPath;
+    else if (!strcmp(*arg, "--checkpoint-interval"))
+      target = &intervalArg;
+    else if (!strcmp(*arg, "--sequence"))
+      target = &sequencePath;
+    else if (!strcmp(*arg, "--resume")) {
+      resume = true;
+      arg = args.erase(arg);
+      continue;
+    }
+    else if (!strcmp(*arg, "--worker")) {
+      workerMode = true;
+      arg = args.erase(arg);
+      continue;
+    } else if (!strcmp(*arg, "--"))
+      break;
+    if (!target) {
+      ++arg;
+      continue;
+    }
+    if (arg + 1 == args.end()) {
+      std::cerr << *arg << " needs an argument." << std::endl;
+      usage();
+      exit(1);
+    }
+    *target = *(arg + 1);
+    if (target == &workerCmd)
+      workerCmds.push_back(workerCmd);
+    arg = args.erase(arg, arg + 2);
+  }
+  argc = (int)args.size();
+  args.push_back(nullptr);
+  argv = args.data();
+
+  if (!regionArg.empty() && !tileArg.empty()) {
+    std::cerr << "--region and --tile can't be used together." << std::endl;
+    exit(1);
+  }
+  if (!regionArg.empty()) {
+    char end;
+    hasRegion = sscanf(regionArg.c_str(), "%d,%d,%d,%d%c", &region[0],
+                       &region[1], &region[2], &region[3], &end) == 4;
+    if (!hasRegion || region[0] < 0 || region[1] < 0 ||
+        region[2] <= region[0] || region[3] <= region[1]) {
+      std::cerr << "Bad --region '" << regionArg << "', expected x0,y0,x1,y1."
+                << std::endl;
+      exit(1);
+    }
+  }
+  if (!workersArg.empty()) {
+    localWorkers = atoi(workersArg.c_str());
+    if (localWorkers < 1) {
+      std::cerr << "--workers needs a number of workers." << std::endl;
+      exit(1);
+    }
+  }
+  if (!timeoutArg.empty())
+    tileTimeout = atof(timeoutArg.c_str());
+  if (!intervalArg.empty())
+    checkpointInterval = atof(intervalArg.c_str());
+  if (resume && checkpointPath.empty()) {
+    std::cerr << "--resume needs the --checkpoint to resume from."
+              << std::endl;
+    exit(1);
+  }
+  if (!checkpointPath.empty() &&
+      (localWorkers || !workerCmds.empty() || workerMode)) {
+    std::cerr << "--checkpoint can't be used with worker processes."
+              << std::endl;
+    exit(1);
+  }
+  if (!sequencePath.empty() &&
+      (localWorkers || !workerCmds.empty() || workerMode ||
+       !checkpointPath.empty())) {
+    std::cerr << "--sequence can't be used with worker processes or "
+                 "--checkpoint."
+              << std::endl;
+    exit(1);
+  }
+  if ((localWorkers || !workerCmds.empty()) &&
+      (!regionArg.empty() || !tileArg.empty() || !snapshotOut.empty())) {
+    std::cerr << "--workers and --worker-cmd render the whole frame, and "
+                 "can't be used with --region, --tile or --save-snapshot."
+              << std::endl;
+    exit(1);
+  }
+  if (!tileArg.empty()) {
+    char end;
+    if (sscanf(tileArg.c_str(), "%d/%d%c", &tileIndex, &tileCount, &end) != 2 ||
+        tileCount < 1 || tileIndex < 0 || tileIndex >= tileCount) {
+      std::cerr << "Bad --tile '" << tileArg << "', expected i/N with "
+                << "0 <= i < N." << std::endl;
+      exit(1);
+    }
+  }
+
+  while ((i = getopt(argc, argv, "tr:w:hj:c:SspT:n:e:ax:m:")) != EOF) {
     switch (i) {
     case 'r':
       m_nDepth = atoi(optarg);
@@ -39,6 +182,44 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
     case 'c':
       cubemap_file = optarg;
       break;
+    case 'S':
+      m_raySorting = true;
+      break;
+    case 's':
+      m_stats = true;
+      break;
+    case 'p':
+      m_progressive = true;
+      break;
+    case 'T':
+      m_progressive = true;
+      m_progressiveTime = atof(optarg);
+      otherLimit = true;
+      break;
+    case 'n':
+      m_progressive = true;
+      m_progressiveSamples = atoi(optarg);
+      passLimit = true;
+      break;
+    case 'e':
+      m_progressive = true;
+      m_progressiveTolerance = atof(optarg);
+      otherLimit = true;
+      break;
+    case 'a':
+      m_aovs = true;
+      break;
+    case 'x':
+      m_exposure = atof(optarg);
+      break;
+    case 'm':
+      m_toneMap = optarg;
+      if (m_toneMap != "clamp" && m_toneMap != "reinhard") {
+        std::cerr << "Unknown tone curve '" << m_toneMap << "'." << std::endl;
+        usage();
+        exit(1);
+      }
+      break;
     case 'h':
       usage();
       exit(1);
@@ -49,6 +230,10 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
       exit(1);
     }
   }
+  // Given a time or error target, don't also stop at the default number
+  // of passes.
+  if (otherLimit && !passLimit)
+    m_progressiveSamples = 0;
   if (jsonfile) {
     loadFromJson(jsonfile);
   }
@@ -56,30 +241,203 @@ CommandLineUI::CommandLineUI(int argc, char **argv) : TraceUI() {
     smartLoadCubemap(cubemap_file);
   }
 
-  if (optind >= argc - 1) {
+  // A server is told what to load and render by its clients.
+  if (!serverSocket.empty()) {
+    if (localWorkers || !workerCmds.empty() || workerMode ||
+        !regionArg.empty() || !tileArg.empty() || !snapshotIn.empty() ||
+        !snapshotOut.empty() || !checkpointPath.empty() ||
+        !sequencePath.empty() || optind < argc) {
+      std::cerr << "--server takes no scene, image, or options about "
+                   "either; clients give those."
+                << std::endl;
+      exit(1);
+    }
+    rayName = imgName = nullptr;
+    return;
+  }
+
+  // Workers get the options we got, with the scene to load.
+  workerArgs.assign(argv + 1, argv + optind);
+  if (!snapshotIn.empty()) {
+    workerArgs.push_back("--load-snapshot");
+    workerArgs.push_back(snapshotIn);
+  }
+
+  // A loaded snapshot takes the place of the scene file, and when saving
+  // one the image is optional. A worker has no image.
+  rayName = nullptr;
+  if (snapshotIn.empty() && optind < argc)
+    rayName = argv[optind++];
+  if (rayName)
+    workerArgs.push_back(rayName);
+  imgName = optind < argc ? argv[optind] : nullptr;
+  if ((snapshotIn.empty() && !rayName) ||
+      (!imgName && snapshotOut.empty() && !workerMode)) {
     std::cerr << "no input and/or output name." << std::endl;
     exit(1);
   }
+}
+
+// What a checkpoint records as the scene: the file it came from and a
+// hash of its contents, so one isn't resumed after the scene is edited.
+string CommandLineUI::sceneTag() const {
+  string path = snapshotIn.empty() ? string(rayName) : snapshotIn;
+  MappedFile file(path);
+  char hash[32];
+  snprintf(hash, sizeof hash, "%016llx",
+           file.isOpen()
+               ? (unsigned long long)fnv1a64(file.data(), file.size())
+               : 0ull);
+  return path + " " + hash;
+}
+
+// The argv of each worker process: this program, or a --worker-cmd run
+// by the shell, with our options.
+std::vector<std::vector<string>> CommandLineUI::workerCommands() const {
+  string self = progName;
+#ifdef __linux__
+  char path[4096];
+  ssize_t n = readlink("/proc/self/exe", path, sizeof path - 1);
+  if (n > 0)
+    self.assign(path, n);
+#endif
+  std::vector<string> args{"--worker"};
+  args.insert(args.end(), workerArgs.begin(), workerArgs.end());
 
-  rayName = argv[optind];
-  imgName = argv[optind + 1];
+  std::vector<std::vector<string>> commands;
+  for (int w = 0; w < localWorkers; w++) {
+    commands.push_back({self});
+    commands.back().insert(commands.back().end(), args.begin(), args.end());
+  }
+  for (const string &cmd : workerCmds) {
+    string line = cmd;
+    for (const string &arg : args) {
+      // Quote for the shell: 'it'\''s' is it's.
+      line += " '";
+      for (char c : arg)
+        line += c == '\'' ? string("'\\''") : string(1, c);
+      line += "'";
+    }
+    commands.push_back({"/bin/sh", "-c", line});
+  }
+  return commands;
 }
 
 int CommandLineUI::run() {
   assert(raytracer != 0);
-  raytracer->loadScene(rayName);
+  if (!serverSocket.empty()) {
+    string error;
+    RenderServer server(serverSocket, getThreads());
+    if (!server.run(error)) {
+      alert("Error: render server failed: " + error);
+      return 1;
+    }
+    return 0;
+  }
+  if (localWorkers || !workerCmds.empty()) {
+    // The workers load the scene; we never need to.
+    string error;
+    RenderCoordinator coordinator(workerCommands(), tileTimeout);
+    if (!coordinator.render(imgName, error)) {
+      alert("Error: distributed render failed: " + error);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (snapshotIn.empty())
+    raytracer->loadScene(rayName);
+  else
+    raytracer->loadSnapshot(snapshotIn.c_str());
+
+  if (raytracer->sceneLoaded() && !snapshotOut.empty()) {
+    if (!raytracer->saveSnapshot(snapshotOut.c_str()))
+      return 1;
+    if (!imgName)
+      return 0;
+  }
 
   if (raytracer->sceneLoaded()) {
     int width = m_nSize;
     int height = (int)(width / raytracer->aspectRatio() + 0.5);
 
+    if (workerMode)
+      return runTileWorker(raytracer, width, height);
+
+    // A tile is a horizontal strip: tile i of N covers rows i*h/N up to
+    // (i+1)*h/N, counted from the top.
+    if (tileCount) {
+      hasRegion = true;
+      region[0] = 0;
+      region[1] = (int)((long long)height * tileIndex / tileCount);
+      region[2] = width;
+      region[3] = (int)((long long)height * (tileIndex + 1) / tileCount);
+    }
+    if (hasRegion) {
+      if (region[2] > width || region[3] > height ||
+          region[1] >= region[3]) {
+        std::cerr << "The region to render must be inside the " << width
+                  << "x" << height << " frame." << std::endl;
+        return 1;
+      }
+      raytracer->setRegion(region[0], region[1], region[2], region[3]);
+      if (!recordsWindow(imgName))
+        std::cerr << "Warning: only png and exr files record where a region "
+                     "goes in the frame."
+                  << std::endl;
+    }
+
+    if (!sequencePath.empty())
+      return renderSequence(width, height);
+
     raytracer->traceSetup(width, height);
 
+    if (!checkpointPath.empty()) {
+      raytracer->setCheckpoint(checkpointPath, checkpointInterval, sceneTag());
+      string error;
+      if (resume && !ifstream(checkpointPath)) {
+        std::cerr << "No checkpoint at " << checkpointPath
+                  << " yet; starting from the beginning." << std::endl;
+      } else if (resume && !raytracer->resumeFrom(checkpointPath, error)) {
+        alert("Error: can't resume from " + checkpointPath + ": " + error);
+        return 1;
+      }
+      stopFlag = &raytracer->stopTrace;
+      signal(SIGINT, stopRender);
+      signal(SIGTERM, stopRender);
+    }
+
+    // The size of the part being rendered.
+    unsigned char *buf;
+    int outWidth, outHeight;
+    raytracer->getBuffer(buf, outWidth, outHeight);
+    ImageWindow window;
+    if (hasRegion)
+      window = raytracer->window();
+
+    // A PNG is compressed band by band while the rest is still tracing,
+    // rather than all at the end.
+    std::unique_ptr<PNGStreamWriter> png;
+    string error;
+    if (isPNGImage(imgName)) {
+      png.reset(new PNGStreamWriter(imgName, outWidth, outHeight, window));
+      if (!png->ok()) {
+        png->finish(error);
+        alert("Error: couldn't save image: " + error);
+        return 1;
+      }
+      raytracer->setRowsDone([&](int y0, int y1) {
+        std::vector<unsigned char> rows = raytracer->exportRows(y0, y1);
+        png->addRows(y0, y1, rows.data());
+      });
+    }
+
     clock_t start, end;
     start = clock();
 
     raytracer->traceImage(width, height);
     raytracer->waitRender();
+    raytracer->setRowsDone(nullptr);
     if (aaSwitch()) {
       raytracer->aaImage();
       raytracer->waitRender();
@@ -87,36 +445,195 @@ int CommandLineUI::run() {
 
     end = clock();
 
-    // save image
-    unsigned char *buf;
-
-    raytracer->getBuffer(buf, width, height);
+    if (raytracer->stopTrace) {
+      // Whatever of the image was written is incomplete. Other formats
+      // haven't been written at all, so a file by that name isn't ours.
+      if (png) {
+        png.reset();
+        remove(imgName);
+      }
+      std::cerr << "Render stopped; resume it with --resume --checkpoint "
+                << checkpointPath << std::endl;
+      return 1;
+    }
 
-    if (buf)
-      writeImage(imgName, width, height, buf);
+    // save image
+    if (png) {
+      if (!png->finish(error)) {
+        alert("Error: couldn't save image: " + error);
+        return 1;
+      }
+    } else if (!raytracer->saveImage(imgName)) {
+      return 1;
+    }
+    // The image is safely out; the checkpoint has served its purpose.
+    if (!checkpointPath.empty())
+      remove(checkpointPath.c_str());
 
-    [[maybe_unused]] double t = (double)(end - start) / CLOCKS_PER_SEC;
-    //		int totalRays = TraceUI::resetCount();
-    //		std::cout << "total time = " << t << " seconds,
-    // rays traced = " << totalRays << std::endl;
+    double t = (double)(end - start) / CLOCKS_PER_SEC;
+    if (m_stats) {
+      long long visits = TraceUI::getStat(TraceUI::BVH_NODE_VISITS);
+      long long misses = TraceUI::getStat(TraceUI::BVH_NODE_MISSES);
+      std::cout << "total time = " << t << " seconds" << std::endl
+                << "bvh nodes visited = " << visits
+                << ", simulated cache misses = " << misses << " ("
+                << (visits ? 100.0 * misses / visits : 0.0) << "%)"
+                << std::endl
+                << "secondary rays sorted = "
+                << TraceUI::getStat(TraceUI::SORTED_RAYS) << std::endl
+                << "shadow rays = " << TraceUI::getStat(TraceUI::SHADOW_QUERIES)
+                << ", answered by last occluder = "
+                << TraceUI::getStat(TraceUI::SHADOW_CACHE_HITS) << std::endl
+                << "lights shaded = "
+                << TraceUI::getStat(TraceUI::LIGHTS_SHADED) << std::endl;
+      if (m_progressive)
+        std::cout << "samples per pixel = " << raytracer->samplesDone()
+                  << std::endl;
+    }
     return 0;
+  } else if (!snapshotIn.empty()) {
+    std::cerr << "Unable to load snapshot '" << snapshotIn << "'" << std::endl;
+    return (1);
   } else {
     std::cerr << "Unable to load ray file '" << rayName << "'" << std::endl;
     return (1);
   }
 }
 
+// The image name for a frame of a sequence: imgName with a printf-style
+// %d (with optional zero padding and width) replaced by the frame number,
+// or with the number, four digits, before the extension if it has none.
+static string frameName(const string &pattern, int frame) {
+  size_t pct = pattern.find('%');
+  if (pct != string::npos) {
+    size_t d = pattern.find_first_not_of("0123456789", pct + 1);
+    if (d != string::npos && pattern[d] == 'd') {
+      char number[32];
+      string spec = pattern.substr(pct, d + 1 - pct);
+      snprintf(number, sizeof number, spec.c_str(), frame);
+      return pattern.substr(0, pct) + number + pattern.substr(d + 1);
+    }
+  }
+  char number[32];
+  snprintf(number, sizeof number, ".%04d", frame);
+  size_t dot = pattern.find_last_of('.');
+  if (dot == string::npos ||
+      pattern.find_first_of("\\/", dot) != string::npos)
+    return pattern + number;
+  return pattern.substr(0, dot) + number + pattern.substr(dot);
+}
+
+// Render every frame of the --sequence in turn, moving the scene between
+// them instead of loading it again.
+int CommandLineUI::renderSequence(int width, int height) {
+  string error;
+  std::unique_ptr<SceneAnimation> anim(
+      SceneAnimation::load(sequencePath, error));
+  if (!anim || !anim->bind(*raytracer->sharedScene(), error)) {
+    alert("Error: can't use sequence " + sequencePath + ": " + error);
+    return 1;
+  }
+
+  for (int frame = 0; frame < anim->frames(); frame++) {
+    auto start = std::chrono::steady_clock::now();
+    SceneAnimation::FrameStats moved = anim->apply(frame);
+    raytracer->traceImage(width, height);
+    raytracer->waitRender();
+    string name = frameName(imgName, frame);
+    if (!raytracer->saveImage(name.c_str()))
+      return 1;
+    if (m_stats) {
+      std::chrono::duration<double> t =
+          std::chrono::steady_clock::now() - start;
+      std::cout << name << ": " << t.count() << " seconds, scene bvh "
+                << (moved.sceneRebuilt ? "rebuilt" : "refit") << ", meshes "
+                << moved.meshesRefit << " refit, " << moved.meshesRebuilt
+                << " rebuilt" << std::endl;
+    }
+  }
+  return 0;
+}
+
 void CommandLineUI::alert(const string &msg) { std::cerr << msg << std::endl; }
 
 void CommandLineUI::usage() {
   using namespace std;
   cerr << "usage: " << progName << " [options] [input.ray output.png]" << endl
+       << "       (output.pfm or output.exr for a linear float image)" << endl
+       << "       " << progName
+       << " [options] --load-snapshot <FILE> output.png" << endl
+       << "       " << progName << " [options] --server <SOCKET>" << endl
        << "  -r <#>      set recursion level (default " << m_nDepth << ")"
        << endl
        << "  -w <#>      set output image width (default " << m_nSize << ")"
        << endl
        << "  -j <FILE>   set parameters from JSON file" << endl
+       << "  -S          bin and sort secondary rays per block" << endl
+       << "  -s          print render statistics" << endl
+       << "  -p          render progressively, one sample per pixel per pass"
+       << endl
+       << "  -T <sec>    progressive, stop after this many seconds" << endl
+       << "  -n <#>      progressive, stop after this many samples per pixel "
+          "(default "
+       << m_progressiveSamples << ", 0 = no limit)" << endl
+       << "  -e <tol>    progressive, stop once the estimated error is below "
+          "tol (e.g. 0.002)"
+       << endl
+       << "  -a          also output depth, normal and albedo (pfm, exr)"
+       << endl
+       << "  -x <stops>  exposure for 8-bit output (default 0)" << endl
+       << "  -m <curve>  tone curve for 8-bit output: clamp (default), "
+          "reinhard"
+       << endl
+       << "  --region x0,y0,x1,y1    render only this part of the frame, "
+          "in pixels"
+       << endl
+       << "                          from the top left; png and exr "
+          "record where"
+       << endl
+       << "                          it goes"
+       << endl
+       << "  --tile i/N  render only the i-th of N horizontal strips (from 0)"
+       << endl
+       << "  --workers <#>           render on this many worker processes"
+       << endl
+       << "  --worker-cmd <CMD>      ... and/or one run by CMD, e.g. "
+          "\"ssh node ray\";"
+       << endl
+       << "                          may be given more than once" << endl
+       << "  --tile-timeout <sec>    drop a worker that takes longer on a "
+          "tile,"
+       << endl
+       << "                          or to load the scene" << endl
+       << "  --server <SOCKET>       keep scenes loaded and render them on "
+          "request,"
+       << endl
+       << "                          over this Unix domain socket" << endl
+       << "  --checkpoint <FILE>     save the render in progress here, to "
+          "resume it"
+       << endl
+       << "                          if it is stopped; removed once the "
+          "image is saved"
+       << endl
+       << "  --checkpoint-interval <sec>  how often (default "
+       << checkpointInterval << ", 0 = only when stopped)" << endl
+       << "  --resume    carry on from the --checkpoint, if there is one"
+       << endl
+       << "  --sequence <FILE>       render the frames of a keyframed "
+          "sequence; the"
+       << endl
+       << "                          output name gets the frame number "
+          "(or put %04d in it)"
+       << endl
        << "  -c <FILE>   one Cubemap file, the remainings will be "
           "detected automatically"
+       << endl
+       << "  --save-snapshot <FILE>  save the loaded scene, fully built, for"
+       << endl
+       << "                          --load-snapshot; the output image is "
+          "optional"
+       << endl
+       << "  --load-snapshot <FILE>  render a saved snapshot instead of a "
+          "scene file"
        << endl;
 }
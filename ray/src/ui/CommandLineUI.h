@@ -8,6 +8,7 @@
 #define __CommandLineUI_h__
 
 #include "TraceUI.h"
+#include <vector>
 
 class CommandLineUI : public TraceUI {
 public:
@@ -18,10 +19,42 @@ public:
 
 private:
   void usage();
+  std::vector<std::vector<string>> workerCommands() const;
+  string sceneTag() const;
+  int renderSequence(int width, int height);
 
   char *rayName;
-  char *imgName;
+  char *imgName; // null when only saving a snapshot
   char *progName;
+
+  string snapshotIn;  // --load-snapshot
+  string snapshotOut; // --save-snapshot
+
+  // --region x0,y0,x1,y1 or --tile i/N: render only part of the frame.
+  bool hasRegion = false;
+  int region[4];
+  int tileIndex = 0, tileCount = 0;
+
+  // Coordinator: --workers N local processes and/or a --worker-cmd for
+  // each remote one, given the options in workerArgs. --worker: be one.
+  int localWorkers = 0;
+  std::vector<string> workerCmds;
+  double tileTimeout = 0.0;
+  std::vector<string> workerArgs;
+  bool workerMode = false;
+
+  // --server SOCKET: keep scenes loaded and render them on request.
+  string serverSocket;
+
+  // --checkpoint FILE every --checkpoint-interval seconds; --resume from
+  // it.
+  string checkpointPath;
+  double checkpointInterval = 60.0;
+  bool resume = false;
+
+  // --sequence FILE: render the frames it keys, to imgName with the frame
+  // number in it.
+  string sequencePath;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "CubeMapChooser.h"
 #include "../scene/cubeMap.h"
 #include "../scene/material.h"
+#include "../scene/textureCache.h"
 #include "../ui/GraphicalUI.h"
 #include <iostream>
 
@@ -104,8 +105,12 @@ void CubeMapChooser::cb_ok(Fl_Widget *o, void *) {
       ch->caller->setCubeMap(new CubeMap());
     }
     cm = ch->caller->getCubeMap();
-    for (int i = 0; i < 6; i++)
-      cm->setNthMap(i, ch->cubeFace[i].release());
+    std::string files;
+    for (int i = 0; i < 6; i++) {
+      cm->setNthMap(i, std::move(ch->cubeFace[i]));
+      files += (i ? ";" : "") + ch->fn[i];
+    }
+    ch->caller->setCubeMapFiles(files);
     ch->caller->useCubeMap(true);
     ch->caller->m_filterSlider->activate();
     ch->caller->m_cubeMapCheckButton->activate();
@@ -201,7 +206,7 @@ void CubeMapChooser::cb_smartLoad(Fl_Widget *o, void *) {
 
 bool CubeMapChooser::loadImageInto(const char *curPath, int i, bool sync_dir) {
   try {
-    cubeFace[i].reset(new TextureMap(curPath));
+    cubeFace[i] = TextureCache::instance().get(curPath);
   } catch (TextureMapException &xcpt) {
     fb[i]->selection_color(FL_RED);
     fb[i]->value(0);
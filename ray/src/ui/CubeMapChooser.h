@@ -22,7 +22,7 @@ class CubeMapChooser {
   Fl_Button *cancel;
   Fl_File_Input *fi[6];
   Fl_Light_Button *fb[6];
-  std::unique_ptr<TextureMap> cubeFace[6];
+  std::shared_ptr<const TextureMap> cubeFace[6];
   std::string fn[6];
   std::string btnMsg[6];
 
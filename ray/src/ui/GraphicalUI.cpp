@@ -53,6 +53,7 @@ void GraphicalUI::cb_load_scene(Fl_Menu_ *o, void *) {
 
     if (pUI->raytracer->loadScene(newfile)) {
       print(buf, "Ray <%s>", newfile);
+      pUI->sceneFile = newfile;
       stopTracing(); // terminate the previous rendering
     } else
       print(buf, "Ray <Not Loaded>");
@@ -67,6 +68,33 @@ void GraphicalUI::cb_load_scene(Fl_Menu_ *o, void *) {
   }
 }
 
+// Read the scene file again for its lights and materials only, and
+// re-shade the last image with them (see RayTracer::relight), which is
+// much quicker than rendering it from scratch. Renders it in full if
+// there is no finished image of the scene at the current settings.
+void GraphicalUI::cb_relight(Fl_Menu_ *o, void *) {
+  pUI = whoami(o);
+  if (pUI->sceneFile.empty() ||
+      !pUI->raytracer->reloadShading(pUI->sceneFile.c_str()))
+    return;
+  pUI->nextRender = RELIGHT;
+  cb_render(pUI->m_renderButton, nullptr);
+}
+
+// Read the scene file again after it was edited, and trace only the parts
+// of the image the edits can have changed (see RayTracer::editScene), or
+// all of it if that can't be told.
+void GraphicalUI::cb_reload_scene(Fl_Menu_ *o, void *) {
+  pUI = whoami(o);
+  if (pUI->sceneFile.empty() ||
+      !pUI->raytracer->editScene(pUI->sceneFile.c_str()))
+    return;
+  pUI->m_debuggingWindow->m_debuggingView->setDirty();
+  pUI->m_debuggingWindow->redraw();
+  pUI->nextRender = RETRACE_EDITS;
+  cb_render(pUI->m_renderButton, nullptr);
+}
+
 void GraphicalUI::cb_load_cubemap(Fl_Menu_ *o, void *) {
   pUI = whoami(o);
   pUI->m_cubeMapChooser->show();
@@ -75,7 +103,8 @@ void GraphicalUI::cb_load_cubemap(Fl_Menu_ *o, void *) {
 void GraphicalUI::cb_save_image(Fl_Menu_ *o, void *) {
   pUI = whoami(o);
 
-  char *savefile = fl_file_chooser("Save Image?", "*.bmp", "save.bmp");
+  char *savefile = fl_file_chooser("Save Image?", "*.{bmp,png,pfm,exr}",
+                                   "save.bmp");
   if (savefile != NULL) {
     pUI->m_traceGlWindow->saveImage(savefile);
   }
@@ -208,6 +237,11 @@ void GraphicalUI::cb_bfCheckButton(Fl_Widget *o, void *) {
   pUI->m_backface = (((Fl_Check_Button *)o)->value() == 1);
 }
 
+void GraphicalUI::cb_progressiveCheckButton(Fl_Widget *o, void *) {
+  pUI = (GraphicalUI *)(o->user_data());
+  pUI->m_progressive = (((Fl_Check_Button *)o)->value() == 1);
+}
+
 void GraphicalUI::cb_aaCheckButton(Fl_Widget *o, void *) {
   pUI = (GraphicalUI *)(o->user_data());
   pUI->m_antiAlias = (((Fl_Check_Button *)o)->value() == 1);
@@ -260,7 +294,14 @@ void GraphicalUI::cb_render(Fl_Widget *o, void *) {
     auto t_now = t_start;
     auto t_elapsed =
         std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
-    pUI->raytracer->traceImage(width, height);
+    bool updated = false;
+    if (pUI->nextRender == RELIGHT)
+      updated = pUI->raytracer->relight();
+    else if (pUI->nextRender == RETRACE_EDITS)
+      updated = pUI->raytracer->retraceEdited();
+    if (!updated)
+      pUI->raytracer->traceImage(width, height);
+    pUI->nextRender = RENDER;
     clock_t intervalMS = pUI->refreshInterval * 100;
     while (!pUI->raytracer->checkRender()) {
       // check for input and refresh view every so often while
@@ -273,8 +314,12 @@ void GraphicalUI::cb_render(Fl_Widget *o, void *) {
       t_elapsed =
           std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
       if ((now - prev) / CLOCKS_PER_SEC * 1000 >= intervalMS) {
-        print(buffer, "Time: %.2f sec, Rays: %u", t_elapsed,
-              TraceUI::getCount());
+        if (pUI->progressive())
+          print(buffer, "Time: %.2f sec, Rays: %u, Samples: %d", t_elapsed,
+                TraceUI::getCount(), pUI->raytracer->samplesDone());
+        else
+          print(buffer, "Time: %.2f sec, Rays: %u", t_elapsed,
+                TraceUI::getCount());
         pUI->m_traceGlWindow->label(buffer);
         pUI->m_traceGlWindow->refresh();
         prev = now;
@@ -291,10 +336,14 @@ void GraphicalUI::cb_render(Fl_Widget *o, void *) {
     auto t_trace =
         std::chrono::duration<double, std::ratio<1>>(t_now - t_start).count();
     int imageRays = TraceUI::resetCount();
-    print(buffer, "Time: %.2f sec, Rays: %u, Aa: none", t_trace, imageRays);
+    if (pUI->progressive())
+      print(buffer, "Time: %.2f sec, Rays: %u, Samples: %d", t_trace,
+            imageRays, pUI->raytracer->samplesDone());
+    else
+      print(buffer, "Time: %.2f sec, Rays: %u, Aa: none", t_trace, imageRays);
     pUI->m_traceGlWindow->label(buffer);
     pUI->m_traceGlWindow->refresh();
-    if (pUI->aaSwitch() && !stopTrace) {
+    if (pUI->aaSwitch() && !pUI->progressive() && !stopTrace) {
       clock_t aaStart, aaTime;
       auto t_aaStart = std::chrono::high_resolution_clock::now();
       auto t_total =
@@ -408,6 +457,8 @@ void GraphicalUI::alert(const string &msg) { fl_alert("%s", msg.c_str()); }
 
 void GraphicalUI::setRayTracer(RayTracer *tracer) {
   TraceUI::setRayTracer(tracer);
+  tracer->setKeepGBuffer(true);
+  tracer->setTrackEdits(true);
   m_traceGlWindow->setRayTracer(tracer);
   m_debuggingWindow->m_debuggingView->setRayTracer(tracer);
 }
@@ -419,6 +470,10 @@ Fl_Menu_Item GraphicalUI::menuitems[] = {
      nullptr, 0, 0, 0, 0, 0},
     {"&Load Cubemap...", FL_ALT + 'c',
      (Fl_Callback *)GraphicalUI::cb_load_cubemap, nullptr, 0, 0, 0, 0, 0},
+    {"&Relight", FL_ALT + 'r', (Fl_Callback *)GraphicalUI::cb_relight, nullptr,
+     0, 0, 0, 0, 0},
+    {"Reloa&d Scene", FL_ALT + 'd', (Fl_Callback *)GraphicalUI::cb_reload_scene,
+     nullptr, 0, 0, 0, 0, 0},
     {"&Save Image...", FL_ALT + 's', (Fl_Callback *)GraphicalUI::cb_save_image,
      nullptr, 0, 0, 0, 0, 0},
     {"&Exit", FL_ALT + 'e', (Fl_Callback *)GraphicalUI::cb_exit, nullptr, 0, 0,
@@ -677,6 +732,13 @@ GraphicalUI::GraphicalUI() : refreshInterval(10) {
   m_debuggingDisplayCheckButton->callback(cb_debuggingDisplayCheckButton);
   m_debuggingDisplayCheckButton->value(m_displayDebuggingInfo);
 
+  // set up progressive rendering checkbox
+  m_progressiveCheckButton =
+      new Fl_Check_Button(170, 419, 110, 20, "Progressive");
+  m_progressiveCheckButton->user_data((void *)(this));
+  m_progressiveCheckButton->callback(cb_progressiveCheckButton);
+  m_progressiveCheckButton->value(m_progressive);
+
   m_mainWindow->callback(cb_exit2);
   m_mainWindow->when(FL_HIDE);
   m_mainWindow->end();
@@ -52,6 +52,7 @@ public:
   Fl_Check_Button *m_ssCheckButton;
   Fl_Check_Button *m_shCheckButton;
   Fl_Check_Button *m_bfCheckButton;
+  Fl_Check_Button *m_progressiveCheckButton;
 
   Fl_Button *m_renderButton;
   Fl_Button *m_stopButton;
@@ -74,6 +75,11 @@ public:
 private:
   clock_t refreshInterval;
 
+  // The scene file last loaded, which Relight and Reload read again, and
+  // how the next cb_render is to bring the image up to date.
+  string sceneFile;
+  enum { RENDER, RELIGHT, RETRACE_EDITS } nextRender = RENDER;
+
   // static class members
   static Fl_Menu_Item menuitems[];
 
@@ -81,6 +87,8 @@ private:
 
   static void cb_load_scene(Fl_Menu_ *o, void *v);
   static void cb_load_cubemap(Fl_Menu_ *o, void *v);
+  static void cb_relight(Fl_Menu_ *o, void *v);
+  static void cb_reload_scene(Fl_Menu_ *o, void *v);
   static void cb_save_image(Fl_Menu_ *o, void *v);
   static void cb_exit(Fl_Menu_ *o, void *v);
   static void cb_about(Fl_Menu_ *o, void *v);
@@ -109,6 +117,7 @@ private:
   static void cb_ssCheckButton(Fl_Widget *o, void *v);
   static void cb_shCheckButton(Fl_Widget *o, void *v);
   static void cb_bfCheckButton(Fl_Widget *o, void *v);
+  static void cb_progressiveCheckButton(Fl_Widget *o, void *v);
 
   static bool stopTrace;
   static GraphicalUI *pUI;
@@ -0,0 +1,382 @@
+#include "RenderCoordinator.h"
+
+#include "../RayTracer.h"
+#include "../fileio/images.h"
+#include "../fileio/pngstream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using std::string;
+using std::vector;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// Strips per worker: enough that fast workers can take more of them and
+// the last few don't leave most workers idle.
+const int STRIPS_PER_WORKER = 4;
+
+#ifndef _WIN32
+bool writeAll(int fd, const void *data, size_t n) {
+  const char *p = (const char *)data;
+  while (n > 0) {
+    ssize_t k = write(fd, p, n);
+    if (k < 0 && errno == EINTR)
+      continue;
+    if (k <= 0)
+      return false;
+    p += k;
+    n -= k;
+  }
+  return true;
+}
+#endif
+
+} // namespace
+
+struct RenderCoordinator::Worker {
+  pid_t pid = -1;
+  int in = -1;  // its stdin
+  int out = -1; // its stdout
+  string received;
+  bool ready = false;
+  int strip = -1; // the one it is working on, if any
+  Clock::time_point started; // its strip, or before ready, the worker
+};
+
+RenderCoordinator::RenderCoordinator(
+    const vector<vector<string>> &commands, double tileTimeout)
+    : commands(commands), tileTimeout(tileTimeout) {}
+
+#ifdef _WIN32
+
+bool RenderCoordinator::render(const char *, string &error) {
+  error = "worker processes are not supported on this platform";
+  return false;
+}
+
+int runTileWorker(RayTracer *, int, int) {
+  std::cerr << "--worker is not supported on this platform" << std::endl;
+  return 1;
+}
+
+#else
+
+bool RenderCoordinator::render(const char *imgName, string &error) {
+  // A worker that dies while we write to it should be an error from
+  // write(), not the end of us.
+  signal(SIGPIPE, SIG_IGN);
+
+  vector<Worker> workers(commands.size());
+  for (size_t w = 0; w < commands.size(); w++) {
+    int toChild[2], fromChild[2];
+    if (pipe(toChild) != 0 || pipe(fromChild) != 0) {
+      error = "couldn't create pipes for the workers";
+      return false;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      dup2(toChild[0], 0);
+      dup2(fromChild[1], 1);
+      close(toChild[0]);
+      close(toChild[1]);
+      close(fromChild[0]);
+      close(fromChild[1]);
+      // Don't let this worker hold the pipes of the ones before it open.
+      for (size_t v = 0; v < w; v++) {
+        close(workers[v].in);
+        close(workers[v].out);
+      }
+      vector<char *> argv;
+      for (const string &arg : commands[w])
+        argv.push_back(const_cast<char *>(arg.c_str()));
+      argv.push_back(nullptr);
+      execvp(argv[0], argv.data());
+      std::cerr << "Couldn't run worker " << argv[0] << ": "
+                << strerror(errno) << std::endl;
+      _exit(127);
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+    if (pid < 0) {
+      close(toChild[1]);
+      close(fromChild[0]);
+      continue;
+    }
+    workers[w].pid = pid;
+    workers[w].started = Clock::now();
+    workers[w].in = toChild[1];
+    workers[w].out = fromChild[0];
+    fcntl(workers[w].out, F_SETFL, O_NONBLOCK);
+  }
+
+  int width = 0, height = 0;
+  vector<int> stripRows; // first row of each strip, plus the end
+  vector<int> running;   // workers on each strip
+  vector<bool> done;
+  std::deque<int> queue;
+  size_t remaining = 0;
+
+  vector<unsigned char> image;
+  std::unique_ptr<PNGStreamWriter> png;
+
+  // How long strips have taken, to tell when one is running late.
+  double stripSeconds = 0.0;
+  int stripsTimed = 0;
+
+  auto drop = [&](Worker &wk, const string &why) {
+    if (wk.pid < 0)
+      return;
+    std::cerr << "Dropping worker " << wk.pid << ": " << why << std::endl;
+    kill(wk.pid, SIGKILL);
+    close(wk.in);
+    close(wk.out);
+    waitpid(wk.pid, nullptr, 0);
+    wk.pid = -1;
+    if (wk.strip >= 0 && --running[wk.strip] == 0 && !done[wk.strip])
+      queue.push_front(wk.strip);
+    wk.strip = -1;
+  };
+
+  auto start = [&](Worker &wk, int s) {
+    char line[128];
+    snprintf(line, sizeof line, "tile 0 %d %d %d\n", stripRows[s], width,
+             stripRows[s + 1]);
+    wk.strip = s;
+    wk.started = Clock::now();
+    running[s]++;
+    if (!writeAll(wk.in, line, strlen(line)))
+      drop(wk, "it stopped reading");
+  };
+
+  // Take in a finished strip, bottom row first like the buffers.
+  auto accept = [&](int s, const char *pixels) {
+    int y0 = stripRows[s], y1 = stripRows[s + 1];
+    // Strip rows count from the top, buffer rows from the bottom.
+    int b0 = height - y1, b1 = height - y0;
+    if (png)
+      png->addRows(b0, b1, (const unsigned char *)pixels);
+    else
+      memcpy(image.data() + size_t(b0) * width * 3, pixels,
+             size_t(b1 - b0) * width * 3);
+    done[s] = true;
+    remaining--;
+  };
+
+  // Handle whatever complete messages wk has sent.
+  auto handle = [&](Worker &wk) {
+    for (;;) {
+      size_t eol = wk.received.find('\n');
+      if (eol == string::npos)
+        return;
+      string line = wk.received.substr(0, eol);
+      int w, h, x0, y0, x1, y1;
+      long long n;
+      char end;
+      if (!wk.ready &&
+          sscanf(line.c_str(), "ready %d %d%c", &w, &h, &end) == 2) {
+        wk.received.erase(0, eol + 1);
+        if (width == 0 && w > 0 && h > 0) {
+          width = w;
+          height = h;
+          int strips = std::min(height, std::max<int>(1, STRIPS_PER_WORKER *
+                                                             workers.size()));
+          for (int s = 0; s <= strips; s++)
+            stripRows.push_back(int((long long)height * s / strips));
+          running.assign(strips, 0);
+          done.assign(strips, false);
+          for (int s = 0; s < strips; s++)
+            queue.push_back(s);
+          remaining = strips;
+          if (isPNGImage(imgName))
+            png.reset(new PNGStreamWriter(imgName, width, height));
+          else
+            image.resize(size_t(width) * height * 3);
+        } else if (w != width || h != height) {
+          drop(wk, "its frame is a different size");
+          return;
+        }
+        wk.ready = true;
+      } else if (wk.strip >= 0 &&
+                 sscanf(line.c_str(), "done %d %d %d %d %lld%c", &x0, &y0,
+                        &x1, &y1, &n, &end) == 5) {
+        int s = wk.strip;
+        if (x0 != 0 || x1 != width || y0 != stripRows[s] ||
+            y1 != stripRows[s + 1] || n != (long long)width * (y1 - y0) * 3) {
+          drop(wk, "it sent back the wrong tile");
+          return;
+        }
+        if (wk.received.size() < eol + 1 + n)
+          return;
+        if (!done[s]) {
+          accept(s, wk.received.data() + eol + 1);
+          stripSeconds +=
+              std::chrono::duration<double>(Clock::now() - wk.started).count();
+          stripsTimed++;
+        }
+        wk.received.erase(0, eol + 1 + n);
+        running[s]--;
+        wk.strip = -1;
+      } else {
+        drop(wk, "it sent '" + line + "'");
+        return;
+      }
+    }
+  };
+
+  auto alive = [&]() {
+    int n = 0;
+    for (Worker &wk : workers)
+      n += wk.pid >= 0;
+    return n;
+  };
+
+  while (width == 0 || remaining > 0) {
+    if (alive() == 0) {
+      error = width == 0 ? "no worker could load the scene"
+                         : "every worker has failed";
+      return false;
+    }
+
+    // Hand out strips: queued ones first, then second copies of those
+    // that have been running longest, once longer than strips usually
+    // take.
+    for (Worker &wk : workers) {
+      if (wk.pid < 0 || !wk.ready || wk.strip >= 0 || width == 0)
+        continue;
+      while (!queue.empty() && done[queue.front()])
+        queue.pop_front();
+      if (!queue.empty()) {
+        int s = queue.front();
+        queue.pop_front();
+        start(wk, s);
+        continue;
+      }
+      const Worker *slowest = nullptr;
+      for (const Worker &other : workers)
+        if (other.pid >= 0 && other.strip >= 0 && !done[other.strip] &&
+            running[other.strip] == 1 &&
+            (!slowest || other.started < slowest->started))
+          slowest = &other;
+      if (slowest && stripsTimed > 0) {
+        std::chrono::duration<double> taken = Clock::now() - slowest->started;
+        if (taken.count() > stripSeconds / stripsTimed)
+          start(wk, slowest->strip);
+      }
+    }
+
+    vector<pollfd> fds;
+    vector<Worker *> owners;
+    for (Worker &wk : workers) {
+      if (wk.pid < 0)
+        continue;
+      fds.push_back({wk.out, POLLIN, 0});
+      owners.push_back(&wk);
+    }
+    if (poll(fds.data(), fds.size(), 1000) < 0 && errno != EINTR) {
+      error = "poll failed";
+      return false;
+    }
+
+    for (size_t k = 0; k < fds.size(); k++) {
+      Worker &wk = *owners[k];
+      if (!fds[k].revents)
+        continue;
+      char chunk[65536];
+      ssize_t got = read(wk.out, chunk, sizeof chunk);
+      if (got > 0) {
+        wk.received.append(chunk, got);
+        handle(wk);
+      } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+        drop(wk, "it exited");
+      }
+    }
+
+    // A worker that never gets as far as ready (a hung ssh, say) would
+    // otherwise be waited for forever.
+    if (tileTimeout > 0) {
+      for (Worker &wk : workers) {
+        std::chrono::duration<double> taken = Clock::now() - wk.started;
+        if (wk.pid < 0 || taken.count() <= tileTimeout)
+          continue;
+        if (!wk.ready)
+          drop(wk, "it wasn't ready in time");
+        else if (wk.strip >= 0)
+          drop(wk, "its tile timed out");
+      }
+    }
+  }
+
+  // Everything is in. Workers still on a second copy, or still loading,
+  // are stopped; the rest are told to quit.
+  for (Worker &wk : workers) {
+    if (wk.pid < 0)
+      continue;
+    if (wk.strip >= 0 || !wk.ready)
+      kill(wk.pid, SIGKILL);
+    else
+      writeAll(wk.in, "quit\n", 5);
+    close(wk.in);
+    close(wk.out);
+    waitpid(wk.pid, nullptr, 0);
+  }
+
+  if (png)
+    return png->finish(error);
+  writeImage(imgName, width, height, image.data());
+  return true;
+}
+
+int runTileWorker(RayTracer *raytracer, int width, int height) {
+  // stdout is the protocol; anything else printed along the way goes to
+  // stderr instead.
+  FILE *protocol = fdopen(dup(1), "w");
+  dup2(2, 1);
+  if (!protocol)
+    return 1;
+
+  fprintf(protocol, "ready %d %d\n", width, height);
+  fflush(protocol);
+
+  char line[256];
+  while (fgets(line, sizeof line, stdin)) {
+    int x0, y0, x1, y1;
+    if (!strcmp(line, "quit\n"))
+      break;
+    if (sscanf(line, "tile %d %d %d %d", &x0, &y0, &x1, &y1) != 4) {
+      std::cerr << "Worker: unknown request " << line << std::endl;
+      return 1;
+    }
+    raytracer->setRegion(x0, y0, x1, y1);
+    raytracer->traceImage(width, height);
+    raytracer->waitRender();
+
+    unsigned char *buf;
+    int w, h;
+    raytracer->getBuffer(buf, w, h);
+    std::vector<unsigned char> pixels = raytracer->exportRows(0, h);
+    fprintf(protocol, "done %d %d %d %d %zu\n", x0, y0, x1, y1,
+            pixels.size());
+    if (fwrite(pixels.data(), 1, pixels.size(), protocol) != pixels.size() ||
+        fflush(protocol) != 0)
+      return 1;
+  }
+  return 0;
+}
+
+#endif
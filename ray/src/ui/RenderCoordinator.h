@@ -0,0 +1,56 @@
+//
+// RenderCoordinator.h
+//
+// Splits a frame into strips and renders them on worker processes.
+//
+
+#ifndef __RenderCoordinator_h__
+#define __RenderCoordinator_h__
+
+#include <string>
+#include <vector>
+
+/*
+ * The coordinator starts each worker as a child process and talks to it
+ * over its stdin and stdout. A worker is `ray --worker [options] scene`;
+ * it may be wrapped in another command (e.g. ssh) to run elsewhere, as
+ * long as its stdin and stdout come back to us. The protocol is lines of
+ * text, plus raw pixels after a "done":
+ *
+ *   worker:  ready <width> <height>      scene loaded, frame size
+ *   us:      tile <x0> <y0> <x1> <y1>    render this part (see setRegion)
+ *   worker:  done <x0> <y0> <x1> <y1> <n>
+ *            followed by n bytes: the part, 8-bit RGB, bottom row first
+ *   us:      quit                        (or just closing the pipe)
+ *
+ * Tiles are horizontal strips. Each worker has one at a time. Once none
+ * are left to hand out, idle workers are given copies of strips still
+ * running elsewhere, so a slow worker can't hold up the end of the
+ * frame; whichever copy comes back first is used. A worker that exits,
+ * breaks the protocol, or (with a timeout) sits on a strip too long is
+ * dropped and its strip goes back in the queue; with a timeout, so is
+ * one that takes longer than that to load the scene.
+ */
+class RenderCoordinator {
+public:
+  // Each command is the argv of one worker, starting with the program.
+  // tileTimeout is in seconds, 0 for none.
+  RenderCoordinator(const std::vector<std::vector<std::string>> &commands,
+                    double tileTimeout);
+
+  // Render the frame and write it to imgName. Returns false, with the
+  // reason in error, if it can't.
+  bool render(const char *imgName, std::string &error);
+
+private:
+  struct Worker;
+
+  std::vector<std::vector<std::string>> commands;
+  double tileTimeout;
+};
+
+// Serve tiles for a coordinator on stdin/stdout, as described above.
+class RayTracer;
+int runTileWorker(RayTracer *raytracer, int width, int height);
+
+#endif
@@ -0,0 +1,310 @@
+#include "RenderServer.h"
+
+#include "../RayTracer.h"
+#include "../ThreadPool.h"
+#include "../scene/scene.h"
+
+#include <chrono>
+#include <climits>
+#include <iostream>
+#include <json.hpp>
+#include <string.h>
+#include <thread>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+using std::string;
+
+struct RenderServer::Connection {
+  int fd;
+  std::thread thread;
+  bool done = false;
+};
+
+RenderServer::RenderServer(const string &socketPath, unsigned int threads)
+    : socketPath(socketPath), pool(new ThreadPool(threads)) {}
+
+RenderServer::~RenderServer() {}
+
+namespace {
+
+glm::dvec3 toVec3(const json &j) {
+  return glm::dvec3(j.at(0).get<double>(), j.at(1).get<double>(),
+                    j.at(2).get<double>());
+}
+
+// Change the fields of c that the request's "camera" object gives.
+void overrideCamera(Camera &c, const json &j) {
+  if (j.count("position"))
+    c.setEye(toVec3(j.at("position")));
+  if (j.count("viewdir") || j.count("updir")) {
+    glm::dvec3 view = j.count("viewdir") ? toVec3(j.at("viewdir"))
+                                         : c.getLook();
+    glm::dvec3 up = j.count("updir") ? toVec3(j.at("updir"))
+                                     : glm::normalize(c.getV());
+    c.setLook(view, up);
+  }
+  if (j.count("fov"))
+    c.setFOV(j.at("fov").get<double>());
+  if (j.count("aspectRatio"))
+    c.setAspectRatio(j.at("aspectRatio").get<double>());
+}
+
+json failure(const string &error) { return {{"ok", false}, {"error", error}}; }
+
+// The largest image a request may ask for (8192 x 8192), so that one
+// request can't run the server out of memory.
+const double MAX_PIXELS = 8192.0 * 8192.0;
+
+} // namespace
+
+// Load a scene file or snapshot and keep it as id, replacing any scene
+// already there. Returns the reason if it can't.
+string RenderServer::load(const string &id, const string &file,
+                          bool snapshot) {
+  std::shared_ptr<Scene> scene;
+  {
+    std::lock_guard<std::mutex> guard(loadLock);
+    RayTracer loader;
+    bool ok = snapshot ? loader.loadSnapshot(file.c_str())
+                       : loader.loadScene(file.c_str());
+    if (!ok || !loader.sceneLoaded())
+      return "couldn't load " + file;
+    scene = loader.sharedScene();
+  }
+  // Once built, the accelerators are only ever read, so any number of
+  // renders can share the scene.
+  scene->buildAccelerators();
+  std::lock_guard<std::mutex> guard(scenesLock);
+  scenes[id] = scene;
+  return "";
+}
+
+// Carry out one request and return the reply.
+string RenderServer::handle(const string &request) {
+  json reply;
+  try {
+    json req = json::parse(request);
+    string op = req.at("op").get<string>();
+
+    if (op == "load") {
+      string id = req.at("id").get<string>();
+      bool snapshot = req.count("snapshot") > 0;
+      string file = req.at(snapshot ? "snapshot" : "file").get<string>();
+      string error = load(id, file, snapshot);
+      reply = error.empty() ? json{{"ok", true}, {"id", id}} : failure(error);
+    } else if (op == "unload") {
+      // Renders already running keep their own reference to the scene.
+      string id = req.at("id").get<string>();
+      std::lock_guard<std::mutex> guard(scenesLock);
+      reply = scenes.erase(id) ? json{{"ok", true}}
+                               : failure("no scene '" + id + "'");
+    } else if (op == "list") {
+      json ids = json::array();
+      std::lock_guard<std::mutex> guard(scenesLock);
+      for (const auto &entry : scenes)
+        ids.push_back(entry.first);
+      reply = {{"ok", true}, {"scenes", ids}};
+    } else if (op == "render") {
+      string id = req.at("scene").get<string>();
+      string output = req.at("output").get<string>();
+      int width = req.at("width").get<int>();
+      std::shared_ptr<Scene> scene;
+      {
+        std::lock_guard<std::mutex> guard(scenesLock);
+        auto found = scenes.find(id);
+        if (found != scenes.end())
+          scene = found->second;
+      }
+      if (!scene)
+        return failure("no scene '" + id + "'").dump();
+
+      Camera camera = scene->getCamera();
+      if (req.count("camera"))
+        overrideCamera(camera, req.at("camera"));
+      int height;
+      if (req.count("height")) {
+        height = req.at("height").get<int>();
+        if (height > 0)
+          camera.setAspectRatio(double(width) / height);
+      } else {
+        double h = width / camera.getAspectRatio() + 0.5;
+        height = h < INT_MAX ? (int)h : INT_MAX;
+      }
+      if (width <= 0 || height <= 0)
+        return failure("the image must be at least one pixel").dump();
+      if (double(width) * height > MAX_PIXELS)
+        return failure("the image must be at most " +
+                       std::to_string((long long)MAX_PIXELS) + " pixels")
+            .dump();
+
+      auto start = std::chrono::steady_clock::now();
+      RayTracer raytracer;
+      raytracer.setScene(scene);
+      raytracer.setCamera(camera);
+      raytracer.setThreadPool(pool.get());
+      raytracer.traceImage(width, height);
+      raytracer.waitRender();
+      if (!raytracer.saveImage(output.c_str()))
+        return failure("couldn't save image " + output).dump();
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      reply = {{"ok", true},      {"output", output},
+               {"width", width},  {"height", height},
+               {"seconds", elapsed.count()}};
+    } else if (op == "shutdown") {
+      stopping = true;
+      reply = {{"ok", true}};
+    } else {
+      reply = failure("unknown op '" + op + "'");
+    }
+  } catch (const json::exception &e) {
+    reply = failure(string("bad request: ") + e.what());
+  } catch (const std::exception &e) {
+    // Out of memory, say; the other requests and scenes are unaffected.
+    reply = failure(string("request failed: ") + e.what());
+  }
+  return reply.dump();
+}
+
+#ifdef _WIN32
+
+bool RenderServer::run(string &error) {
+  error = "the render server is not supported on this platform";
+  return false;
+}
+
+void RenderServer::serve(Connection *) {}
+
+#else
+
+bool RenderServer::run(string &error) {
+  // A client that hangs up before its reply should be an error from
+  // send(), not the end of us.
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (socketPath.size() >= sizeof addr.sun_path) {
+    error = "socket path is too long";
+    return false;
+  }
+  strcpy(addr.sun_path, socketPath.c_str());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) {
+    error = string("couldn't create socket: ") + strerror(errno);
+    return false;
+  }
+  // A socket file left behind by a server that didn't shut down cleanly
+  // would stop bind. Only take it over if nobody answers on it.
+  if (connect(listener, (sockaddr *)&addr, sizeof addr) == 0) {
+    error = "another server is already listening on " + socketPath;
+    close(listener);
+    return false;
+  }
+  close(listener);
+  listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(socketPath.c_str());
+  if (bind(listener, (sockaddr *)&addr, sizeof addr) != 0 ||
+      listen(listener, 16) != 0) {
+    error = "couldn't listen on " + socketPath + ": " + strerror(errno);
+    close(listener);
+    return false;
+  }
+  std::cerr << "Listening on " << socketPath << std::endl;
+
+  while (!stopping) {
+    // Wake up now and then to notice a shutdown, and to join the
+    // threads of connections that have closed.
+    pollfd pfd = {listener, POLLIN, 0};
+    int ready = poll(&pfd, 1, 200);
+    {
+      std::lock_guard<std::mutex> guard(connectionsLock);
+      for (auto c = connections.begin(); c != connections.end();) {
+        if (!c->done) {
+          ++c;
+          continue;
+        }
+        c->thread.join();
+        c = connections.erase(c);
+      }
+    }
+    if (ready <= 0)
+      continue;
+    int fd = accept(listener, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    std::lock_guard<std::mutex> guard(connectionsLock);
+    connections.emplace_back();
+    Connection *c = &connections.back();
+    c->fd = fd;
+    c->thread = std::thread(&RenderServer::serve, this, c);
+  }
+
+  close(listener);
+  unlink(socketPath.c_str());
+
+  // Let requests in progress finish, but take no more.
+  {
+    std::lock_guard<std::mutex> guard(connectionsLock);
+    for (Connection &c : connections)
+      if (!c.done)
+        shutdown(c.fd, SHUT_RD);
+  }
+  for (Connection &c : connections)
+    c.thread.join();
+  connections.clear();
+  return true;
+}
+
+void RenderServer::serve(Connection *c) {
+  string received;
+  char chunk[4096];
+  for (;;) {
+    size_t eol = received.find('\n');
+    if (eol == string::npos) {
+      ssize_t got = recv(c->fd, chunk, sizeof chunk, 0);
+      if (got < 0 && errno == EINTR)
+        continue;
+      if (got <= 0)
+        break;
+      received.append(chunk, got);
+      continue;
+    }
+    string line = received.substr(0, eol);
+    received.erase(0, eol + 1);
+    if (line.find_first_not_of(" \t\r") == string::npos)
+      continue;
+
+    string reply = handle(line) + "\n";
+    const char *p = reply.data();
+    size_t n = reply.size();
+    while (n > 0) {
+      ssize_t k = send(c->fd, p, n, MSG_NOSIGNAL);
+      if (k < 0 && errno == EINTR)
+        continue;
+      if (k <= 0)
+        break;
+      p += k;
+      n -= k;
+    }
+    if (n > 0 || stopping)
+      break;
+  }
+
+  std::lock_guard<std::mutex> guard(connectionsLock);
+  close(c->fd);
+  c->done = true;
+}
+
+#endif
@@ -0,0 +1,75 @@
+//
+// RenderServer.h
+//
+// Keeps scenes loaded and renders them on request.
+//
+
+#ifndef __RenderServer_h__
+#define __RenderServer_h__
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class Scene;
+class ThreadPool;
+
+/*
+ * A long-running process that loads scenes once and then renders them
+ * as often as asked, so a render doesn't pay for parsing, texture
+ * decoding and BVH construction each time. Clients connect to a Unix
+ * domain socket and send requests, one JSON object per line; each gets
+ * one line back, {"ok": true, ...} or {"ok": false, "error": "..."}.
+ *
+ *   {"op": "load", "id": "s", "file": "scene.ray"}
+ *   {"op": "load", "id": "s", "snapshot": "scene.snap"}
+ *   {"op": "unload", "id": "s"}
+ *   {"op": "list"}
+ *   {"op": "render", "scene": "s", "width": 512, "output": "out.png",
+ *    "height": 384, "camera": {"position": [x, y, z],
+ *    "viewdir": [x, y, z], "updir": [x, y, z], "fov": 45}}
+ *   {"op": "shutdown"}
+ *
+ * "height" and "camera" are optional. A height sets the aspect ratio; by
+ * default it follows from the camera's, as on the command line. Camera
+ * fields are those of a JSON scene's camera, and any left out keep the
+ * scene's values.
+ *
+ * Requests on one connection are answered in order; renders on separate
+ * connections run at the same time, sharing one pool of threads. Every
+ * other setting (depth, samples, output options) is the server's own,
+ * from its command line.
+ */
+class RenderServer {
+public:
+  RenderServer(const std::string &socketPath, unsigned int threads);
+  ~RenderServer();
+
+  // Serve until asked to shut down. Returns false, with the reason in
+  // error, if the socket can't be set up.
+  bool run(std::string &error);
+
+private:
+  struct Connection;
+
+  void serve(Connection *c);
+  std::string handle(const std::string &request);
+  std::string load(const std::string &id, const std::string &file,
+                   bool snapshot);
+
+  std::string socketPath;
+  std::unique_ptr<ThreadPool> pool;
+
+  std::map<std::string, std::shared_ptr<Scene>> scenes;
+  std::mutex scenesLock;
+  std::mutex loadLock; // the parsers aren't safe to run twice at once
+
+  std::atomic<bool> stopping{false};
+  std::list<Connection> connections;
+  std::mutex connectionsLock;
+};
+
+#endif
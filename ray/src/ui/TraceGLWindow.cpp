@@ -8,7 +8,6 @@
 #include "GraphicalUI.h"
 #include "TraceGLWindow.h"
 
-#include "../fileio/bitmap.h"
 
 extern bool debugMode;
 extern TraceUI *traceUI;
@@ -105,11 +104,7 @@ void TraceGLWindow::resizeWindow(int width, int height) {
 }
 
 void TraceGLWindow::saveImage(char *iname) {
-  unsigned char *buf;
-
-  raytracer->getBuffer(buf, m_nDrawWidth, m_nDrawHeight);
-  if (buf)
-    writeBMP(iname, m_nDrawWidth, m_nDrawHeight, buf);
+  raytracer->saveImage(iname);
 }
 
 void TraceGLWindow::setRayTracer(RayTracer *tracer) { raytracer = tracer; }
@@ -5,8 +5,10 @@
 #else
 #include <dirent.h>
 #endif
+#include "../parser/MeshCache.h"
 #include "../scene/cubeMap.h"
 #include "../scene/material.h"
+#include "../scene/textureCache.h"
 
 /*
  * JSON for Modern C++
@@ -29,6 +31,7 @@ template <typename T> void load(Json &j, const string &field, T &target) {
 TraceUI::TraceUI() {
   for (unsigned int i = 0; i < MAX_THREADS; i++)
     rayCount[i] = 0;
+  resetStats();
 }
 
 TraceUI::~TraceUI() {}
@@ -55,6 +58,22 @@ void TraceUI::loadFromJson(const char *file) {
   load(json, "shadows", m_shadows);
   load(json, "smoothshade", m_smoothshade);
   load(json, "backface_culling", m_backface);
+  load(json, "ray_sorting", m_raySorting);
+  load(json, "russian_roulette", m_russianRoulette);
+  load(json, "light_cutoff", m_lightCutoff);
+  load(json, "max_lights", m_maxLights);
+  load(json, "texture_cache_mb", m_textureCacheMB);
+  TextureCache::instance().setBudget(size_t(m_textureCacheMB) << 20);
+  load(json, "mesh_cache", MeshCache::enabled);
+  load(json, "mesh_cache_dir", MeshCache::directory);
+  load(json, "stats", m_stats);
+  load(json, "progressive", m_progressive);
+  load(json, "progressive_samples", m_progressiveSamples);
+  load(json, "progressive_time", m_progressiveTime);
+  load(json, "progressive_tolerance", m_progressiveTolerance);
+  load(json, "aovs", m_aovs);
+  load(json, "exposure", m_exposure);
+  load(json, "tone_map", m_toneMap);
   /*
    * Note for Students:
    * The following options are legacy from previous semesters.
@@ -144,14 +163,19 @@ void TraceUI::smartLoadCubemap(const string &file) {
     if (!getCubeMap()) {
       setCubeMap(new CubeMap());
     }
+    string files;
     try {
-      for (int i = 0; i < 6; i++)
-        cubemap->setNthMap(i, new TextureMap(pdir + "/" + matched_fn[i]));
+      for (int i = 0; i < 6; i++) {
+        string path = pdir + "/" + matched_fn[i];
+        cubemap->setNthMap(i, TextureCache::instance().get(path));
+        files += (i ? ";" : "") + path;
+      }
     } catch (TextureMapException &xcpt) {
       cubemap.reset();
       std::cerr << xcpt.message() << std::endl;
       return;
     }
+    setCubeMapFiles(files);
     useCubeMap(true);
   }
 }
@@ -49,8 +49,22 @@ public:
   bool cubeMap() const { return m_usingCubeMap && cubemap; }
   CubeMap *getCubeMap() const { return cubemap.get(); }
   void setCubeMap(CubeMap *cm);
+  // The files the cubemap was loaded from, to tell one from another.
+  const string &getCubeMapFiles() const { return m_cubeMapFiles; }
+  void setCubeMapFiles(const string &files) { m_cubeMapFiles = files; }
   bool internalReflection() const { return m_internalReflection; }
   bool backfaceSpecular() const { return m_backfaceSpecular; }
+  bool raySorting() const { return m_raySorting; }
+  bool russianRoulette() const { return m_russianRoulette; }
+  double getLightCutoff() const { return m_lightCutoff; }
+  int getMaxLights() const { return m_maxLights; }
+  bool progressive() const { return m_progressive; }
+  int getProgressiveSamples() const { return m_progressiveSamples; }
+  double getProgressiveTime() const { return m_progressiveTime; }
+  double getProgressiveTolerance() const { return m_progressiveTolerance; }
+  bool aovs() const { return m_aovs; }
+  double getExposure() const { return m_exposure; }
+  const string &getToneMap() const { return m_toneMap; }
 
   // ray counter
   static void addRays(int number, int ctr) {
@@ -84,8 +98,53 @@ public:
     return total;
   }
 
+  // render statistics, kept per thread like the ray counter. Only
+  // collected while m_stats is set, so normal renders pay nothing.
+  enum Stat {
+    BVH_NODE_VISITS,   // bounding volume nodes tested
+    BVH_NODE_MISSES,   // ... that fell out of the simulated node cache
+    SORTED_RAYS,       // secondary rays reordered before traversal
+    SHADOW_QUERIES,    // shadow rays cast towards a light
+    SHADOW_CACHE_HITS, // ... answered by the light's last occluder
+    LIGHTS_SHADED,     // lights evaluated by Material::shade
+    NUM_STATS
+  };
+  static void addStat(Stat s, int ctr, long long number = 1) {
+    if (m_stats && ctr >= 0)
+      statCount[s][ctr] += number;
+  }
+  static long long getStat(Stat s) {
+    long long total = 0;
+    for (int i = 0; i < m_threads; i++)
+      total += statCount[s][i];
+    return total;
+  }
+  static void resetStats() {
+    for (int s = 0; s < NUM_STATS; s++)
+      for (int i = 0; i < MAX_THREADS; i++)
+        statCount[s][i] = 0;
+  }
+
+  // Record a visit to an acceleration structure node. Besides counting
+  // the visit, this runs the node address through a small direct-mapped
+  // cache per thread; its miss rate is a cheap, deterministic stand-in
+  // for how well consecutive rays share their working set.
+  static void touchNode(const void *node, int ctr) {
+    static constexpr int kCacheLines = 512;
+    thread_local const void *lines[kCacheLines] = {};
+    if (!m_stats || ctr < 0)
+      return;
+    size_t slot = (reinterpret_cast<size_t>(node) >> 6) % kCacheLines;
+    statCount[BVH_NODE_VISITS][ctr]++;
+    if (lines[slot] != node) {
+      lines[slot] = node;
+      statCount[BVH_NODE_MISSES][ctr]++;
+    }
+  }
+
   static int m_threads; // number of threads to run
   static bool m_debug;
+  static bool m_stats; // collect render statistics?
 
   static bool matchCubemapFiles(const string &one_cubemap_file,
                                 string matched_fn[6], string &pdir);
@@ -104,6 +163,7 @@ protected:
   int m_nFilterWidth = 1;   // width of cubemap filter
 
   static int rayCount[MAX_THREADS]; // Ray counter
+  static long long statCount[NUM_STATS][MAX_THREADS]; // Render statistics
 
   // Determines whether or not to show debugging information
   // for individual rays.  Disabled by default for efficiency
@@ -119,8 +179,24 @@ protected:
       true; // Enable reflection inside a translucent object.
   bool m_backfaceSpecular = false; // Enable specular component even seeing
                                    // through the back of a translucent object.
+  bool m_raySorting = false; // bin and sort secondary rays per block
+  bool m_russianRoulette = false; // Randomly continue rays below threshold
+                                  // instead of cutting them off.
+  double m_lightCutoff = 0.0; // Skip lights contributing less than this
+  int m_maxLights = 0; // Sample this many lights per hit if more remain
+                       // after culling (0 = shade them all)
+  int m_textureCacheMB = 256; // Memory budget of the shared texture cache
+  bool m_progressive = false; // Render in passes of one sample per pixel
+  int m_progressiveSamples = 64; // Stop after this many passes (0 = no limit)
+  double m_progressiveTime = 0.0; // ... or after this many seconds (0 = none)
+  double m_progressiveTolerance = 0.0; // ... or once the estimated error of
+                                       // the image is below this (0 = never)
+  bool m_aovs = false; // Also render depth, normal and albedo images
+  double m_exposure = 0.0; // Stops to scale by when exporting 8-bit images
+  string m_toneMap = "clamp"; // ... and the curve to apply: clamp, reinhard
 
   std::unique_ptr<CubeMap> cubemap;
+  string m_cubeMapFiles;
 
   void loadFromJson(const char *file);
   void smartLoadCubemap(const string &file);
@@ -431,37 +431,35 @@ void DebuggingView::drawScene() {
 void DebuggingView::drawRays() {
   glDisable(GL_LIGHTING);
   // Now draw all the rays
-  for (std::vector<std::pair<ray *, isect *>>::const_iterator rayItr =
-           raytracer->getScene().intersectCache.begin();
-       rayItr != raytracer->getScene().intersectCache.end(); ++rayItr) {
-    switch (rayItr->first->type()) {
+  auto draw = [&](const DebugRayLog::Record &rec) {
+    switch (rec.type) {
     case ray::VISIBILITY:
       if (!m_showVisibilityRays)
-        continue;
+        return;
       glColor4f(1.0f, 1.0f, 0.0f, 1.0f);
       break;
 
     case ray::REFLECTION:
       if (!m_showReflectionRays)
-        continue;
+        return;
       glColor4f(1.0f, 1.0f, 0.0f, 1.0f);
       break;
 
     case ray::REFRACTION:
       if (!m_showRefractionRays)
-        continue;
+        return;
       glColor4f(1.0f, 1.0f, 0.0f, 1.0f);
       break;
 
     case ray::SHADOW:
       if (!m_showShadowRays)
-        continue;
+        return;
       glColor4f(0.20f, 0.45f, 0.72f, 1.0f);
       break;
     }
-    glm::dvec3 p = rayItr->first->getPosition();
-    glm::dvec3 d = rayItr->first->getDirection();
-    glm::dvec3 isectPoint = p + rayItr->second->getT() * d;
+    glm::dvec3 p = rec.position;
+    glm::dvec3 d = rec.direction;
+    glm::dvec3 isectPoint = p + rec.t * d;
 
     glEnable(GL_LINE_STIPPLE);
     glLineStipple(1, 0x3333);
@@ -480,11 +478,12 @@ void DebuggingView::drawRays() {
       glBegin(GL_LINES);
       glColor4f(0.5f, 1.0f, 0.5f, 1.0f);
       glVertex3d(0.0, 0.0, 0.0);
-      glVertex3dv(&(rayItr->second->getN()[0]));
+      glVertex3dv(&rec.normal[0]);
       glEnd();
       glPopMatrix();
     }
-  }
+  };
+  raytracer->getScene().getDebugRays().forEach(draw);
   glEnd();
   glEnable(GL_LIGHTING);
 }